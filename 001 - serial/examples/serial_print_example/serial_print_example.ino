@@ -18,8 +18,27 @@
 // include serial_utils.h
 #define DEBUG
 
+// When this macro is defined, sout and dbg send the values in binary and
+// the formatting is done on your computer, which is much quicker on the board.
+// You need to use python/serlogdecode.py to see the messages rather than
+// the Serial Monitor. Again you must define this BEFORE you include serial_utils.h
+//#define SERIAL_BINARY_LOG
+
+// sout and dbg check the format string against the arguments when you compile and
+// format each value by its type without using vsnprintf. If you need them to
+// use the old serial_printf() instead, define this macro before you include serial_utils.h
+//#define SERIAL_USE_PRINTF
+
+// When this macro is defined, sout and dbg put the text in a queue of this many bytes
+// and it is sent when the serial hardware has room, so printing never holds up
+// your code. Call serial_tx_poll() in your loop() to keep the queue moving.
+//#define SERIAL_TX_QUEUE_SIZE 256
+
 #include "serial_utils.h"
 
+// now_cycles() times things in CPU cycles, which is much finer than micros()
+#include "cycle_timer.h"
+
 
  
 void setup() 
@@ -27,6 +46,9 @@ void setup()
   // Start the serial support
   Serial.begin(115200);
 
+  // and the cycle counter we time the printing with
+  cycle_timer_begin();
+
   // Scroll down a bit and say hello
   sout("\n\n\n\n\nHello"); 
   sout("Welcome to simplified debugging :)");
@@ -46,13 +68,13 @@ void loop()
   long time_ms = millis();
 
   // measure how long this takes
-  long start = micros();
+  cycles_t start = now_cycles();
 
   // Print out all the values.
-  // To print the float we need to format it as a string first so the conversion
-  // string we use to print it out is %s, not %f 
-  sout("Time: %6ld ms, byte: 0x%2.2X, int: %5d, long: %11ld, float: %s",
-      time_ms, g_byte_val, g_int_val, g_long_val, f2s(g_float_val, 2));
+  // The float can be printed with %f. You can also format it as a string first
+  // with f2s() or F2S() and print it with %s.
+  sout("Time: %6ld ms, byte: 0x%2.2X, int: %5d, long: %11ld, float: %.2f",
+      time_ms, g_byte_val, g_int_val, g_long_val, g_float_val);
 
   // Make some changes so we aren't printing out the same values all the time
   g_byte_val *= 27;
@@ -60,12 +82,16 @@ void loop()
   g_long_val += time_ms; 
   g_float_val *= 1.002;
 
-  long elapsed = micros() - start;
+  cycles_t elapsed = cycles_since(start);
 
   // Just as an example we only print the elapsed time in the debug build
   // To turn this off, comment out the #define DEBUG statement at the top of the program
-  dbg("Elapsed time: %ld us", elapsed);
+  dbg("Elapsed time: %lu us (%lu cycles)", (unsigned long)cycles_to_us(elapsed), (unsigned long)elapsed);
   
   // wait a bit before we go around again
-  delay(1000); // 1 second
+  // keeping the transmit queue moving while we do
+  uint32_t wait_start = millis();
+  while ((millis() - wait_start) < 1000) { // 1 second
+    serial_tx_poll();
+  }
 }
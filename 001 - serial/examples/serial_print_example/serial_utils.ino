@@ -10,24 +10,755 @@ void serial_printf(const char* fmt, ...)
   // buffer to assemble the text into.
   // NOTE: limited size!
   char buf[128]; 
+  size_t len = 0;
 
-  // format the output string
   va_list args;
   va_start (args, fmt);
-  vsnprintf (buf, 127, fmt, args);
 
-  // send it out
-  Serial.println(buf);
+  // Format the output string one conversion at a time so we can
+  // do %f ourselves
+  const char* p = fmt;
+  while (*p && (len < sizeof(buf) - 1)) {
+    if (*p != '%') {
+      buf[len++] = *p++;
+      continue;
+    }
+
+    // collect the conversion spec like %-8.3lf
+    char spec[16];
+    uint8_t spec_len = 0;
+    int width = 0;
+    int precision = -1;
+    bool left = false;
+    bool zeros = false;
+    uint8_t longs = 0;
+    spec[spec_len++] = *p++;
+    while (*p && strchr("-+ #0", *p)) {
+      if (*p == '-') left = true;
+      if (*p == '0') zeros = true;
+      if (spec_len < sizeof(spec) - 2) spec[spec_len++] = *p;
+      p++;
+    }
+    while ((*p >= '0') && (*p <= '9')) {
+      width = width * 10 + (*p - '0');
+      if (spec_len < sizeof(spec) - 2) spec[spec_len++] = *p;
+      p++;
+    }
+    if (*p == '.') {
+      precision = 0;
+      if (spec_len < sizeof(spec) - 2) spec[spec_len++] = *p;
+      p++;
+      while ((*p >= '0') && (*p <= '9')) {
+        precision = precision * 10 + (*p - '0');
+        if (spec_len < sizeof(spec) - 2) spec[spec_len++] = *p;
+        p++;
+      }
+    }
+    while ((*p == 'l') || (*p == 'h')) {
+      if (*p == 'l') longs++;
+      if (spec_len < sizeof(spec) - 2) spec[spec_len++] = *p;
+      p++;
+    }
+    char conv = *p;
+    if (conv == 0) {
+      break;
+    }
+    p++;
+    spec[spec_len++] = conv;
+    spec[spec_len] = 0;
+
+    char* p_out = &buf[len];
+    size_t room = sizeof(buf) - len;
+    int n = 0;
+    switch (conv) {
+    case 'f':
+    case 'F':
+    {
+      // floats are passed as doubles
+      char fbuf[F2S_MAX_LEN];
+      f2s((float)va_arg(args, double), (precision < 0) ? 6 : precision, fbuf, sizeof(fbuf));
+      int pad = width - (int)strlen(fbuf);
+      char fill = (zeros && !left) ? '0' : ' ';
+      const char* f = fbuf;
+      if ((fill == '0') && (*f == '-')) {
+        // the sign goes before the zeros
+        if (n < (int)room - 1) p_out[n++] = *f;
+        f++;
+      }
+      for (; !left && (pad > 0); pad--) {
+        if (n < (int)room - 1) p_out[n++] = fill;
+      }
+      while (*f) {
+        if (n < (int)room - 1) p_out[n++] = *f;
+        f++;
+      }
+      for (; pad > 0; pad--) {
+        if (n < (int)room - 1) p_out[n++] = ' ';
+      }
+      break;
+    }
+    case 'd':
+    case 'i':
+      if (longs > 1) {
+        // there's no %lld on the AVR so just take it off the list
+        (void)va_arg(args, long long);
+        n = snprintf(p_out, room, "%s", spec);
+      } else if (longs) {
+        n = snprintf(p_out, room, spec, va_arg(args, long));
+      } else {
+        n = snprintf(p_out, room, spec, va_arg(args, int));
+      }
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      if (longs > 1) {
+        (void)va_arg(args, unsigned long long);
+        n = snprintf(p_out, room, "%s", spec);
+      } else if (longs) {
+        n = snprintf(p_out, room, spec, va_arg(args, unsigned long));
+      } else {
+        n = snprintf(p_out, room, spec, va_arg(args, unsigned int));
+      }
+      break;
+    case 'c':
+      n = snprintf(p_out, room, spec, va_arg(args, int));
+      break;
+    case 's':
+      n = snprintf(p_out, room, spec, va_arg(args, const char*));
+      break;
+    case 'p':
+      n = snprintf(p_out, room, spec, va_arg(args, void*));
+      break;
+    case '%':
+      n = snprintf(p_out, room, "%%");
+      break;
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      // we can't format these but we know the argument was a double
+      (void)va_arg(args, double);
+      n = snprintf(p_out, room, "%s", spec);
+      break;
+    default:
+      // Not something we know about so we don't know how big its argument
+      // is either. Show it and the rest of the format as they are rather
+      // than read the arguments after it from the wrong place.
+      n = snprintf(p_out, room, "%s%s", spec, p);
+      p += strlen(p);
+      break;
+    }
+
+    // snprintf tells us how long it wanted to be, not how much it wrote
+    if (n > 0) {
+      len += ((size_t)n < room) ? n : (room - 1);
+    }
+  }
 
   // tidy up
   va_end (args);
+
+  // send it out with a line ending like Serial.println does
+  serial_msg_begin();
+  serial_write((const uint8_t*)buf, len);
+  serial_write((const uint8_t*)"\r\n", 2);
+  serial_msg_end();
+}
+
+bool _SoutFmt::next(_SoutSpec& spec)
+{
+  for (;;) {
+    // send the text up to the next %
+    const char* p = m_p;
+    while (*p && (*p != '%')) {
+      p++;
+    }
+    if (p != m_p) {
+      serial_write((const uint8_t*)m_p, p - m_p);
+    }
+    m_p = p;
+    if (*p == 0) {
+      return false;
+    }
+
+    p++;
+    if (*p == '%') {
+      serial_write((const uint8_t*)p, 1);
+      m_p = p + 1;
+      continue;
+    }
+
+    // read the conversion spec like %-8.3lf
+    spec.flags = 0;
+    spec.width = 0;
+    spec.precision = -1;
+    for (;; p++) {
+      if (*p == '-') spec.flags |= SOUT_LEFT;
+      else if (*p == '+') spec.flags |= SOUT_PLUS;
+      else if (*p == ' ') spec.flags |= SOUT_SPACE;
+      else if (*p == '0') spec.flags |= SOUT_ZERO;
+      else if (*p != '#') break;
+    }
+    while ((*p >= '0') && (*p <= '9')) {
+      spec.width = spec.width * 10 + (*p++ - '0');
+    }
+    if (*p == '.') {
+      p++;
+      spec.precision = 0;
+      while ((*p >= '0') && (*p <= '9')) {
+        spec.precision = spec.precision * 10 + (*p++ - '0');
+      }
+    }
+    while ((*p == 'l') || (*p == 'h') || (*p == 'L')) {
+      p++;
+    }
+    spec.conv = *p;
+    if (*p == 0) {
+      // a % at the very end
+      m_p = p;
+      return false;
+    }
+    m_p = p + 1;
+    return true;
+  }
+}
+
+void _SoutFmt::finish()
+{
+  // send what's left. The compiler has already checked there
+  // aren't any conversions without an argument.
+  _SoutSpec spec;
+  while (next(spec)) {
+  }
+  serial_write((const uint8_t*)"\r\n", 2);
+}
+
+// Send a character n times
+static void _soutFill(char c, int n)
+{
+  char fill[8];
+  memset(fill, c, sizeof(fill));
+  while (n > 0) {
+    int len = (n < (int)sizeof(fill)) ? n : sizeof(fill);
+    serial_write((const uint8_t*)fill, len);
+    n -= len;
+  }
+}
+
+// Send a formatted field padded out to the width in the spec.
+// zeros is the number of leading zeros the value itself needs.
+static void _soutField(const _SoutSpec& spec, char sign, const char* p_body, uint8_t len, int zeros)
+{
+  int pad = (int)spec.width - len - zeros - (sign ? 1 : 0);
+  if (!(spec.flags & SOUT_LEFT)) {
+    if ((spec.flags & SOUT_ZERO) && (spec.precision < 0 || spec.conv == 'f' || spec.conv == 'F')) {
+      // the padding zeros go after the sign
+      zeros += (pad > 0) ? pad : 0;
+    } else {
+      _soutFill(' ', pad);
+    }
+    pad = 0;
+  }
+  if (sign) {
+    serial_write((const uint8_t*)&sign, 1);
+  }
+  _soutFill('0', zeros);
+  serial_write((const uint8_t*)p_body, len);
+  _soutFill(' ', pad);
+}
+
+// The sign character to show for a number
+static char _soutSign(const _SoutSpec& spec, bool negative)
+{
+  return negative ? '-' : (spec.flags & SOUT_PLUS) ? '+' : (spec.flags & SOUT_SPACE) ? ' ' : 0;
+}
+
+void _soutInt(const _SoutSpec& spec, uint32_t value, bool negative)
+{
+  if (spec.conv == 'c') {
+    char c = (char)value;
+    _soutField(spec, 0, &c, 1, 0);
+    return;
+  }
+
+  uint8_t base = 10;
+  char ten = 'a'; // what to use for the digit after 9
+  switch (spec.conv) {
+  case 'X':
+    ten = 'A';
+    // fall through
+  case 'x':
+  case 'p':
+    base = 16;
+    break;
+  case 'o':
+    base = 8;
+    break;
+  }
+
+  // the digits come out backwards so fill the buffer from the end.
+  // 32 bits in octal is 11 digits.
+  char digits[11];
+  uint8_t n = sizeof(digits);
+  if (base == 10) {
+    while (value) {
+      digits[--n] = '0' + (value % 10);
+      value /= 10;
+    }
+  } else {
+    uint8_t shift = (base == 16) ? 4 : 3;
+    while (value) {
+      uint8_t d = value & (base - 1);
+      digits[--n] = (d < 10) ? ('0' + d) : (ten + d - 10);
+      value >>= shift;
+    }
+  }
+  uint8_t len = sizeof(digits) - n;
+
+  // printf shows a zero unless the precision is 0
+  int precision = (spec.precision < 0) ? 1 : spec.precision;
+  int zeros = (precision > len) ? precision - len : 0;
+  if (spec.conv == 'p') {
+    // like printf a pointer has 0x in front, and there's room for that as
+    // a pointer is never more than 8 hex digits
+    if (len == 0) {
+      digits[--n] = '0';
+      len++;
+    }
+    digits[--n] = 'x';
+    digits[--n] = '0';
+    len += 2;
+    _SoutSpec ptr = spec;
+    ptr.flags &= ~SOUT_ZERO;
+    _soutField(ptr, 0, &digits[n], len, 0);
+    return;
+  }
+  char sign = (base == 10) ? _soutSign(spec, negative) : 0;
+  _soutField(spec, sign, &digits[n], len, zeros);
+}
+
+void _soutFloat(const _SoutSpec& spec, float value)
+{
+  char buf[F2S_MAX_LEN];
+  f2s(value, (spec.precision < 0) ? 6 : spec.precision, buf, sizeof(buf));
+  const char* p = buf;
+  bool negative = (*p == '-');
+  if (negative) {
+    p++;
+  }
+  _soutField(spec, _soutSign(spec, negative), p, strlen(p), 0);
+}
+
+void _soutStr(const _SoutSpec& spec, const char* s)
+{
+  if (s == NULL) {
+    s = "(null)";
+  }
+  size_t len = strlen(s);
+  if ((spec.precision >= 0) && (len > (size_t)spec.precision)) {
+    len = spec.precision;
+  }
+  _SoutSpec str = spec;
+  str.flags &= ~SOUT_ZERO;
+  _soutField(str, 0, s, (len > 255) ? 255 : len, 0);
+}
+
+void _soutStr(const _SoutSpec& spec, const __FlashStringHelper* s)
+{
+  // copy it out of the flash memory a piece at a time
+  PGM_P p = (PGM_P)s;
+  size_t len = strlen_P(p);
+  if ((spec.precision >= 0) && (len > (size_t)spec.precision)) {
+    len = spec.precision;
+  }
+  int pad = (int)spec.width - (int)len;
+  if (!(spec.flags & SOUT_LEFT)) {
+    _soutFill(' ', pad);
+    pad = 0;
+  }
+  char buf[16];
+  while (len) {
+    size_t n = (len < sizeof(buf)) ? len : sizeof(buf);
+    memcpy_P(buf, p, n);
+    serial_write((const uint8_t*)buf, n);
+    p += n;
+    len -= n;
+  }
+  _soutFill(' ', pad);
+}
+
+#ifdef SERIAL_TX_QUEUE_SIZE
+
+// The transmit queue. We only use it from the foreground so
+// it doesn't need any locks.
+static uint8_t s_tx_queue[SERIAL_TX_QUEUE_SIZE];
+static size_t s_tx_head = 0; // where the next byte goes in
+static size_t s_tx_count = 0; // how many bytes are waiting
+static uint32_t s_tx_dropped = 0;
+
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+
+// The lengths of the whole messages in the queue, oldest first. The message
+// we're still writing isn't one of them. Its bytes are at the head end of the
+// queue and aren't sent until it's finished, so we can still take it back out.
+static uint16_t s_tx_lens[SERIAL_TX_MAX_MESSAGES];
+static uint8_t s_tx_first = 0; // the oldest one
+static uint8_t s_tx_msgs = 0;
+static bool s_tx_started = false; // some of the oldest one has been sent
+static size_t s_tx_open = 0; // the bytes of the message we're writing
+static uint8_t s_tx_depth = 0; // serial_msg_begin() calls without an end
+static bool s_tx_discard = false; // throw away the rest of this message
+
+// Throw away the message we're writing
+void _txDropOpen()
+{
+  s_tx_head = (s_tx_head + SERIAL_TX_QUEUE_SIZE - s_tx_open) % SERIAL_TX_QUEUE_SIZE;
+  s_tx_count -= s_tx_open;
+  s_tx_dropped += s_tx_open;
+  s_tx_open = 0;
+  s_tx_discard = true;
+}
+
+#if SERIAL_TX_POLICY == SERIAL_TX_DROP_OLDEST
+
+// Throw away the oldest whole message that we haven't started sending.
+// Returns false if there isn't one.
+bool _txDropOldest()
+{
+  if (!s_tx_started) {
+    if (s_tx_msgs == 0) {
+      return false;
+    }
+    // it's at the tail so just move the tail past it
+    s_tx_count -= s_tx_lens[s_tx_first];
+    s_tx_dropped += s_tx_lens[s_tx_first];
+    s_tx_first = (s_tx_first + 1) % SERIAL_TX_MAX_MESSAGES;
+    s_tx_msgs--;
+    return true;
+  }
+
+  // The hardware has part of the oldest one, so we have to send the rest of
+  // it. Throw away the one after it by moving the rest of the oldest one up
+  // over it.
+  if (s_tx_msgs < 2) {
+    return false;
+  }
+  uint8_t second = (s_tx_first + 1) % SERIAL_TX_MAX_MESSAGES;
+  size_t keep = s_tx_lens[s_tx_first];
+  size_t gap = s_tx_lens[second];
+  size_t tail = (s_tx_head + SERIAL_TX_QUEUE_SIZE - s_tx_count) % SERIAL_TX_QUEUE_SIZE;
+  for (size_t i = keep; i > 0; i--) {
+    s_tx_queue[(tail + gap + i - 1) % SERIAL_TX_QUEUE_SIZE] =
+        s_tx_queue[(tail + i - 1) % SERIAL_TX_QUEUE_SIZE];
+  }
+  s_tx_count -= gap;
+  s_tx_dropped += gap;
+  s_tx_lens[second] = keep;
+  s_tx_first = second;
+  s_tx_msgs--;
+  return true;
+}
+
+#endif // SERIAL_TX_DROP_OLDEST
+
+#endif // not SERIAL_TX_BLOCK
+
+void serial_tx_poll()
+{
+#if SERIAL_TX_POLICY == SERIAL_TX_BLOCK
+  size_t ready = s_tx_count;
+#else
+  // only the whole messages can go
+  size_t ready = s_tx_count - s_tx_open;
+#endif
+  while (ready) {
+    // see how much the hardware buffer will take without waiting
+    int room = Serial.availableForWrite();
+    if (room <= 0) {
+      return;
+    }
+
+    // send the oldest bytes, up to the end of the queue memory
+    size_t tail = (s_tx_head + SERIAL_TX_QUEUE_SIZE - s_tx_count) % SERIAL_TX_QUEUE_SIZE;
+    size_t n = SERIAL_TX_QUEUE_SIZE - tail;
+    if (n > ready) n = ready;
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+    // and not past the end of the oldest message, so we know where it ends
+    if (n > s_tx_lens[s_tx_first]) n = s_tx_lens[s_tx_first];
+#endif
+    if (n > (size_t)room) n = room;
+    Serial.write(&s_tx_queue[tail], n);
+    s_tx_count -= n;
+    ready -= n;
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+    s_tx_lens[s_tx_first] -= n;
+    s_tx_started = (s_tx_lens[s_tx_first] != 0);
+    if (!s_tx_started) {
+      s_tx_first = (s_tx_first + 1) % SERIAL_TX_MAX_MESSAGES;
+      s_tx_msgs--;
+    }
+#endif
+  }
+}
+
+void serial_msg_begin()
+{
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+  s_tx_depth++;
+#endif
 }
 
-// A global string used to format the floats
-String _f2s_buffer;
+void serial_msg_end()
+{
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+  if ((s_tx_depth == 0) || (--s_tx_depth != 0)) {
+    return;
+  }
+  if (s_tx_discard) {
+    s_tx_discard = false;
+    return;
+  }
+  if (s_tx_open == 0) {
+    return;
+  }
+  if (s_tx_msgs == SERIAL_TX_MAX_MESSAGES) {
+#if SERIAL_TX_POLICY == SERIAL_TX_DROP_OLDEST
+    if (!_txDropOldest())
+#endif
+    {
+      _txDropOpen();
+      s_tx_discard = false;
+      return;
+    }
+  }
+  s_tx_lens[(s_tx_first + s_tx_msgs) % SERIAL_TX_MAX_MESSAGES] = s_tx_open;
+  s_tx_msgs++;
+  s_tx_open = 0;
+#endif
+}
+
+size_t serial_write(const uint8_t* p_data, size_t len)
+{
+  // get rid of what we can first
+  serial_tx_poll();
+
+  // on its own it's a whole message
+  serial_msg_begin();
+
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+  if (s_tx_discard) {
+    // we've already thrown away the start of this message
+    s_tx_dropped += len;
+    len = 0;
+  }
+  if (s_tx_open + len > SERIAL_TX_QUEUE_SIZE) {
+    // it'll never fit
+    s_tx_dropped += len;
+    len = 0;
+    _txDropOpen();
+  }
+  // make room for it before we put any of it in
+  while (len > SERIAL_TX_QUEUE_SIZE - s_tx_count) {
+#if SERIAL_TX_POLICY == SERIAL_TX_DROP_OLDEST
+    if (_txDropOldest()) {
+      continue;
+    }
+#endif
+    s_tx_dropped += len;
+    len = 0;
+    _txDropOpen();
+  }
+#endif
+
+  size_t queued = 0;
+  while (queued < len) {
+#if SERIAL_TX_POLICY == SERIAL_TX_BLOCK
+    if (s_tx_count == SERIAL_TX_QUEUE_SIZE) {
+      serial_tx_poll();
+      continue;
+    }
+#endif
+    s_tx_queue[s_tx_head] = p_data[queued++];
+    s_tx_head = (s_tx_head + 1) % SERIAL_TX_QUEUE_SIZE;
+    s_tx_count++;
+  }
+#if SERIAL_TX_POLICY != SERIAL_TX_BLOCK
+  s_tx_open += queued;
+#endif
+
+  serial_msg_end();
+  return queued;
+}
+
+size_t serial_tx_pending()
+{
+  return s_tx_count;
+}
+
+uint32_t serial_tx_dropped()
+{
+  return s_tx_dropped;
+}
+
+#else // no SERIAL_TX_QUEUE_SIZE
+
+size_t serial_write(const uint8_t* p_data, size_t len)
+{
+  return Serial.write(p_data, len);
+}
+
+void serial_tx_poll()
+{
+}
+
+void serial_msg_begin()
+{
+}
+
+void serial_msg_end()
+{
+}
+
+size_t serial_tx_pending()
+{
+  return 0;
+}
+
+uint32_t serial_tx_dropped()
+{
+  return 0;
+}
+
+#endif // no SERIAL_TX_QUEUE_SIZE
+
+char* f2s(float value, uint8_t places, char* buf, size_t size)
+{
+  static const uint32_t scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+  char tmp[F2S_MAX_LEN];
+  uint8_t len = 0;
+
+  if (size == 0) {
+    return buf;
+  }
+
+  if (isnan(value)) {
+    strncpy(tmp, "nan", sizeof(tmp));
+  } else if (isinf(value)) {
+    strncpy(tmp, "inf", sizeof(tmp));
+  } else if ((value > 4294967040.0) || (value < -4294967040.0)) {
+    // too big for our 32-bit integer part
+    strncpy(tmp, "ovf", sizeof(tmp));
+  } else {
+    if (places > 6) {
+      places = 6;
+    }
+    if (value < 0) {
+      tmp[len++] = '-';
+      value = -value;
+    }
+
+    // split it into the whole number part and the rounded fraction
+    uint32_t whole = (uint32_t)value;
+    uint32_t scale = scales[places];
+    uint32_t frac = (uint32_t)((value - (float)whole) * scale + 0.5f);
+    if (frac >= scale) {
+      // the fraction rounded up to the next whole number
+      whole++;
+      frac -= scale;
+    }
+
+    // the digits of the whole number come out backwards so reverse them
+    char digits[10];
+    uint8_t nd = 0;
+    do {
+      digits[nd++] = '0' + (whole % 10);
+      whole /= 10;
+    } while (whole);
+    while (nd) {
+      tmp[len++] = digits[--nd];
+    }
+
+    if (places) {
+      tmp[len++] = '.';
+      for (uint8_t n = places; n > 0; n--) {
+        tmp[len + n - 1] = '0' + (frac % 10);
+        frac /= 10;
+      }
+      len += places;
+    }
+    tmp[len] = 0;
+  }
+
+  strncpy(buf, tmp, size - 1);
+  buf[size - 1] = 0;
+  return buf;
+}
+
+// A few buffers we use in turn to format the floats
+static char _f2s_buffers[F2S_NUM_BUFFERS][F2S_MAX_LEN];
+static uint8_t _f2s_next = 0;
 
 const char* f2s(float& value, uint8_t places)
 {
-  _f2s_buffer = String(value, places);
-  return _f2s_buffer.c_str();
+  char* buf = _f2s_buffers[_f2s_next];
+  _f2s_next = (_f2s_next + 1) % F2S_NUM_BUFFERS;
+  return f2s(value, places, buf, F2S_MAX_LEN);
+}
+
+#ifdef SERIAL_BINARY_LOG
+
+void _BlogBuf::putString(const char* s)
+{
+  // strings are sent with the zero on the end so the host knows
+  // where they stop
+  putTag(BLOG_STRING);
+  uint8_t len = strlen(s);
+  if (len >= BLOG_MAX_MESSAGE - m_len) {
+    len = BLOG_MAX_MESSAGE - m_len - 1;
+  }
+  put(s, len);
+  putTag(0);
+}
+
+void _BlogBuf::putString(const __FlashStringHelper* s)
+{
+  // the same as above but copied out of the flash memory
+  PGM_P p = (PGM_P)s;
+  putTag(BLOG_STRING);
+  uint8_t c;
+  while ((m_len < BLOG_MAX_MESSAGE - 1) && ((c = pgm_read_byte(p++)) != 0)) {
+    m_buf[m_len++] = c;
+  }
+  putTag(0);
 }
+
+void _BlogBuf::send()
+{
+  // COBS encode the message so the host can always find the start of the
+  // next one. Each zero byte is replaced by the distance to the next zero
+  // and a zero is sent at the end.
+  uint8_t tx[BLOG_MAX_MESSAGE + 2];
+  uint8_t code_index = 0;
+  uint8_t out = 1;
+  uint8_t code = 1;
+  for (uint8_t n = 0; n < m_len; n++) {
+    if (m_buf[n] == 0) {
+      tx[code_index] = code;
+      code_index = out++;
+      code = 1;
+    } else {
+      tx[out++] = m_buf[n];
+      code++;
+    }
+  }
+  tx[code_index] = code;
+  tx[out++] = 0;
+
+  serial_write(tx, out);
+}
+
+#endif // SERIAL_BINARY_LOG
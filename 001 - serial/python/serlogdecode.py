@@ -0,0 +1,242 @@
+#!/usr/bin/env python
+
+# Decode the binary log messages sent by sout and dbg when a sketch is
+# built with SERIAL_BINARY_LOG defined (see serial_utils.h).
+# Each message is COBS encoded and ends with a zero byte. Inside it is:
+# id        32-bits  FNV-1a hash of the format string
+# then for each argument:
+#   tag     8-bits   type in the top 4 bits, size in bytes in the low 4 bits
+#   value            the value, little endian. Strings end with a zero.
+#
+# We find out what the IDs mean by reading the sketch source code and
+# hashing the format string of every sout and dbg call the same way the
+# compiler does.
+
+import os
+import sys
+import re
+import optparse
+import serial
+import datetime
+import traceback
+import struct
+
+# Argument type tags
+BLOG_SIGNED = 0x00
+BLOG_UNSIGNED = 0x10
+BLOG_FLOAT = 0x20
+BLOG_STRING = 0x30
+
+# Find the sout("...", ...) and dbg("...", ...) calls in the source.
+# Adjacent string literals are joined like the compiler does.
+CALL_RE = re.compile(r'\b(?:sout|dbg)\s*\(\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL_RE = re.compile(r'"((?:[^"\\]|\\.)*)"')
+
+# C escape sequences we understand in the format strings
+ESCAPES = {'n': '\n', 't': '\t', 'r': '\r', '0': '\0', '\\': '\\', '"': '"', "'": "'"}
+
+# printf length modifiers that Python's % operator does not want
+LENGTH_RE = re.compile(r'%([-+ #0]*[0-9]*(?:\.[0-9]+)?)(?:hh|h|ll|l|z|j|t)?([diouxXeEfgGcsp%])')
+
+
+# Turn a printf conversion into one for Python's % operator. Python has no
+# %p so pointers are shown in hex like sout does.
+def pythonSpec(m):
+    if m.group(2) == 'p':
+        return '0x%' + m.group(1) + 'x'
+    return '%' + m.group(1) + m.group(2)
+
+
+# Turn the text of a C string literal into the string the compiler sees
+def unescape(s):
+    out = ''
+    i = 0
+    while i < len(s):
+        c = s[i]
+        if c == '\\' and i + 1 < len(s):
+            n = s[i + 1]
+            if n == 'x':
+                m = re.match(r'[0-9a-fA-F]+', s[i + 2:])
+                out += chr(int(m.group(0), 16) & 0xFF)
+                i += 2 + len(m.group(0))
+                continue
+            out += ESCAPES.get(n, n)
+            i += 2
+            continue
+        out += c
+        i += 1
+    return out
+
+
+# The same FNV-1a hash as _blogHash() in serial_utils.h
+def blogHash(s):
+    h = 2166136261
+    for c in s:
+        h = ((h ^ ord(c)) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+# Read all the format strings from the sketch source files.
+# Returns a dictionary of id -> format string
+def loadFormats(sketch_dir):
+    formats = {}
+    for name in os.listdir(sketch_dir):
+        if os.path.splitext(name)[1] not in ('.ino', '.h', '.cpp'):
+            continue
+        src = open(os.path.join(sketch_dir, name)).read()
+        for m in CALL_RE.finditer(src):
+            fmt = ''.join([unescape(l) for l in LITERAL_RE.findall(m.group(1))])
+            formats[blogHash(fmt)] = fmt
+    return formats
+
+
+# COBS decode a message (without the zero at the end)
+def cobsDecode(data):
+    out = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        if code == 0 or index + code > len(data):
+            return None
+        out += data[index + 1:index + code]
+        index += code
+        if code < 0xFF and index < len(data):
+            out.append(0)
+    return out
+
+
+# Unpack the arguments that follow the ID.
+# Returns the arguments and whether the message was cut short, which happens
+# when it's longer than BLOG_MAX_MESSAGE on the board.
+def decodeArgs(data):
+    args = []
+    index = 0
+    while index < len(data):
+        tag = data[index]
+        index += 1
+        kind = tag & 0xF0
+        size = tag & 0x0F
+        if kind == BLOG_STRING:
+            end = data.find(b'\x00', index)
+            if end < 0:
+                args.append(str(data[index:].decode('latin-1')))
+                return args, True
+            args.append(str(data[index:end].decode('latin-1')))
+            index = end + 1
+            continue
+        if kind == BLOG_FLOAT:
+            fmt = {4: 'f', 8: 'd'}.get(size)
+        else:
+            fmt = {1: 'b', 2: 'h', 4: 'l', 8: 'q'}.get(size)
+            if fmt and kind == BLOG_UNSIGNED:
+                fmt = fmt.upper()
+        if fmt is None or index + size > len(data):
+            return args, True
+        args.append(struct.unpack('<' + fmt, bytes(data[index:index + size]))[0])
+        index += size
+    return args, False
+
+
+# Format a decoded message
+def formatMessage(formats, data):
+    if len(data) < 4:
+        return None
+    id = struct.unpack('<L', bytes(data[:4]))[0]
+    args, truncated = decodeArgs(data[4:])
+    fmt = formats.get(id)
+    if fmt is None:
+        return 'Unknown format 0x%08X: %s' % (id, repr(args))
+    if truncated:
+        return 'Truncated "%s": %s' % (fmt, repr(args))
+    try:
+        return LENGTH_RE.sub(pythonSpec, fmt) % tuple(args)
+    except (TypeError, ValueError) as e:
+        return 'Bad arguments for "%s": %s' % (fmt, repr(args))
+
+
+def main():
+    usage = '''
+    usage: %prog -p port [options]
+    Use -h to get full help
+    '''
+
+    # create an option parser
+    p = optparse.OptionParser(usage, version='%prog 1.0')
+
+    # Add an option to collect a USB port name
+    p.add_option('--port', '-p', default="", action='store', help='Select the USB serial port')
+
+    # Add an option to set the baud rate
+    p.add_option('--baud', '-b', default="115200", action='store', help='Set the baud rate. Default is 115,200')
+
+    # Add an option to say where the sketch source is
+    p.add_option('--sketch', '-s', default=".", action='store', help='Set the sketch folder to read the format strings from. Default is the current folder')
+
+    # Add an option to also write the messages to a file
+    p.add_option('--filename', '-f', default="", action='store', help='Also write the messages to this file')
+
+    # parse the command line ignoring argv[0] (the application name)
+    opt, args = p.parse_args(args=sys.argv[1:])
+
+    if opt.port == '':
+        p.error('Port is required')
+
+    formats = loadFormats(opt.sketch)
+    print 'Found', len(formats), 'format strings in', opt.sketch
+
+    # try to open the port
+    try:
+        ser = serial.Serial(opt.port, opt.baud, timeout=10)
+    except IOError as e:
+        print 'Exception', e
+        exit(1)
+
+    print "Receiving serial data from:", opt.port, 'at', opt.baud, 'baud'
+
+    opfile = None
+    if opt.filename != '':
+        try:
+            opfile = open(opt.filename, 'w')
+            print "Writing messages to:", opt.filename
+        except IOError as e:
+            print 'Exception', e
+            exit(1)
+
+    buf = bytearray()
+    while True:
+        try:
+            n = ser.in_waiting
+            data = ser.read(n if n > 0 else 1)
+            if len(data) == 0:
+                raise serial.SerialTimeoutException()
+            buf += bytearray(data)
+            while True:
+                end = buf.find(b'\x00')
+                if end < 0:
+                    break
+                msg = cobsDecode(buf[:end])
+                del buf[:end + 1]
+                if not msg:
+                    continue
+                s = formatMessage(formats, msg)
+                if s is None:
+                    continue
+                print s
+                if opfile:
+                    opfile.write(s)
+                    opfile.write('\n')
+        except serial.SerialTimeoutException:
+            print "Timed out"
+            break
+        except Exception as e:
+            print "Other exception", e
+            print(traceback.format_exc())
+            break
+
+    if opfile:
+        print "Closing file:", opt.filename
+        opfile.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,134 @@
+/** \file cycle_timer.h
+ *  \brief A CPU cycle counter for timing code and events.
+ *
+ *  micros() only counts in 4 us steps on the Uno and takes a few
+ *  microseconds to call, which is a lot to add to an ISR. now_cycles()
+ *  reads a counter that goes up once every CPU clock:
+ *    - on the Artemis it's the DWT cycle counter in the Cortex-M4, so
+ *      reading it is a single load
+ *    - on the ATmega it's Timer1 counting at the CPU clock, with the
+ *      overflows counted to make it 32 bits
+ *    - on any other board it's micros() scaled up to cycles, so the code
+ *      still works but with the resolution of micros()
+ *
+ *    cycle_timer_begin();   // in setup()
+ *
+ *    cycles_t start = now_cycles();
+ *    ... the code you want to time ...
+ *    uint32_t ns = cycles_to_ns(cycles_since(start));
+ *
+ *  The count is 32 bits so it wraps around, every 268 seconds at 16 MHz
+ *  and every 89 seconds at 48 MHz. Take one time from another with
+ *  unsigned math, like cycles_since() does, and the difference is right
+ *  across the wrap as long as it's shorter than that.
+ *
+ *  On the ATmega this needs all of Timer1 running freely at the CPU clock.
+ *  FastAdc and the input capture code are written to share it, but you
+ *  can't use analogWrite() on pins 9 and 10 or the Servo library with it.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _CYCLE_TIMER_H_
+#define _CYCLE_TIMER_H_
+
+#include "Arduino.h"
+
+typedef uint32_t cycles_t;
+
+// The number of cycles in a microsecond
+#define CYCLES_PER_US (F_CPU / 1000000L)
+
+/// \brief Start the counter.
+/// Call this from setup() before you use now_cycles(). It's safe to call
+/// it more than once, the count isn't reset.
+void cycle_timer_begin();
+
+#if defined(ARDUINO_ARCH_APOLLO3)
+
+/// \brief Get the number of CPU cycles since the counter started.
+inline cycles_t now_cycles()
+{
+  return DWT->CYCCNT;
+}
+
+#elif defined(__AVR__)
+
+// The top 16 bits of the count. Only changed in the overflow ISR.
+extern volatile uint16_t _cycle_overflows;
+
+/// \brief Extend a 16-bit Timer1 value to 32 bits.
+/// Use this for a count the hardware latched, like ICR1, while it's still
+/// recent. If the timer has overflowed but the overflow ISR hasn't run yet,
+/// a small value must have come after the overflow so we count it here.
+/// Call this with interrupts off.
+inline cycles_t cycles_extend(uint16_t low)
+{
+  uint16_t high = _cycle_overflows;
+  if ((TIFR1 & bit(TOV1)) && (low < 0x8000)) {
+    high++;
+  }
+  return ((cycles_t)high << 16) | low;
+}
+
+/// \brief Get the number of CPU cycles since the counter started.
+/// This is about 20 cycles as the interrupts have to be off while we
+/// put the two halves together.
+inline cycles_t now_cycles()
+{
+  uint8_t sreg = SREG;
+  cli();
+  cycles_t t = cycles_extend(TCNT1);
+  SREG = sreg;
+  return t;
+}
+
+#else // nothing better than micros() on this board
+
+inline cycles_t now_cycles()
+{
+  return micros() * CYCLES_PER_US;
+}
+
+#endif
+
+/// \brief Get the cycles since an earlier now_cycles(), across the wrap.
+inline cycles_t cycles_since(cycles_t start)
+{
+  return now_cycles() - start;
+}
+
+/// \brief Convert cycles to nanoseconds.
+/// The result is 32 bits so this is good for times up to about 4 seconds.
+inline uint32_t cycles_to_ns(cycles_t cycles)
+{
+  return (uint32_t)((uint64_t)cycles * 1000 / CYCLES_PER_US);
+}
+
+/// \brief Convert cycles to whole microseconds.
+inline uint32_t cycles_to_us(cycles_t cycles)
+{
+  return cycles / CYCLES_PER_US;
+}
+
+#endif // _CYCLE_TIMER_H_
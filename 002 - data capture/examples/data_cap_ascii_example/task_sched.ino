@@ -0,0 +1,226 @@
+/** \file task_sched.cpp
+ *  \brief A small cooperative scheduler that sleeps while it waits.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "task_sched.h"
+
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#include "cycle_timer.h"
+#endif
+
+Scheduler::Scheduler()
+: m_num_tasks(0)
+, m_sleep(SCHED_SLEEP_DEEP)
+, m_tick_rate(1000000L)
+, m_min_sleep(SCHED_MIN_SLEEP_US)
+, m_deep_ok(false)
+, m_sleep_ticks(0)
+, m_stats_start(0)
+{
+}
+
+int8_t Scheduler::every(uint32_t period_us, SchedFn fn)
+{
+  if (m_num_tasks == SCHED_MAX_TASKS) {
+    return -1;
+  }
+  Task& task = m_tasks[m_num_tasks];
+  task.fn = fn;
+  task.period = usToTicks(period_us);
+  task.next_due = now() + task.period;
+  return m_num_tasks++;
+}
+
+void Scheduler::run()
+{
+  for (uint8_t i = 0; i < m_num_tasks; i++) {
+    Task& task = m_tasks[i];
+    uint32_t t = now();
+    if ((int32_t)(t - task.next_due) >= 0) {
+      task.fn();
+      task.next_due += task.period;
+      if ((int32_t)(t - task.next_due) >= 0) {
+        // we're more than a period behind so start again from now
+        task.next_due = t + task.period;
+      }
+    }
+  }
+
+  if (m_sleep == SCHED_SLEEP_NONE) {
+    return;
+  }
+
+  // Sleep until the first task is due. With no tasks the 0xFFFFFFFF just
+  // means until an interrupt wakes us up.
+  uint32_t t = now();
+  uint32_t wait = 0xFFFFFFFFUL;
+  for (uint8_t i = 0; i < m_num_tasks; i++) {
+    int32_t left = (int32_t)(m_tasks[i].next_due - t);
+    if (left < (int32_t)m_min_sleep) {
+      // it's due now or will be before we could get to sleep
+      return;
+    }
+    if ((uint32_t)left < wait) {
+      wait = left;
+    }
+  }
+  sleepFor(wait);
+  m_sleep_ticks += now() - t;
+}
+
+uint8_t Scheduler::getSleepPercent()
+{
+  uint32_t t = now();
+  uint32_t total = t - m_stats_start;
+  uint8_t percent = (total == 0) ? 0 : (uint8_t)((uint64_t)m_sleep_ticks * 100 / total);
+  m_stats_start = t;
+  m_sleep_ticks = 0;
+  return percent;
+}
+
+uint32_t Scheduler::usToTicks(uint32_t us) const
+{
+  return (uint32_t)((uint64_t)us * m_tick_rate / 1000000L);
+}
+
+#if defined(__AVR__)
+
+void Scheduler::begin()
+{
+  // the clock is the CPU cycle counter on Timer1
+  cycle_timer_begin();
+  m_tick_rate = F_CPU;
+  m_min_sleep = usToTicks(SCHED_MIN_SLEEP_US);
+  m_stats_start = now();
+}
+
+uint32_t Scheduler::now() const
+{
+  return now_cycles();
+}
+
+void Scheduler::sleepFor(uint32_t ticks)
+{
+  // Only the idle mode leaves Timer1 running, so that's the deep sleep too
+  set_sleep_mode(SLEEP_MODE_IDLE);
+
+  cli();
+  if (ticks < 0x10000UL) {
+    // OCR1A compares with the low 16 bits of the count. For a longer sleep
+    // the Timer1 overflow wakes us up every 4 ms and we look again.
+    OCR1A = TCNT1 + (uint16_t)ticks;
+    TIFR1 = bit(OCF1A);
+    TIMSK1 |= bit(OCIE1A);
+  }
+  sleep_enable();
+  // The instruction after sei() always runs before any interrupt, so an
+  // interrupt can't come in between and leave us asleep with work to do.
+  sei();
+  sleep_cpu();
+  sleep_disable();
+}
+
+// Only here to wake us up
+ISR(TIMER1_COMPA_vect)
+{
+  TIMSK1 &= ~bit(OCIE1A);
+}
+
+#elif defined(ARDUINO_ARCH_APOLLO3)
+
+// The STIMER ticks per second for each CLKSEL setting. The HFRC ones are
+// 48 MHz / 16 and / 256, the XTAL ones 32768 Hz / 1, / 2 and / 32 and the
+// LFRC is about 1024 Hz. We don't use the CTIMER ones (7 and 8).
+static const uint32_t s_stimer_rates[] = {0, 3000000L, 187500L, 32768L, 16384L, 1024L, 1024L};
+
+void Scheduler::begin()
+{
+  uint32_t clksel = (CTIMER->STCFG & CTIMER_STCFG_CLKSEL_Msk) >> CTIMER_STCFG_CLKSEL_Pos;
+  if ((clksel == 0) || (clksel >= sizeof(s_stimer_rates) / sizeof(s_stimer_rates[0]))) {
+    // Nothing has started it so run it from the crystal, which keeps going
+    // in deep sleep
+    am_hal_stimer_config(AM_HAL_STIMER_XTAL_32KHZ);
+    clksel = (CTIMER->STCFG & CTIMER_STCFG_CLKSEL_Msk) >> CTIMER_STCFG_CLKSEL_Pos;
+  }
+  m_tick_rate = s_stimer_rates[clksel];
+  // The HFRC stops in deep sleep and the STIMER with it
+  m_deep_ok = (clksel >= 3);
+
+  // at least 2 ticks so the compare can't be set for a tick that's already started
+  m_min_sleep = usToTicks(SCHED_MIN_SLEEP_US);
+  if (m_min_sleep < 2) {
+    m_min_sleep = 2;
+  }
+  m_stats_start = now();
+
+  am_hal_stimer_int_clear(AM_HAL_STIMER_INT_COMPAREH);
+  NVIC_EnableIRQ(STIMER_CMPR7_IRQn);
+}
+
+uint32_t Scheduler::now() const
+{
+  return am_hal_stimer_counter_get();
+}
+
+void Scheduler::sleepFor(uint32_t ticks)
+{
+  am_hal_stimer_compare_delta_set(7, ticks);
+  am_hal_stimer_int_enable(AM_HAL_STIMER_INT_COMPAREH);
+
+  // am_hal_sysctrl_sleep() turns the interrupts off around the WFI, and an
+  // interrupt that's pending then still wakes it straight away
+  if ((m_sleep == SCHED_SLEEP_DEEP) && m_deep_ok) {
+    am_hal_sysctrl_sleep(AM_HAL_SYSCTRL_SLEEP_DEEP);
+  } else {
+    am_hal_sysctrl_sleep(AM_HAL_SYSCTRL_SLEEP_NORMAL);
+  }
+}
+
+// Only here to wake us up
+extern "C" void am_stimer_cmpr7_isr(void)
+{
+  am_hal_stimer_int_clear(AM_HAL_STIMER_INT_COMPAREH);
+  am_hal_stimer_int_disable(AM_HAL_STIMER_INT_COMPAREH);
+}
+
+#else // no sleep on this board, micros() is the clock
+
+void Scheduler::begin()
+{
+  m_stats_start = now();
+}
+
+uint32_t Scheduler::now() const
+{
+  return micros();
+}
+
+void Scheduler::sleepFor(uint32_t ticks)
+{
+  (void)ticks;
+}
+
+#endif
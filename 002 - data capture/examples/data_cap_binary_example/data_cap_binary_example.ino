@@ -4,93 +4,139 @@
  * this code simulates some analog data that might be read using two ADC
  * channels.
  * 
+ * V2: The records are now sent in COBS encoded frames with a sequence number
+ *     and a CRC (see cobs_frame.h). Several records go in each frame. A start
+ *     pattern of 0xFFFFFFFF could also turn up in the data and make the receiver
+ *     lose track of the records, this can't.
+ *     Use python/serbinlog.py to receive the data.
+ * 
+ * V3: Each record is a packed struct so it's added to the frame in one go, and
+ *     the baud rate and record interval can be changed below. Set RECORD_INTERVAL_US
+ *     to zero to send records as fast as possible and serbinlog.py will tell you
+ *     how many records per second the board really manages.
+ * 
+ * V4: Define DELTA_ENCODING to send the differences between records rather than
+ *     the records themselves (see delta_encoder.h). That's about a third of the data.
+ * 
+ * V5: The test signals come from a sine wave generator (see wave_gen.h) that works
+ *     out the wave from the time, so the frequency stays the same whatever the
+ *     record interval is, and the values use the whole 10-bit range.
+ * 
+ * V6: The records are sent by a task for the scheduler in task_sched.h rather than
+ *     loop() waiting with delayMicroseconds(), so the board sleeps in between.
+ * 
  */
 
 #include "Arduino.h"
+#include "cobs_frame.h"
+#include "delta_encoder.h"
+#include "wave_gen.h"
+#include "task_sched.h"
+
+// Define this to compress the records
+//#define DELTA_ENCODING
+
+// The serial baud rate. An Uno or Mega at 16 MHz can do 1000000 or 2000000
+// exactly, and those are much closer to the real rate than 115200 is.
+// Remember to tell serbinlog.py with the -b option.
+#define BAUD_RATE 115200
+
+// The time between records in microseconds.
+// Zero means send them as fast as we can.
+#define RECORD_INTERVAL_US 10000L
+
+// One data record.
+// Packed so there is no padding between the fields on any board.
+struct Record
+{
+  uint32_t now; // time the samples were taken in microseconds
+  uint16_t v1;
+  uint16_t v2;
+} __attribute__((packed));
+
+// The number of records we put in each frame.
+#define RECORDS_PER_FRAME (FRAME_MAX_PAYLOAD / sizeof(Record))
 
-// define the pattern we want to send at the start of each record.
-// We are using 32 bits of all ones here but that is only one possibility.
-const uint32_t START_PATTERN = 0xFFFFFFFFL;
+// The frame we collect the records in before sending them
+// and the number of records in it so far
+FrameWriter g_frame(Serial);
+uint8_t g_num_records = 0;
+
+#ifdef DELTA_ENCODING
+// The delta encoder for our two samples per record
+DeltaEncoder g_delta(g_frame, 2);
+#endif
 
 // To avoid having to write a long-winded statement like:
-// Serial.write((const uint8_t*)&v1, sizeof(v1));
+// g_frame.add((const uint8_t*)&rec, sizeof(rec));
 // we declare a macro here so our code is a bit cleaner
-#define WRITE(x) (Serial.write((const uint8_t*)&(x), sizeof(x)))
+#define ADD(x) (g_frame.add((const uint8_t*)&(x), sizeof(x)))
  
-// A table of 256 8-bit sine values. These values are biased around 127
-// so that they are all positive 8-bit values
-const uint8_t sine_table[] = { 
-  127,130,133,136,139,143,146,149,152,155,158,161,164,167,170,173,
-  176,179,182,184,187,190,193,195,198,200,203,205,208,210,213,215,
-  217,219,221,224,226,228,229,231,233,235,236,238,239,241,242,244,
-  245,246,247,248,249,250,251,251,252,253,253,254,254,254,254,254,
-  255,254,254,254,254,254,253,253,252,251,251,250,249,248,247,246,
-  245,244,242,241,239,238,236,235,233,231,229,228,226,224,221,219,
-  217,215,213,210,208,205,203,200,198,195,193,190,187,184,182,179,
-  176,173,170,167,164,161,158,155,152,149,146,143,139,136,133,130,
-  127,124,121,118,115,111,108,105,102,99,96,93,90,87,84,81,
-  78,75,72,70,67,64,61,59,56,54,51,49,46,44,41,39,
-  37,35,33,30,28,26,25,23,21,19,18,16,15,13,12,10,
-  9,8,7,6,5,4,3,3,2,1,1,0,0,0,0,0,
-  0,0,0,0,0,0,1,1,2,3,3,4,5,6,7,8,
-  9,10,12,13,15,16,18,19,21,23,25,26,28,30,33,35,
-  37,39,41,44,46,49,51,54,56,59,61,64,67,70,72,75,
-  78,81,84,87,90,93,96,99,102,105,108,111,115,118,121,124
-};
-#define SINE_TABLE_SIZE (sizeof(sine_table) / sizeof(uint8_t))
+// The frequency of the test signals
+#define WAVE_FREQUENCY_HZ 0.4
+
+// The test signals are two 10-bit sine waves, like two analogRead() inputs,
+// 90 degrees apart. The table has 256 entries.
+typedef WaveTable<8, 10> SineTable;
+WaveGen<SineTable, 2> g_wave;
+
+// The scheduler that calls sendRecord() every RECORD_INTERVAL_US
+Scheduler g_sched;
  
 void setup() 
 {
   // Set up the serial interface at a baud rate that is fast enough for the 
   // data records we want to send
-  Serial.begin(115200);
+  Serial.begin(BAUD_RATE);
 
+  // We give the generator the time in microseconds
+  g_wave.setFrequency(WAVE_FREQUENCY_HZ, 1000000.0);
+  g_wave.setPhaseOffset(1, wgDegrees(90));
+
+  // The serial port has to keep sending while we sleep so this can't use
+  // the deep sleep on the Artemis
+  g_sched.begin();
+  g_sched.setSleep(SCHED_SLEEP_LIGHT);
+  g_sched.every(RECORD_INTERVAL_US, sendRecord);
 }
 
-uint8_t index = 0;
 uint32_t start_time = micros();
 
-void loop() 
+// Called by the scheduler every RECORD_INTERVAL_US
+void sendRecord()
 {
   // capture the time that we take the samples.
+  Record rec;
   uint32_t now = micros();
+  rec.now = now;
   
   // generate a couple of analog signals to mimic what we might get
   // from reading two analog inputs with analogRead();
-  // Not that our data table is only 8 bits and the ADC has a 10 bit range
-  // so we shift the data 2 bits to make it use more of the range and look a bit more
-  // realistic.
-  uint16_t v1 = sine_table[index % SINE_TABLE_SIZE] << 2;
-  uint16_t v2 = sine_table[(index + 64) % SINE_TABLE_SIZE] << 2;
-
-  // advance the waveform generator
-  index++;
-
-  // send the data record over the serial link starting with the start sequence
-  // we use Serial.write here not Serial.print as we are not sending characters
-  // We also need to use the form of Serial.write that takes a pointer to a buffer and
-  // a length to ensure we write the correct number of bytes
-#if 0
-  // The long-winded way
-  Serial.write((const uint8_t*)&START_PATTERN, sizeof(START_PATTERN)); // 4 bytes
-  Serial.write((const uint8_t*)&now, sizeof(now)); // 4 bytes
-  Serial.write((const uint8_t*)&v1, sizeof(v1)); // 2 bytes
-  Serial.write((const uint8_t*)&v2, sizeof(v2)); // 2 bytes
+  // The wave is worked out for the time we took the samples.
+  uint16_t v[2];
+  g_wave.at(now, v);
+  rec.v1 = v[0];
+  rec.v2 = v[1];
+
+#ifdef DELTA_ENCODING
+  // the encoder sends the frame when it's full
+  uint16_t values[2] = {rec.v1, rec.v2};
+  g_delta.add(rec.now, values);
 #else
-  // Using our handy macro
-  WRITE(START_PATTERN); // 4 bytes
-  WRITE(now);           // 4 bytes
-  WRITE(v1);            // 2 bytes
-  WRITE(v2);            // 2 bytes
-#endif  
-
-  // see how long it took us to do that
-  uint32_t elapsed = micros() - now;
-
-  // wait a bit
-  if (elapsed < 10000L) {
-    delayMicroseconds(10000L - elapsed); // so we loop about every 10 ms
+  // add the data record to the frame
+  ADD(rec); // 8 bytes
+
+  // send the frame when it's full
+  g_num_records++;
+  if (g_num_records >= RECORDS_PER_FRAME) {
+    g_frame.send(FRAME_TYPE_RECORDS);
+    g_num_records = 0;
   }
-  
+#endif
+}
 
+void loop() 
+{
+  // send a record when it's due and sleep until the next one
+  g_sched.run();
 }
@@ -0,0 +1,95 @@
+/** \file delta_encoder.h
+ *  \brief Delta compression for captured sample records.
+ *
+ *  Our records are a timestamp and a few sample values. The timestamps go
+ *  up by almost the same amount every time and the samples change slowly, so
+ *  rather than send every value in full we send the differences.
+ *
+ *  Each FRAME_TYPE_DELTA frame payload looks like this:
+ *
+ *    channels   8-bits   the number of sample values in each record
+ *    time       32-bits  the time of the first record
+ *    values     16-bits  each sample value of the first record
+ *    then for each of the other records:
+ *      time     varint   change in the time interval since the previous record
+ *      values   varint   change in each sample value since the previous record
+ *
+ *  The varints are zigzag encoded so small negative numbers are small too:
+ *  0 -> 0, -1 -> 1, 1 -> 2, -2 -> 3 etc. Then each byte holds 7 bits of the
+ *  value, low bits first, with the top bit set if there are more bytes to come.
+ *  With a steady 10 ms record interval each of the later records in a frame
+ *  usually takes only one byte per field.
+ *
+ *  Each frame starts with a complete record so the receiver can decode any
+ *  frame on its own, even if it lost the one before.
+ *
+ *  The matching Python code is parseDeltaRecords() in python/framing.py
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _DELTA_ENCODER_H_
+#define _DELTA_ENCODER_H_
+
+#include "Arduino.h"
+#include "cobs_frame.h"
+
+// The most sample values we allow in a record
+#define DELTA_MAX_CHANNELS 8
+
+/// \brief Zigzag and varint encode a signed value.
+/// \param value The value to encode.
+/// \param p_out Where to put the encoded bytes. Needs room for 5 bytes.
+/// \return The number of bytes used.
+uint8_t zigzagVarint(int32_t value, uint8_t* p_out);
+
+/// \brief Delta encodes records into frames and sends them.
+class DeltaEncoder
+{
+public:
+  /// \brief Construct the encoder.
+  /// \param frame The frame writer to send the frames with.
+  /// \param num_channels The number of sample values in each record.
+  DeltaEncoder(FrameWriter& frame, uint8_t num_channels);
+
+  /// \brief Add a record.
+  /// If the record won't fit in the current frame, the frame is sent first.
+  /// \param time The time of the record.
+  /// \param p_values The sample values. There must be num_channels of them.
+  void add(uint32_t time, const uint16_t* p_values);
+
+  /// \brief Send whatever records we have now.
+  void flush();
+
+private:
+  FrameWriter& m_frame;
+  const uint8_t m_num_channels;
+  bool m_empty; // true if there are no records in the current frame
+
+  // what we had in the previous record
+  uint32_t m_prev_time;
+  int32_t m_prev_interval;
+  uint16_t m_prev_values[DELTA_MAX_CHANNELS];
+};
+
+#endif // _DELTA_ENCODER_H_
@@ -0,0 +1,89 @@
+/** \file delta_encoder.cpp
+ *  \brief Delta compression for captured sample records.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "delta_encoder.h"
+
+uint8_t zigzagVarint(int32_t value, uint8_t* p_out)
+{
+  // move the sign to the bottom bit
+  uint32_t u = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+
+  // then send 7 bits at a time
+  uint8_t n = 0;
+  while (u >= 0x80) {
+    p_out[n++] = (uint8_t)(u | 0x80);
+    u >>= 7;
+  }
+  p_out[n++] = (uint8_t)u;
+  return n;
+}
+
+DeltaEncoder::DeltaEncoder(FrameWriter& frame, uint8_t num_channels)
+: m_frame(frame)
+, m_num_channels(num_channels > DELTA_MAX_CHANNELS ? DELTA_MAX_CHANNELS : num_channels)
+, m_empty(true)
+, m_prev_time(0)
+, m_prev_interval(0)
+{
+  memset(m_prev_values, 0, sizeof(m_prev_values));
+}
+
+void DeltaEncoder::add(uint32_t time, const uint16_t* p_values)
+{
+  // encode the differences from the previous record
+  uint8_t buf[5 * (DELTA_MAX_CHANNELS + 1)];
+  uint8_t len = 0;
+  int32_t interval = (int32_t)(time - m_prev_time);
+  if (!m_empty) {
+    len += zigzagVarint(interval - m_prev_interval, &buf[len]);
+    for (uint8_t c = 0; c < m_num_channels; c++) {
+      len += zigzagVarint((int32_t)p_values[c] - (int32_t)m_prev_values[c], &buf[len]);
+    }
+  }
+
+  if (m_empty || !m_frame.add(buf, len)) {
+    // this is the first record in the frame or there wasn't room for it.
+    // Start a new frame with the whole record.
+    flush();
+    m_frame.add(&m_num_channels, 1);
+    m_frame.add(&time, sizeof(time));
+    m_frame.add(p_values, m_num_channels * sizeof(uint16_t));
+    m_empty = false;
+    interval = 0;
+  }
+
+  m_prev_time = time;
+  m_prev_interval = interval;
+  memcpy(m_prev_values, p_values, m_num_channels * sizeof(uint16_t));
+}
+
+void DeltaEncoder::flush()
+{
+  if (!m_empty) {
+    m_frame.send(FRAME_TYPE_DELTA);
+    m_empty = true;
+  }
+}
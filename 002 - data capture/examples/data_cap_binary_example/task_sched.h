@@ -0,0 +1,158 @@
+/** \file task_sched.h
+ *  \brief A small cooperative scheduler that sleeps while it waits.
+ *
+ *  Rather than pace loop() with delay() or spin waiting for something, give
+ *  the scheduler the functions you want called and how often, and call
+ *  run() from loop():
+ *
+ *    Scheduler g_sched;
+ *
+ *    void setup()
+ *    {
+ *      g_sched.begin();
+ *      g_sched.every(10000, sendRecord);   // every 10 ms
+ *      g_sched.every(500000, printStats);  // every 500 ms
+ *    }
+ *
+ *    void loop()
+ *    {
+ *      g_sched.run();
+ *    }
+ *
+ *  run() calls the tasks that are due then puts the CPU to sleep until the
+ *  next one is due or any interrupt comes in, then it returns. So the ISRs
+ *  keep running while we sleep, and anything else you do in loop(), like
+ *  FastAdc::poll(), gets looked at after every interrupt. If an ISR leaves
+ *  work for loop() just before we go to sleep it waits for the next
+ *  interrupt, which with the ADC running is the next sample.
+ *
+ *  The tasks run at a fixed rate, so a task that's called late doesn't push
+ *  the later ones back. If one gets more than a whole period behind the
+ *  missed calls are dropped rather than made up in a burst. Nothing runs in
+ *  an ISR, so a task can take as long as it likes, but the others wait.
+ *
+ *  How it sleeps:
+ *    - on the ATmega it's SLEEP_MODE_IDLE, which stops the CPU but leaves
+ *      the timers, the ADC and the serial port running. Timer1 from
+ *      cycle_timer.h is the clock and an OCR1A compare wakes us up. The
+ *      deeper modes stop Timer1 so SCHED_SLEEP_DEEP is the same as
+ *      SCHED_SLEEP_LIGHT.
+ *    - on the Artemis the clock is the system timer (STIMER) and compare H
+ *      wakes us up. SCHED_SLEEP_DEEP is the Cortex-M4 deep sleep, which turns
+ *      off the high frequency clock, and the UART and the ADC with it, so
+ *      use SCHED_SLEEP_LIGHT if you're streaming data or sampling. Deep sleep
+ *      is only used when the STIMER runs from the 32 kHz crystal or the LFRC
+ *      as otherwise it would stop the timer that wakes us.
+ *    - on other boards it doesn't sleep, run() just returns.
+ *
+ *  The times are kept in timer ticks, which wrap around like micros() does,
+ *  so the longest period is about 2 minutes on a 16 MHz Uno.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _TASK_SCHED_H_
+#define _TASK_SCHED_H_
+
+#include "Arduino.h"
+
+// The most tasks one scheduler can have
+#define SCHED_MAX_TASKS 8
+
+// Don't bother going to sleep for less than this many microseconds
+#define SCHED_MIN_SLEEP_US 50
+
+/// \brief A task function.
+typedef void (*SchedFn)();
+
+/// \brief How hard to sleep while there's nothing to do.
+enum SchedSleep
+{
+  SCHED_SLEEP_NONE,  ///< don't sleep, run() just returns
+  SCHED_SLEEP_LIGHT, ///< stop the CPU but leave the clocks running
+  SCHED_SLEEP_DEEP   ///< the deepest sleep the scheduler can still wake from
+};
+
+/// \brief A cooperative scheduler for periodic tasks.
+/// There only needs to be one.
+class Scheduler
+{
+public:
+  Scheduler();
+
+  /// \brief Start the timer the scheduler uses. Call it from setup()
+  /// before every().
+  void begin();
+
+  /// \brief Call a function every so often.
+  /// The first call is one period from now.
+  /// \param period_us The time between the calls in microseconds. Zero
+  /// means every time run() is called, and then run() never sleeps.
+  /// \param fn The function to call.
+  /// \return The task number, or -1 if there are SCHED_MAX_TASKS already.
+  int8_t every(uint32_t period_us, SchedFn fn);
+
+  /// \brief Set how hard run() sleeps. The default is SCHED_SLEEP_DEEP.
+  void setSleep(SchedSleep mode)
+  {
+    m_sleep = mode;
+  }
+
+  /// \brief Call the tasks that are due, then sleep until the next one is
+  /// due or an interrupt comes in. Call this from loop().
+  void run();
+
+  /// \brief Get the share of the time we spent asleep since the last call,
+  /// in percent.
+  uint8_t getSleepPercent();
+
+private:
+  struct Task
+  {
+    SchedFn fn;
+    uint32_t period;   // in ticks
+    uint32_t next_due; // in ticks
+  };
+
+  // The time in timer ticks
+  uint32_t now() const;
+
+  // Convert microseconds to timer ticks
+  uint32_t usToTicks(uint32_t us) const;
+
+  // Sleep for up to this many ticks
+  void sleepFor(uint32_t ticks);
+
+  Task m_tasks[SCHED_MAX_TASKS];
+  uint8_t m_num_tasks;
+  SchedSleep m_sleep;
+  uint32_t m_tick_rate; // ticks per second
+  uint32_t m_min_sleep; // in ticks
+  bool m_deep_ok;       // the timer keeps going in deep sleep
+
+  // for getSleepPercent()
+  uint32_t m_sleep_ticks;
+  uint32_t m_stats_start;
+};
+
+#endif // _TASK_SCHED_H_
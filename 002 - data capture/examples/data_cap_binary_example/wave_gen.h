@@ -0,0 +1,273 @@
+/** \file wave_gen.h
+ *  \brief A table driven sine wave generator for test signals.
+ *
+ *  This is a DDS (direct digital synthesis) generator. A 32-bit phase goes
+ *  up by a fixed step for every sample and wraps around once per cycle, and
+ *  the top bits of the phase pick the entry in a sine table. The step sets
+ *  the frequency so you get any frequency you like at any sample rate, to
+ *  a fraction of a millihertz, and the table size only sets how smooth the
+ *  wave is.
+ *
+ *    // 256 entries of 10 bits, like the ADC gives you
+ *    typedef WaveTable<8, 10> SineTable;
+ *    WaveGen<SineTable, 2> wave;
+ *
+ *    wave.setFrequency(5.0, 1000.0);         // 5 Hz at 1000 samples per second
+ *    wave.setPhaseOffset(1, wgDegrees(90));  // channel 1 is a cosine
+ *
+ *    uint16_t v[2];
+ *    wave.next(v);                           // once per sample
+ *
+ *  The table is worked out by the compiler so there's nothing to paste in
+ *  when you change its size. It's in PROGMEM so on the ATmega it lives in
+ *  flash rather than RAM.
+ *
+ *  next() is an add, a shift and a table read for each channel, less than a
+ *  microsecond on the Uno, so it's fine to call it from a timer ISR. If you
+ *  do, change the frequency and phases with the interrupts off as the
+ *  ATmega can't write 32 bits in one go.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _WAVE_GEN_H_
+#define _WAVE_GEN_H_
+
+#include "Arduino.h"
+
+// The compiler has already done all the work in these so they only need
+// to be good enough to round to 16 bits. C++11 constexpr functions have to
+// be a single return statement, hence the nesting.
+
+// sin(x) for -pi/2 <= x <= pi/2 from its Taylor series, good to about 1e-9
+constexpr double _wgSinPoly(double x, double x2)
+{
+  return x * (1 - x2 / 6 * (1 - x2 / 20 * (1 - x2 / 42 * (1 - x2 / 72 * (1 - x2 / 110 * (1 - x2 / 156))))));
+}
+
+// sin(x) for 0 <= x < 2 pi
+constexpr double _wgSin(double x)
+{
+  return (x < PI / 2) ? _wgSinPoly(x, x * x)
+       : (x < 3 * PI / 2) ? _wgSinPoly(PI - x, (PI - x) * (PI - x))
+       : _wgSinPoly(x - 2 * PI, (x - 2 * PI) * (x - 2 * PI));
+}
+
+// Entry i of a table of n entries of a sine wave from 0 to 2 ^ bits - 1
+constexpr uint16_t _wgSample(uint16_t i, uint16_t n, uint8_t bits)
+{
+  return (uint16_t)(((1UL << bits) - 1) / 2.0 * (1 + _wgSin(2 * PI * i / n)) + 0.5);
+}
+
+// A list of the numbers 0..N-1 as a template parameter pack so we can
+// expand it into an initializer list. The list is built by joining two
+// halves so the compiler only recurses log2(N) deep.
+template <uint16_t... I>
+struct _WgIndices
+{
+};
+
+template <typename A, typename B>
+struct _WgJoin;
+
+template <uint16_t... A, uint16_t... B>
+struct _WgJoin<_WgIndices<A...>, _WgIndices<B...> >
+{
+  typedef _WgIndices<A..., (uint16_t)(sizeof...(A) + B)...> type;
+};
+
+template <uint16_t N>
+struct _WgMakeIndices
+{
+  typedef typename _WgJoin<typename _WgMakeIndices<N / 2>::type,
+                           typename _WgMakeIndices<N - N / 2>::type>::type type;
+};
+
+template <>
+struct _WgMakeIndices<0>
+{
+  typedef _WgIndices<> type;
+};
+
+template <>
+struct _WgMakeIndices<1>
+{
+  typedef _WgIndices<0> type;
+};
+
+// The smallest type that holds a table entry
+template <bool WIDE>
+struct _WgValue
+{
+  typedef uint8_t type;
+};
+
+template <>
+struct _WgValue<true>
+{
+  typedef uint16_t type;
+};
+
+// The table is an array inside a struct so a constexpr function can
+// return it with all the entries filled in from the list of indices.
+template <typename T, uint16_t LENGTH>
+struct _WgArray
+{
+  T v[LENGTH];
+};
+
+template <typename T, uint16_t LENGTH, uint16_t... I>
+constexpr _WgArray<T, LENGTH> _wgMakeTable(uint8_t bits, _WgIndices<I...>)
+{
+  return _WgArray<T, LENGTH>{ { (T)_wgSample(I, LENGTH, bits)... } };
+}
+
+/// \brief A table of one cycle of a sine wave.
+/// The values go from 0 to 2 ^ BITS - 1 with the middle at 2 ^ (BITS - 1),
+/// which is what an ADC reading of a biased sine wave looks like.
+/// \tparam LOG2_LENGTH The table has 2 ^ LOG2_LENGTH entries, up to 4096.
+/// \tparam BITS The bits in each entry, up to 16. Up to 8 bits the entries
+/// are bytes.
+template <uint8_t LOG2_LENGTH, uint8_t BITS>
+struct WaveTable
+{
+  static_assert((LOG2_LENGTH >= 1) && (LOG2_LENGTH <= 12), "The table must have 2 to 4096 entries");
+  static_assert((BITS >= 1) && (BITS <= 16), "The table entries must be 1 to 16 bits");
+
+  typedef typename _WgValue<(BITS > 8)>::type value_type;
+  static const uint16_t LENGTH = 1 << LOG2_LENGTH;
+  static const uint8_t LOG2_LEN = LOG2_LENGTH;
+
+  // The entries. It's a static member of a template so there is only one
+  // copy of each size of table however many generators use it.
+  typedef _WgArray<value_type, LENGTH> table_type;
+  static const table_type s_table;
+
+  /// \brief Read entry \p i of the table.
+  static inline value_type read(uint16_t i)
+  {
+    if (sizeof(value_type) == 1) {
+      return (value_type)pgm_read_byte(&s_table.v[i]);
+    }
+    return (value_type)pgm_read_word(&s_table.v[i]);
+  }
+};
+
+template <uint8_t LOG2_LENGTH, uint8_t BITS>
+const typename WaveTable<LOG2_LENGTH, BITS>::table_type WaveTable<LOG2_LENGTH, BITS>::s_table PROGMEM =
+  _wgMakeTable<typename WaveTable<LOG2_LENGTH, BITS>::value_type, (1 << LOG2_LENGTH)>(
+    BITS, typename _WgMakeIndices<(1 << LOG2_LENGTH)>::type());
+
+/// \brief Turn an angle in degrees into a phase for WaveGen.
+constexpr uint32_t wgDegrees(double degrees)
+{
+  return (uint32_t)(degrees / 360.0 * 4294967296.0);
+}
+
+/// \brief A sine wave generator for one or more channels.
+/// All the channels have the same frequency and each has its own phase offset.
+/// \tparam TABLE The WaveTable to use.
+/// \tparam CHANNELS The number of channels.
+template <typename TABLE, uint8_t CHANNELS = 1>
+class WaveGen
+{
+public:
+  typedef typename TABLE::value_type value_type;
+
+  WaveGen()
+  : m_phase(0)
+  , m_step(0)
+  {
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      m_offset[c] = 0;
+    }
+  }
+
+  /// \brief Set the frequency.
+  /// \param hz The frequency you want.
+  /// \param sample_rate How often you call next(), in samples per second.
+  /// If you use at() it's the number of ticks in a second, like 1000000
+  /// for micros().
+  void setFrequency(double hz, double sample_rate)
+  {
+    m_step = (uint32_t)(hz / sample_rate * 4294967296.0);
+  }
+
+  /// \brief Set the phase step for each sample directly.
+  /// The frequency is step x sample rate / 2 ^ 32.
+  void setStep(uint32_t step)
+  {
+    m_step = step;
+  }
+
+  /// \brief Set how far ahead of the phase one of the channels is.
+  /// \param channel The channel.
+  /// \param offset The offset. Use wgDegrees() to work it out.
+  void setPhaseOffset(uint8_t channel, uint32_t offset)
+  {
+    m_offset[channel] = offset;
+  }
+
+  /// \brief Set the phase, to start the wave again for example.
+  void setPhase(uint32_t phase)
+  {
+    m_phase = phase;
+  }
+
+  /// \brief Get the values for the next sample.
+  /// \param p_out Where the CHANNELS values go.
+  inline void next(value_type* p_out)
+  {
+    m_phase += m_step;
+    read(p_out);
+  }
+
+  /// \brief Get the values at a time.
+  /// Use this when the samples aren't evenly spaced. The wave is where it
+  /// would be after \p ticks samples, which is exact even when \p ticks wraps
+  /// around.
+  /// \param ticks The time, in the units of the sample_rate you passed to
+  /// setFrequency().
+  /// \param p_out Where the CHANNELS values go.
+  inline void at(uint32_t ticks, value_type* p_out)
+  {
+    m_phase = ticks * m_step;
+    read(p_out);
+  }
+
+  /// \brief Get the values for the current phase.
+  /// \param p_out Where the CHANNELS values go.
+  inline void read(value_type* p_out) const
+  {
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      p_out[c] = TABLE::read((uint16_t)((m_phase + m_offset[c]) >> (32 - TABLE::LOG2_LEN)));
+    }
+  }
+
+private:
+  uint32_t m_phase;
+  uint32_t m_step;
+  uint32_t m_offset[CHANNELS];
+};
+
+#endif // _WAVE_GEN_H_
@@ -0,0 +1,380 @@
+#!/usr/bin/env python
+
+# Columnar capture files.
+# CSV files are slow to load when a capture runs for hours and they are
+# about three times bigger than the data in them. These files keep each
+# channel in its own column, in chunks, with an index of the time range of
+# each chunk at the end. A reader can mmap the file, look up the chunks for
+# the time window it wants and unpack just those columns without reading
+# anything else.
+#
+# All the values are little endian. The file is:
+#
+# header    32 bytes
+#   magic           4 bytes   'CAPC'
+#   version         16-bits   1
+#   channels        16-bits   the number of value channels, not counting time
+#   sample rate     double    samples per second as the board was set up, 0 if not known
+#   index offset    64-bits   where the index starts, 0 if the file wasn't closed properly
+#   records         64-bits   the number of records in the file
+# then 32 bytes for each channel
+#   name            16 bytes  utf-8, zero padded
+#   units           8 bytes   utf-8, zero padded
+#   type            1 byte    'H' for 16-bit unsigned values
+#   pad             3 bytes
+#   scale           float     multiply the raw value by this to get units
+#
+# chunks, one after another
+#   magic           4 bytes   'CHNK'
+#   count           32-bits   the number of records in the chunk
+#   first record    64-bits   the number of records in the chunks before this one
+#   first time      64-bits   the time of the first record in microseconds
+#   time column     32-bits   for each record, microseconds after the first time
+#   value columns   for each channel, count values, padded to a multiple of 8 bytes
+#
+# index
+#   magic           4 bytes   'INDX'
+#   chunks          32-bits   the number of chunks
+#   then for each chunk
+#     offset        64-bits   where the chunk starts in the file
+#     first time    64-bits
+#     last time     64-bits
+#     first record  64-bits
+#
+# Every column starts on an 8 byte boundary so tools like numpy.frombuffer()
+# can use the columns straight out of the mapped file.
+# The board's 32-bit microsecond times wrap around every 71 minutes. The
+# times in the file keep counting so they can be used to seek in long runs.
+# If a capture is stopped before the index is written the chunks can still
+# be found by stepping from one chunk header to the next.
+
+from __future__ import print_function
+
+import sys
+import optparse
+import bisect
+import mmap
+import struct
+
+MAGIC = b'CAPC'
+CHUNK_MAGIC = b'CHNK'
+INDEX_MAGIC = b'INDX'
+VERSION = 1
+
+HEADER_FORMAT = '<4sHHdQQ'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+CHANNEL_FORMAT = '<16s8sc3xf'
+CHANNEL_SIZE = struct.calcsize(CHANNEL_FORMAT)
+CHUNK_FORMAT = '<4sIQQ'
+CHUNK_SIZE = struct.calcsize(CHUNK_FORMAT)
+INDEX_FORMAT = '<4sI'
+INDEX_SIZE = struct.calcsize(INDEX_FORMAT)
+INDEX_ENTRY_FORMAT = '<QQQQ'
+INDEX_ENTRY_SIZE = struct.calcsize(INDEX_ENTRY_FORMAT)
+
+# How many records we put in a chunk
+RECORDS_PER_CHUNK = 8192
+
+# The type codes we know about and how big they are
+VALUE_SIZES = {'H': 2}
+
+
+# Round a size up to a multiple of 8 bytes
+def pad8(n):
+    return (n + 7) & ~7
+
+
+# The size of the columns in a chunk of count records
+def columnsSize(count, types):
+    return pad8(4 * count) + sum(pad8(VALUE_SIZES[t] * count) for t in types)
+
+
+# One channel of values
+class Channel(object):
+    def __init__(self, name, units='', type='H', scale=1.0):
+        self.name = name
+        self.units = units
+        self.type = type
+        self.scale = scale
+
+    def pack(self):
+        return struct.pack(CHANNEL_FORMAT, self.name.encode('utf-8'), self.units.encode('utf-8'),
+                           self.type.encode('ascii'), self.scale)
+
+    @staticmethod
+    def unpack(data, offset):
+        name, units, type, scale = struct.unpack_from(CHANNEL_FORMAT, data, offset)
+        return Channel(name.rstrip(b'\x00').decode('utf-8'), units.rstrip(b'\x00').decode('utf-8'),
+                       type.decode('ascii'), scale)
+
+
+# Write a capture file. This has the same records() call as the writers in
+# capture.py so it can be used as one of its output formats.
+# The channels are set up from the first records unless you give them.
+class ColumnarWriter(object):
+    extension = '.cap'
+
+    def __init__(self, filename, opt=None, channels=None, sample_rate=0.0):
+        self.filename = filename
+        self.file = open(filename, 'wb')
+        self.channels = channels
+        self.sample_rate = sample_rate
+        self.names = None
+        if opt is not None:
+            self.sample_rate = opt.rate
+            if opt.channels:
+                self.names = opt.channels.split(',')
+        self.index = []
+        self.num_records = 0
+        self.high = 0 # the times wrap at 32 bits so we count the wraps
+        self.last_time = None
+        self._startChunk()
+        if channels:
+            self._writeHeader()
+
+    def raw(self, data):
+        pass
+
+    # Add records. values is a flat tuple of count records of width fields
+    # each, the time and then the channel values.
+    def records(self, width, count, values):
+        if self.channels is None:
+            names = self.names or []
+            names += ['v%d' % n for n in range(len(names) + 1, width)]
+            self.channels = [Channel(name) for name in names[:width - 1]]
+            self._writeHeader()
+        if width != len(self.channels) + 1:
+            raise ValueError('Got records with %d values, the file has %d channels'
+                             % (width - 1, len(self.channels)))
+
+        times = values[0::width]
+        columns = [values[c::width] for c in range(1, width)]
+        start = 0
+        for n in range(count):
+            # make the times carry on counting past 32 bits
+            t = times[n]
+            if self.last_time is not None and t < self.last_time:
+                self.high += 1 << 32
+            self.last_time = t
+            t += self.high
+            if self.chunk_count == 0:
+                self.chunk_time = t
+            elif (t - self.chunk_time) > 0xFFFFFFFF:
+                # the offsets in this chunk won't fit in 32 bits
+                self._addColumns(columns, start, n)
+                start = n
+                self._writeChunk()
+                self.chunk_time = t
+            self.chunk_times.append(t - self.chunk_time)
+            self.chunk_count += 1
+            if self.chunk_count == RECORDS_PER_CHUNK:
+                self._addColumns(columns, start, n + 1)
+                start = n + 1
+                self._writeChunk()
+        self._addColumns(columns, start, count)
+
+    def close(self):
+        if self.channels is None:
+            # no records came so there is nothing to say what the channels are
+            self.channels = []
+            self._writeHeader()
+        self._writeChunk()
+
+        # write the index and then go back and say where it is
+        offset = self.file.tell()
+        self.file.write(struct.pack(INDEX_FORMAT, INDEX_MAGIC, len(self.index)))
+        for entry in self.index:
+            self.file.write(struct.pack(INDEX_ENTRY_FORMAT, *entry))
+        self.file.seek(0)
+        self._writeHeader(offset)
+        self.file.close()
+
+    def _writeHeader(self, index_offset=0):
+        self.file.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(self.channels),
+                                    self.sample_rate, index_offset, self.num_records))
+        for c in self.channels:
+            self.file.write(c.pack())
+
+    def _startChunk(self):
+        self.chunk_count = 0
+        self.chunk_time = 0
+        self.chunk_times = []
+        self.chunk_columns = None
+
+    def _addColumns(self, columns, start, end):
+        if self.chunk_columns is None:
+            self.chunk_columns = [[] for c in columns]
+        for c, column in enumerate(columns):
+            self.chunk_columns[c].extend(column[start:end])
+
+    def _writeChunk(self):
+        count = self.chunk_count
+        if count == 0:
+            return
+        offset = self.file.tell()
+        last_time = self.chunk_time + self.chunk_times[-1]
+        self.index.append((offset, self.chunk_time, last_time, self.num_records))
+        self.file.write(struct.pack(CHUNK_FORMAT, CHUNK_MAGIC, count, self.num_records, self.chunk_time))
+        self._writeColumn('I', 4, self.chunk_times)
+        for c, column in enumerate(self.chunk_columns):
+            type = self.channels[c].type
+            self._writeColumn(type, VALUE_SIZES[type], column)
+        self.num_records += count
+        self._startChunk()
+
+    def _writeColumn(self, type, size, values):
+        data = struct.pack('<%d%s' % (len(values), type), *values)
+        self.file.write(data + b'\x00' * (pad8(len(data)) - len(data)))
+
+
+# Read a capture file. The file is mapped into memory so only the parts
+# you ask for are read from the disk.
+class CapFile(object):
+    def __init__(self, filename):
+        self.file = open(filename, 'rb')
+        self.data = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, num_channels, self.sample_rate, index_offset, self.num_records = \
+            struct.unpack_from(HEADER_FORMAT, self.data, 0)
+        if magic != MAGIC:
+            raise ValueError('Not a capture file')
+        if version != VERSION:
+            raise ValueError('Capture file version %d is not supported' % version)
+        self.channels = [Channel.unpack(self.data, HEADER_SIZE + n * CHANNEL_SIZE)
+                         for n in range(num_channels)]
+        self.types = [c.type for c in self.channels]
+        self.data_offset = HEADER_SIZE + num_channels * CHANNEL_SIZE
+
+        if index_offset:
+            self.index = self._readIndex(index_offset)
+        else:
+            self.index = self._scanChunks()
+            self.num_records = sum(self._chunkHeader(e[0])[0] for e in self.index)
+        # for finding the chunks for a time range
+        self.last_times = [e[2] for e in self.index]
+
+    def close(self):
+        self.data.close()
+        self.file.close()
+
+    # The names of the columns read() returns
+    def names(self):
+        return ['time'] + [c.name for c in self.channels]
+
+    # The time of the first and last records, in microseconds
+    def timeRange(self):
+        if not self.index:
+            return (0, 0)
+        return (self.index[0][1], self.index[-1][2])
+
+    # Get the records with start <= time < end as a list of columns, time first.
+    # The times are in microseconds. Leave start or end out to go from the
+    # beginning or to the end of the file.
+    def read(self, start=None, end=None):
+        columns = [[] for n in range(len(self.channels) + 1)]
+        first = 0 if start is None else bisect.bisect_left(self.last_times, start)
+        for offset, first_time, last_time, first_record in self.index[first:]:
+            if end is not None and first_time >= end:
+                break
+            count, chunk_time = self._chunkHeader(offset)
+            pos = offset + CHUNK_SIZE
+            times = [chunk_time + t for t in struct.unpack_from('<%dI' % count, self.data, pos)]
+
+            # the times are in order so we can find the part we want
+            lo = 0 if start is None else bisect.bisect_left(times, start)
+            hi = count if end is None else bisect.bisect_left(times, end)
+            columns[0].extend(times[lo:hi])
+            pos += pad8(4 * count)
+            for c, type in enumerate(self.types):
+                size = VALUE_SIZES[type]
+                if hi > lo:
+                    columns[c + 1].extend(struct.unpack_from('<%d%s' % (hi - lo, type), self.data,
+                                                             pos + lo * size))
+                pos += pad8(size * count)
+        return columns
+
+    # Write the records with start <= time < end to a CSV file, like the
+    # ones serbinlog.py writes. Those have the board's 32-bit times, so the
+    # times are wrapped back around to match.
+    def exportCsv(self, f, start=None, end=None):
+        columns = self.read(start, end)
+        columns[0] = [t & 0xFFFFFFFF for t in columns[0]]
+        count = len(columns[0])
+        values = tuple(v for record in zip(*columns) for v in record)
+        line = ','.join(['%d'] * len(columns)) + '\n'
+        f.write((line * count) % values)
+        return count
+
+    def _chunkHeader(self, offset):
+        magic, count, first_record, chunk_time = struct.unpack_from(CHUNK_FORMAT, self.data, offset)
+        if magic != CHUNK_MAGIC:
+            raise ValueError('Bad chunk at %d' % offset)
+        return count, chunk_time
+
+    def _readIndex(self, offset):
+        magic, num_chunks = struct.unpack_from(INDEX_FORMAT, self.data, offset)
+        if magic != INDEX_MAGIC:
+            raise ValueError('Bad index at %d' % offset)
+        offset += INDEX_SIZE
+        return [struct.unpack_from(INDEX_ENTRY_FORMAT, self.data, offset + n * INDEX_ENTRY_SIZE)
+                for n in range(num_chunks)]
+
+    # Find the chunks without an index. We stop at the first one that isn't complete.
+    def _scanChunks(self):
+        index = []
+        offset = self.data_offset
+        while offset + CHUNK_SIZE <= len(self.data):
+            magic, count, first_record, chunk_time = struct.unpack_from(CHUNK_FORMAT, self.data, offset)
+            size = CHUNK_SIZE + columnsSize(count, self.types)
+            if magic != CHUNK_MAGIC or offset + size > len(self.data):
+                break
+            last = struct.unpack_from('<I', self.data, offset + CHUNK_SIZE + 4 * (count - 1))[0]
+            index.append((offset, chunk_time, chunk_time + last, first_record))
+            offset += size
+        return index
+
+
+def main():
+    usage = '''
+    usage: %prog info file.cap
+           %prog csv file.cap [options]
+    Use -h to get full help
+    '''
+
+    # create an option parser
+    p = optparse.OptionParser(usage, version='%prog 1.0')
+
+    # Add options to pick the time range
+    p.add_option('--start', '-s', default=None, type='float', action='store', help='Start this many seconds after the first record')
+    p.add_option('--end', '-e', default=None, type='float', action='store', help='Stop this many seconds after the first record')
+
+    # Add an option to set the filename
+    p.add_option('--filename', '-f', default="", action='store', help='Set the CSV filename. Default is the capture file name with .csv on the end')
+
+    # parse the command line ignoring argv[0] (the application name)
+    opt, args = p.parse_args(args=sys.argv[1:])
+
+    if len(args) != 2 or args[0] not in ('info', 'csv'):
+        p.error('Give a command and a capture file')
+    command, filename = args
+
+    cap = CapFile(filename)
+    t0, t1 = cap.timeRange()
+    if command == 'info':
+        print("Records:", cap.num_records, "in", len(cap.index), "chunks")
+        print("Sample rate:", cap.sample_rate if cap.sample_rate else 'not known')
+        print("Time:", t0, "to", t1, "us,", round((t1 - t0) / 1e6, 3), "seconds")
+        for c in cap.channels:
+            print("Channel:", c.name, "units:", c.units, "type:", c.type, "scale:", c.scale)
+    else:
+        start = None if opt.start is None else t0 + int(opt.start * 1e6)
+        end = None if opt.end is None else t0 + int(opt.end * 1e6)
+        if opt.filename == '':
+            opt.filename = filename + '.csv'
+        with open(opt.filename, 'w') as f:
+            count = cap.exportCsv(f, start, end)
+        print("Wrote", count, "records to:", opt.filename)
+    cap.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,304 @@
+#!/usr/bin/env python
+
+# Capture the binary records from the serial port as fast as they arrive.
+# This does the same job as serbinlog.py but it is built to keep up with
+# a board that is sending tens of thousands of records per second:
+# - the main thread does nothing but read the serial port, in big chunks,
+#   and hand the chunks to a queue so it is always ready for the next one
+# - a second thread splits the chunks into frames, decodes them and writes
+#   the output, so a slow disk never makes us miss serial data
+# - the records in the frames are decoded a whole batch at a time with one
+#   struct call, and formatted for CSV with one string format per batch
+#
+# The output format is pluggable. Use --format to pick one:
+#   csv   time,v1,v2 lines like serbinlog.py writes
+#   raw   exactly the bytes that came from the serial port. You can turn
+#         this into any of the other formats later with --replay
+#   columnar
+#         a file with the channels in columns and an index, for loading long
+#         runs quickly. See capfile.py, which can also turn these into CSV
+#
+# See framing.py for the frame format.
+
+from __future__ import print_function
+
+import sys
+import optparse
+import datetime
+import threading
+import struct
+import time
+import traceback
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+import framing
+import capfile
+
+# The most we read from the serial port in one go
+READ_SIZE = 65536
+
+
+# Split a list of frames into blocks of records.
+# Each block is (width, count, values) where width is the number of fields
+# in each record, count is the number of records and values is a flat tuple
+# of all the fields of all the records, one record after another.
+def decodeBlocks(frames):
+    blocks = []
+    plain = bytearray()
+    for seq, type, payload in frames:
+        if type == framing.FRAME_TYPE_RECORDS:
+            # collect these up so we can unpack them all at once
+            plain += payload[:len(payload) - len(payload) % framing.RECORD_SIZE]
+        elif type == framing.FRAME_TYPE_DELTA:
+            # keep the records in order
+            if plain:
+                blocks.append(unpackRecords(plain))
+                plain = bytearray()
+            records = framing.parseDeltaRecords(payload)
+            values = tuple(v for r in records for v in r)
+            blocks.append((len(records[0]), len(records), values))
+    if plain:
+        blocks.append(unpackRecords(plain))
+    return blocks
+
+
+# Unpack a run of FRAME_TYPE_RECORDS records with a single struct call
+def unpackRecords(data):
+    count = len(data) // framing.RECORD_SIZE
+    fmt = framing.RECORD_FORMAT[0] + framing.RECORD_FORMAT[1:] * count
+    return (len(framing.RECORD_FORMAT) - 1, count, struct.unpack(fmt, bytes(data)))
+
+
+# The output formats. Each one gets every chunk of bytes from the serial
+# port with raw() and the records decoded from them with records().
+class Writer(object):
+    extension = '.dat'
+
+    def __init__(self, filename, opt=None):
+        self.filename = filename
+
+    def raw(self, data):
+        pass
+
+    def records(self, width, count, values):
+        pass
+
+    def close(self):
+        pass
+
+
+class CsvWriter(Writer):
+    extension = '.csv'
+
+    def __init__(self, filename, opt=None):
+        Writer.__init__(self, filename, opt)
+        self.file = open(filename, 'w')
+
+    def records(self, width, count, values):
+        line = ','.join(['%d'] * width) + '\n'
+        self.file.write((line * count) % values)
+
+    def close(self):
+        self.file.close()
+
+
+class RawWriter(Writer):
+    extension = '.bin'
+
+    def __init__(self, filename, opt=None):
+        Writer.__init__(self, filename, opt)
+        self.file = open(filename, 'wb')
+
+    def raw(self, data):
+        self.file.write(data)
+
+    def close(self):
+        self.file.close()
+
+
+WRITERS = {
+    'csv': CsvWriter,
+    'raw': RawWriter,
+    'columnar': capfile.ColumnarWriter,
+}
+
+
+# The thread that decodes the data and writes it out
+class CaptureThread(threading.Thread):
+    def __init__(self, chunks, writer, verbose):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.chunks = chunks
+        self.writer = writer
+        self.verbose = verbose
+        self.reader = framing.FrameReader()
+        self.num_records = 0
+        self.num_bytes = 0
+        self.max_backlog = 0
+        self.error = None
+
+    def run(self):
+        last_report = time.time()
+        try:
+            while True:
+                data = self.chunks.get()
+                if data is None:
+                    break
+                self.num_bytes += len(data)
+                self.max_backlog = max(self.max_backlog, self.chunks.qsize())
+                self.writer.raw(data)
+                for width, count, values in decodeBlocks(self.reader.feed(data)):
+                    self.writer.records(width, count, values)
+                    self.num_records += count
+
+                if self.verbose and (time.time() - last_report) >= 1:
+                    last_report = time.time()
+                    self.report()
+        except Exception as e:
+            # let the main thread know so it stops reading
+            self.error = traceback.format_exc()
+
+    def report(self):
+        r = self.reader
+        print("Records:", self.num_records, "Frames:", r.frames, "CRC errors:", r.crc_errors,
+              "Lost frames:", r.lost_frames, "Backlog:", self.chunks.qsize())
+
+
+# Read the serial port until it goes quiet for timeout seconds
+def readSerial(opt, chunks, capture):
+    import serial
+    try:
+        ser = serial.Serial(opt.port, opt.baud, timeout=0.1)
+    except IOError as e:
+        print('Exception', e)
+        exit(1)
+
+    # Windows lets us ask for a bigger driver buffer
+    if hasattr(ser, 'set_buffer_size'):
+        ser.set_buffer_size(rx_size=READ_SIZE * 4)
+
+    print("Receiving serial data from:", opt.port, 'at', opt.baud, 'baud')
+    last_data = time.time()
+    while capture.error is None:
+        n = ser.in_waiting
+        data = ser.read(min(n, READ_SIZE) if n > 0 else 1)
+        if len(data) == 0:
+            if (time.time() - last_data) > opt.timeout:
+                print("Timed out")
+                break
+            continue
+        last_data = time.time()
+        chunks.put(data)
+    ser.close()
+
+
+# Read a raw capture file as if it was coming from the serial port
+def readReplay(opt, chunks, capture):
+    print("Replaying raw data from:", opt.replay)
+    with open(opt.replay, 'rb') as f:
+        while capture.error is None:
+            data = f.read(READ_SIZE)
+            if len(data) == 0:
+                break
+            chunks.put(data)
+
+
+def main():
+    usage = '''
+    usage: %prog -p port [options]
+           %prog --replay raw_file [options]
+    Use -h to get full help
+    '''
+
+    # create an option parser
+    p = optparse.OptionParser(usage, version='%prog 1.0')
+
+    # Add a verbose option
+    p.add_option('--verbose', '-v', action='store_true', help='Show the progress once a second')
+
+    # Add an option to collect a USB port name
+    p.add_option('--port', '-p', default="", action='store', help='Select the USB serial port')
+
+    # Add an option to set the baud rate
+    p.add_option('--baud', '-b', default="115200", action='store', help='Set the baud rate. Default is 115,200')
+
+    # Add an option to read a raw capture instead of the serial port
+    p.add_option('--replay', '-r', default="", action='store', help='Read a file written with --format raw instead of the serial port')
+
+    # Add an option to pick the output format
+    p.add_option('--format', '-F', default="csv", action='store', choices=sorted(WRITERS.keys()),
+                 help='Set the output format: ' + ', '.join(sorted(WRITERS.keys())) + '. Default is csv')
+
+    # Add an option to set the filename
+    # And set the default name from a timestamp
+    p.add_option('--filename', '-f', default="", action='store', help='Set the filename to write the log data to. Default is <timestamp>-log_data.<format>')
+
+    # Add options to describe the data for the columnar files
+    p.add_option('--channels', '-c', default="", action='store', help='Give the channels names for the columnar format, like -c a0,a1. Default is v1,v2,...')
+    p.add_option('--rate', default=0.0, type='float', action='store', help='Set the sample rate the columnar file says the board used')
+
+    # Add an option to set how long we wait for data
+    p.add_option('--timeout', '-t', default=10.0, type='float', action='store', help='Stop when no data comes for this many seconds. Default is 10')
+
+    # parse the command line ignoring argv[0] (the application name)
+    opt, args = p.parse_args(args=sys.argv[1:])
+
+    if opt.port == '' and opt.replay == '':
+        p.error('Port is required')
+
+    writer_class = WRITERS[opt.format]
+    if opt.filename == '':
+        dt = datetime.datetime.now()
+        opt.filename = dt.strftime("%Y-%m-%d-%H%M%S-log_data") + writer_class.extension
+
+    # try to open the file
+    try:
+        writer = writer_class(opt.filename, opt)
+        print("Writing log data to:", opt.filename)
+    except IOError as e:
+        print('Exception', e)
+        exit(1)
+
+    chunks = queue.Queue()
+    capture = CaptureThread(chunks, writer, opt.verbose)
+    capture.start()
+
+    start_time = datetime.datetime.now()
+    try:
+        if opt.replay:
+            readReplay(opt, chunks, capture)
+        else:
+            readSerial(opt, chunks, capture)
+    except KeyboardInterrupt:
+        print("Stopped")
+    except Exception as e:
+        print("Other exception", e)
+        print(traceback.format_exc())
+
+    # let the writer finish what it has
+    chunks.put(None)
+    capture.join()
+    if capture.error:
+        print("Exception in the capture thread")
+        print(capture.error)
+
+    # show how well the link did
+    r = capture.reader
+    print("Frames:", r.frames, "CRC errors:", r.crc_errors, "Lost frames:", r.lost_frames)
+    elapsed = (datetime.datetime.now() - start_time).total_seconds()
+    if elapsed > 0:
+        print("Records:", capture.num_records, "in", round(elapsed, 1), "seconds:",
+              int(capture.num_records / elapsed), "records/second")
+    print("Largest backlog:", capture.max_backlog, "chunks")
+
+    # close the file
+    print("Closing file:", opt.filename)
+    writer.close()
+
+
+if __name__ == '__main__':
+    main()
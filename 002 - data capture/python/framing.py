@@ -0,0 +1,172 @@
+#!/usr/bin/env python
+
+# Decode the COBS framed binary data sent by the Arduino sketches.
+# See cobs_frame.h in the data_cap_binary_example sketch for the format.
+# Each frame is:
+# seq       8-bits  frame sequence number
+# type      8-bits  payload type
+# payload   0..N bytes
+# crc       16-bits CRC-16/CCITT-FALSE of seq, type and payload
+# The frame is COBS encoded and ends with a zero byte.
+
+import binascii
+import struct
+
+# Frame payload types
+FRAME_TYPE_RECORDS = 1
+FRAME_TYPE_DELTA = 2
+FRAME_TYPE_BANDS = 3
+FRAME_TYPE_PEAKS = 4
+
+# Each record in a FRAME_TYPE_RECORDS frame is
+# uint32 time, uint16 v1, uint16 v2 (little endian)
+RECORD_FORMAT = '<LHH'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+# The spectrum frames start with uint32 time, uint32 sample rate, uint8 log2
+# of the FFT size. See ex5_spectrum.ino in the 006 fast adc examples.
+SPECTRUM_HEADER_FORMAT = '<LLB'
+SPECTRUM_HEADER_SIZE = struct.calcsize(SPECTRUM_HEADER_FORMAT)
+
+
+# Compute the CRC-16/CCITT-FALSE of a block of bytes.
+# binascii.crc_hqx uses the same polynomial (0x1021), we just start it at 0xFFFF
+def crc16(data, crc=0xFFFF):
+    return binascii.crc_hqx(bytes(data), crc)
+
+
+# COBS decode a frame (without the zero at the end)
+# Returns a bytearray or None if the frame is not valid
+def cobsDecode(data):
+    out = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        if code == 0:
+            # there should not be any zeros in an encoded frame
+            return None
+        end = index + code
+        if end > len(data):
+            return None
+        out += data[index + 1:end]
+        index = end
+        if code < 0xFF and index < len(data):
+            out.append(0)
+    return out
+
+
+# Collects bytes from the serial port and splits them into frames
+class FrameReader(object):
+    def __init__(self):
+        self.buf = bytearray()
+        self.frames = 0       # good frames
+        self.crc_errors = 0   # frames that failed the CRC or COBS check
+        self.lost_frames = 0  # gaps in the sequence numbers
+        self.next_seq = None
+
+    # Add some bytes from the serial port.
+    # Returns a list of (seq, type, payload) tuples for the complete frames
+    def feed(self, data):
+        self.buf += bytearray(data)
+        # split() finds all the zeros in one go. The last piece is the
+        # start of a frame that hasn't finished arriving yet.
+        pieces = self.buf.split(b'\x00')
+        self.buf = pieces.pop()
+        frames = []
+        for encoded in pieces:
+            if len(encoded) == 0:
+                continue
+            frame = self.decode(encoded)
+            if frame is not None:
+                frames.append(frame)
+        return frames
+
+    # Decode and check one frame
+    def decode(self, encoded):
+        frame = cobsDecode(encoded)
+        if frame is None or len(frame) < 4:
+            self.crc_errors += 1
+            return None
+        crc = frame[-2] | (frame[-1] << 8)
+        if crc16(frame[:-2]) != crc:
+            self.crc_errors += 1
+            return None
+
+        # keep track of any frames we missed
+        seq = frame[0]
+        if self.next_seq is not None and seq != self.next_seq:
+            self.lost_frames += (seq - self.next_seq) & 0xFF
+        self.next_seq = (seq + 1) & 0xFF
+        self.frames += 1
+
+        return (seq, frame[1], frame[2:-2])
+
+
+# Split the payload of a FRAME_TYPE_RECORDS frame into (time, v1, v2) tuples
+def parseRecords(payload):
+    records = []
+    for offset in range(0, len(payload) - RECORD_SIZE + 1, RECORD_SIZE):
+        records.append(struct.unpack_from(RECORD_FORMAT, bytes(payload), offset))
+    return records
+
+
+# Read a zigzag varint from data starting at index.
+# Returns (value, next index)
+def readZigzagVarint(data, index):
+    u = 0
+    shift = 0
+    while True:
+        b = data[index]
+        index += 1
+        u |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            break
+    # undo the zigzag to get the sign back
+    value = (u >> 1) ^ -(u & 1)
+    return value, index
+
+
+# Decode the payload of a FRAME_TYPE_DELTA frame into (time, v1, v2, ...) tuples.
+# See delta_encoder.h in the data_cap_binary_example sketch for the format.
+def parseDeltaRecords(payload):
+    payload = bytearray(payload)
+    channels = payload[0]
+    index = 1 + 4 + 2 * channels
+    first = struct.unpack_from('<L' + 'H' * channels, bytes(payload), 1)
+    time = first[0]
+    values = list(first[1:])
+    interval = 0
+    records = [first]
+    while index < len(payload):
+        d, index = readZigzagVarint(payload, index)
+        interval += d
+        time = (time + interval) & 0xFFFFFFFF
+        for c in range(channels):
+            d, index = readZigzagVarint(payload, index)
+            values[c] += d
+        records.append(tuple([time] + values))
+    return records
+
+
+# Decode the payload of a FRAME_TYPE_BANDS frame.
+# Returns (time, bin width in Hz, bins per band, [band levels])
+def parseBands(payload):
+    payload = bytes(payload)
+    time, rate, log2n = struct.unpack_from(SPECTRUM_HEADER_FORMAT, payload, 0)
+    bins = bytearray(payload)[SPECTRUM_HEADER_SIZE]
+    index = SPECTRUM_HEADER_SIZE + 1
+    count = (len(payload) - index) // 2
+    levels = struct.unpack_from('<' + 'H' * count, payload, index)
+    return (time, float(rate) / (1 << log2n), bins, list(levels))
+
+
+# Decode the payload of a FRAME_TYPE_PEAKS frame.
+# Returns (time, [(frequency in Hz, level)]) with the biggest peak first
+def parsePeaks(payload):
+    payload = bytes(payload)
+    time, rate, log2n = struct.unpack_from(SPECTRUM_HEADER_FORMAT, payload, 0)
+    bin_hz = float(rate) / (1 << log2n)
+    count = (len(payload) - SPECTRUM_HEADER_SIZE) // 4
+    values = struct.unpack_from('<' + 'HH' * count, payload, SPECTRUM_HEADER_SIZE)
+    return (time, [(values[i] * bin_hz, values[i + 1]) for i in range(0, len(values), 2)])
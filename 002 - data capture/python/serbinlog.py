@@ -1,12 +1,14 @@
 #!/usr/bin/env python
 
-# Read binary records from the serial port that are formatted like this:
-# start_record  32-bits 0xFFFFFFFF
+# Read binary records from the serial port.
+# The records are sent in COBS encoded frames with a sequence number and a CRC.
+# See framing.py for the details. The records can also be delta compressed.
+# Each record is formatted like this:
 # timestamp     32-bits microseconds
 # v1            16-bits
 # v2            16-bits
-
-START_SEQ = [0xFF, 0xFF, 0xFF, 0xFF]
+# This is the simple version. capture.py does the same job for boards that
+# send faster than this can keep up with.
 
 import os
 import sys
@@ -16,49 +18,28 @@ import datetime
 import traceback
 import struct
 
-# wait for the start sequence
-def waitForStart(ser):
-    # wait until we've seen the exact start sequence
-    index = 0
-    while True:
-        # get a byte from the serial link
-        data = ord(ser.read(1))
-        if data != START_SEQ[index]:
-            # not what we want
-            index = 0
-            continue # start again
-
-        # this byte matches
-        index += 1
-        if index == len(START_SEQ):
-            # we have found the whole sequence
-            return
-
-
-
-# Read a binary record from the serial port and return a CSV string
-# formatted for the fields in the record: time,v1,v2
-def readRecord(ser):
-    # wait until we've seen the start record
-    waitForStart(ser)
-
-    # Now collect the 8 bytes of the data record
-    data = ser.read(8)
-
-    # Parse the byte array into a struct of:
-    # uint32, uint16, uint16
-    # We assume little endian format (<)
-    s = struct.unpack('<LHH', data)
-
-    # Convert the fields of the struct into decimal values
-    # in a CSV string
-    ts = s[0]
-    v1 = s[1]
-    v2 = s[2]
-    str = '{:d},{:d},{:d}'.format(ts, v1, v2)
-
-    # return the string
-    return str
+import framing
+
+# Read whatever bytes are waiting on the serial port and return
+# a list of CSV strings formatted for the fields in each record: time,v1,v2
+def readRecords(ser, reader):
+    # read everything that's there, or wait for at least one byte
+    n = ser.in_waiting
+    data = ser.read(n if n > 0 else 1)
+    if len(data) == 0:
+        raise serial.SerialTimeoutException()
+
+    lines = []
+    for seq, type, payload in reader.feed(data):
+        if type == framing.FRAME_TYPE_RECORDS:
+            records = framing.parseRecords(payload)
+        elif type == framing.FRAME_TYPE_DELTA:
+            records = framing.parseDeltaRecords(payload)
+        else:
+            continue
+        for r in records:
+            lines.append(','.join(['{:d}'.format(v) for v in r]))
+    return lines
 
 def main():
     usage = '''
@@ -66,10 +47,6 @@ def main():
     Use -h to get full help
     '''
 
-    # debug stuff
-    global START_SEQ
-    print 'Start seq is', len(START_SEQ), 'bytes'
-
     # create an option parser
     p = optparse.OptionParser(usage, version='%prog 1.0')
     
@@ -112,14 +89,19 @@ def main():
         print 'Exception', e
         exit(1)
 
+    reader = framing.FrameReader()
+    num_records = 0
+    start_time = datetime.datetime.now()
     while True:
         try:
-            s = readRecord(ser)
-            if opt.verbose:
-                # show the record on the screen
-                print s
-            opfile.write(s)
-            opfile.write('\n')
+            lines = readRecords(ser, reader)
+            num_records += len(lines)
+            for s in lines:
+                if opt.verbose:
+                    # show the record on the screen
+                    print s
+                opfile.write(s)
+                opfile.write('\n')
         except serial.SerialTimeoutException:
             print "Timed out"
             break
@@ -128,6 +110,12 @@ def main():
             print(traceback.format_exc())
             break
 
+    # show how well the link did
+    print "Frames:", reader.frames, "CRC errors:", reader.crc_errors, "Lost frames:", reader.lost_frames
+    elapsed = (datetime.datetime.now() - start_time).total_seconds()
+    if elapsed > 0:
+        print "Records:", num_records, "in", int(elapsed), "seconds:", int(num_records / elapsed), "records/second"
+
     # close the file
     print "Closing file:", opt.filename
     opfile.close()
@@ -8,6 +8,7 @@ import sys
 import optparse
 import serial
 import datetime
+import traceback
 
 
 
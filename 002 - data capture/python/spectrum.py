@@ -0,0 +1,141 @@
+#!/usr/bin/env python
+
+# Receive the spectrum summaries from the ex5_spectrum FastAdc example.
+# The board does an FFT of each block of samples and sends the band levels
+# (FRAME_TYPE_BANDS) and the biggest peaks (FRAME_TYPE_PEAKS) in the same
+# COBS frames as the data capture examples. See framing.py.
+#
+# The bands go in <filename>-bands.csv as time,level,level,... with a header
+# line giving the frequency range of each band, and the peaks go in
+# <filename>-peaks.csv as time,frequency,level,frequency,level,...
+# The levels are the amplitude of a sine in Q15, so 32768 is a sine that
+# swings over the whole ADC range.
+
+from __future__ import print_function
+
+import sys
+import optparse
+import datetime
+import time
+import traceback
+
+import framing
+
+
+class SpectrumWriter(object):
+    def __init__(self, filename):
+        self.bands_file = open(filename + '-bands.csv', 'w')
+        self.peaks_file = open(filename + '-peaks.csv', 'w')
+        self.bands_header = False
+        self.num_bands = 0
+        self.num_peaks = 0
+
+    def bands(self, payload):
+        t, bin_hz, bins, levels = framing.parseBands(payload)
+        if not self.bands_header:
+            # we don't know the frequencies until the first frame comes
+            ranges = ['%g-%g Hz' % (b * bins * bin_hz, (b + 1) * bins * bin_hz) for b in range(len(levels))]
+            self.bands_file.write('time,' + ','.join(ranges) + '\n')
+            self.bands_header = True
+        self.bands_file.write(','.join(['%d' % v for v in [t] + levels]) + '\n')
+        self.num_bands += 1
+
+    def peaks(self, payload, verbose):
+        t, peaks = framing.parsePeaks(payload)
+        fields = ['%d' % t]
+        for freq, level in peaks:
+            fields.append('%g' % freq)
+            fields.append('%d' % level)
+        self.peaks_file.write(','.join(fields) + '\n')
+        self.num_peaks += 1
+        if verbose:
+            print(' '.join(['%g Hz: %d' % p for p in peaks]))
+
+    def close(self):
+        self.bands_file.close()
+        self.peaks_file.close()
+
+
+def main():
+    usage = '''
+    usage: %prog -p port [options]
+    Use -h to get full help
+    '''
+
+    # create an option parser
+    p = optparse.OptionParser(usage, version='%prog 1.0')
+
+    # Add a verbose option
+    p.add_option('--verbose', '-v', action='store_true', help='Show the peaks on screen as they arrive')
+
+    # Add an option to collect a USB port name
+    p.add_option('--port', '-p', default="", action='store', help='Select the USB serial port')
+
+    # Add an option to set the baud rate
+    p.add_option('--baud', '-b', default="115200", action='store', help='Set the baud rate. Default is 115,200')
+
+    # Add an option to set the filename
+    # And set the default name from a timestamp
+    dt = datetime.datetime.now()
+    fn_def = dt.strftime("%Y-%m-%d-%H%M%S-spectrum")
+    p.add_option('--filename', '-f', default=fn_def, action='store', help='Set the start of the names of the files to write. Default is <timestamp>-spectrum')
+
+    # Add an option to set how long we wait for data
+    p.add_option('--timeout', '-t', default=10.0, type='float', action='store', help='Stop when no data comes for this many seconds. Default is 10')
+
+    # parse the command line ignoring argv[0] (the application name)
+    opt, args = p.parse_args(args=sys.argv[1:])
+
+    if opt.port == '':
+        p.error('Port is required')
+
+    import serial
+    try:
+        ser = serial.Serial(opt.port, opt.baud, timeout=0.1)
+    except IOError as e:
+        print('Exception', e)
+        exit(1)
+
+    print("Receiving serial data from:", opt.port, 'at', opt.baud, 'baud')
+
+    # try to open the files
+    try:
+        writer = SpectrumWriter(opt.filename)
+        print("Writing spectrum data to:", opt.filename + '-bands.csv', 'and', opt.filename + '-peaks.csv')
+    except IOError as e:
+        print('Exception', e)
+        exit(1)
+
+    reader = framing.FrameReader()
+    last_data = time.time()
+    try:
+        while True:
+            n = ser.in_waiting
+            data = ser.read(n if n > 0 else 1)
+            if len(data) == 0:
+                if (time.time() - last_data) > opt.timeout:
+                    print("Timed out")
+                    break
+                continue
+            last_data = time.time()
+            for seq, type, payload in reader.feed(data):
+                if type == framing.FRAME_TYPE_BANDS:
+                    writer.bands(payload)
+                elif type == framing.FRAME_TYPE_PEAKS:
+                    writer.peaks(payload, opt.verbose)
+    except KeyboardInterrupt:
+        print("Stopped")
+    except Exception as e:
+        print("Other exception", e)
+        print(traceback.format_exc())
+
+    # show how well the link did
+    print("Frames:", reader.frames, "CRC errors:", reader.crc_errors, "Lost frames:", reader.lost_frames)
+    print("Spectra:", writer.num_bands, "band frames,", writer.num_peaks, "peak frames")
+
+    ser.close()
+    writer.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,274 @@
+/** \file fast_pin.h
+ *  \brief Set and clear a digital pin in one instruction.
+ *
+ *  digitalWrite() has to look up the port and bit for the pin in tables
+ *  every time it's called, and check for PWM. That takes about 4 us on
+ *  an Uno. If you use it to show an ISR on a scope, most of what you see
+ *  is digitalWrite(). FastPin<N> works out the port and bit when it's
+ *  compiled, so high() and low() are a single sbi or cbi instruction on
+ *  the ATmega and a single store on the Apollo3:
+ *
+ *    typedef FastPin<2> ScopePin;
+ *    ScopePin::output();   // in setup()
+ *    ScopePin::high();     // in the ISR
+ *    ScopePin::low();
+ *
+ *  On the Uno, Nano and Leonardo N is the Arduino pin number. On the
+ *  Apollo3 it is the pad number of the Artemis module, which is the number
+ *  printed next to the pin on the RedBoard Artemis ATP. On the Uno shaped
+ *  RedBoard Artemis, look the pad up on the schematic. On any other board
+ *  FastPin just calls digitalWrite() and friends so your code still works.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _FAST_PIN_H_
+#define _FAST_PIN_H_
+
+#include "Arduino.h"
+
+#if defined(ARDUINO_ARCH_APOLLO3)
+
+/// \brief A pad on the Artemis module.
+template <uint8_t PAD>
+class FastPin
+{
+public:
+  static_assert(PAD < 50, "The Apollo3 only has pads 0 to 49");
+
+  static void output()
+  {
+    am_hal_gpio_pinconfig(PAD, g_AM_HAL_GPIO_OUTPUT);
+  }
+
+  static void input()
+  {
+    am_hal_gpio_pinconfig(PAD, g_AM_HAL_GPIO_INPUT);
+  }
+
+  // The set and clear registers only change the bits we write a 1 to,
+  // so we don't need to read them first or turn the interrupts off
+  static void high()
+  {
+    ((PAD < 32) ? GPIO->WTSA : GPIO->WTSB) = MASK;
+  }
+
+  static void low()
+  {
+    ((PAD < 32) ? GPIO->WTCA : GPIO->WTCB) = MASK;
+  }
+
+  static void toggle()
+  {
+    if (((PAD < 32) ? GPIO->WTA : GPIO->WTB) & MASK) {
+      low();
+    } else {
+      high();
+    }
+  }
+
+  static bool read()
+  {
+    return ((PAD < 32) ? GPIO->RDA : GPIO->RDB) & MASK;
+  }
+
+  static void write(bool value)
+  {
+    if (value) {
+      high();
+    } else {
+      low();
+    }
+  }
+
+private:
+  static const uint32_t MASK = 1UL << (PAD % 32);
+};
+
+#elif defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega32U4__)
+
+// The ports we know about
+#define _FP_PORTB 1
+#define _FP_PORTC 2
+#define _FP_PORTD 3
+#define _FP_PORTE 4
+#define _FP_PORTF 5
+
+// Each pin is the port in the top bits and the bit number in the low 3 bits
+#define _FP_PIN(port, bit) (((port) << 3) | (bit))
+
+#if defined(__AVR_ATmega32U4__)
+
+// The Leonardo pins are all over the place so we need a table
+constexpr uint8_t _fp_pins[] = {
+  _FP_PIN(_FP_PORTD, 2), _FP_PIN(_FP_PORTD, 3), _FP_PIN(_FP_PORTD, 1), _FP_PIN(_FP_PORTD, 0), // D0..D3
+  _FP_PIN(_FP_PORTD, 4), _FP_PIN(_FP_PORTC, 6), _FP_PIN(_FP_PORTD, 7), _FP_PIN(_FP_PORTE, 6), // D4..D7
+  _FP_PIN(_FP_PORTB, 4), _FP_PIN(_FP_PORTB, 5), _FP_PIN(_FP_PORTB, 6), _FP_PIN(_FP_PORTB, 7), // D8..D11
+  _FP_PIN(_FP_PORTD, 6), _FP_PIN(_FP_PORTC, 7), _FP_PIN(_FP_PORTB, 3), _FP_PIN(_FP_PORTB, 1), // D12..D15
+  _FP_PIN(_FP_PORTB, 2), _FP_PIN(_FP_PORTB, 0), _FP_PIN(_FP_PORTF, 7), _FP_PIN(_FP_PORTF, 6), // D16..D19 (A0, A1)
+  _FP_PIN(_FP_PORTF, 5), _FP_PIN(_FP_PORTF, 4), _FP_PIN(_FP_PORTF, 1), _FP_PIN(_FP_PORTF, 0)  // D20..D23 (A2..A5)
+};
+
+constexpr uint8_t _fastPinCode(uint8_t pin)
+{
+  return _fp_pins[pin];
+}
+
+#define _FP_NUM_PINS (sizeof(_fp_pins) / sizeof(_fp_pins[0]))
+
+#else
+
+// The Uno and Nano: 0..7 are port D, 8..13 are port B and A0..A5 are port C
+constexpr uint8_t _fastPinCode(uint8_t pin)
+{
+  return (pin < 8) ? _FP_PIN(_FP_PORTD, pin)
+      : (pin < 14) ? _FP_PIN(_FP_PORTB, pin - 8)
+      : _FP_PIN(_FP_PORTC, pin - 14);
+}
+
+#define _FP_NUM_PINS 20
+
+#endif
+
+// The registers for each port. These are all inline so the compiler
+// ends up with the address as a constant, which is what lets it use sbi and cbi.
+template <uint8_t PORT>
+struct _FastPort;
+
+#define _FP_DEFINE_PORT(n, letter) \
+  template <> \
+  struct _FastPort<n> \
+  { \
+    static volatile uint8_t& out() { return PORT##letter; } \
+    static volatile uint8_t& ddr() { return DDR##letter; } \
+    static volatile uint8_t& in() { return PIN##letter; } \
+  };
+
+_FP_DEFINE_PORT(_FP_PORTB, B)
+_FP_DEFINE_PORT(_FP_PORTC, C)
+_FP_DEFINE_PORT(_FP_PORTD, D)
+#if defined(__AVR_ATmega32U4__)
+_FP_DEFINE_PORT(_FP_PORTE, E)
+_FP_DEFINE_PORT(_FP_PORTF, F)
+#endif
+
+/// \brief An Arduino pin on an ATmega board.
+template <uint8_t PIN>
+class FastPin
+{
+public:
+  static_assert(PIN < _FP_NUM_PINS, "FastPin doesn't know that pin");
+
+  // These are single bit changes to low I/O registers so the compiler
+  // uses sbi and cbi. They can't be interrupted half way through.
+  static void output()
+  {
+    Port::ddr() |= MASK;
+  }
+
+  static void input()
+  {
+    Port::ddr() &= ~MASK;
+  }
+
+  static void high()
+  {
+    Port::out() |= MASK;
+  }
+
+  static void low()
+  {
+    Port::out() &= ~MASK;
+  }
+
+  // Writing a 1 to the PIN register toggles the output
+  static void toggle()
+  {
+    Port::in() = MASK;
+  }
+
+  static bool read()
+  {
+    return Port::in() & MASK;
+  }
+
+  static void write(bool value)
+  {
+    if (value) {
+      high();
+    } else {
+      low();
+    }
+  }
+
+private:
+  typedef _FastPort<(_fastPinCode(PIN) >> 3)> Port;
+  static const uint8_t MASK = 1 << (_fastPinCode(PIN) & 0x07);
+};
+
+#else // we don't know the pins on this board
+
+/// \brief A pin on a board we don't have a fast version for.
+template <uint8_t PIN>
+class FastPin
+{
+public:
+  static void output()
+  {
+    pinMode(PIN, OUTPUT);
+  }
+
+  static void input()
+  {
+    pinMode(PIN, INPUT);
+  }
+
+  static void high()
+  {
+    digitalWrite(PIN, HIGH);
+  }
+
+  static void low()
+  {
+    digitalWrite(PIN, LOW);
+  }
+
+  static void toggle()
+  {
+    digitalWrite(PIN, !digitalRead(PIN));
+  }
+
+  static bool read()
+  {
+    return digitalRead(PIN) == HIGH;
+  }
+
+  static void write(bool value)
+  {
+    digitalWrite(PIN, value ? HIGH : LOW);
+  }
+};
+
+#endif
+
+#endif // _FAST_PIN_H_
@@ -0,0 +1,84 @@
+/** \file input_capture.h
+ *  \brief Hardware timestamps for input edges using the Timer1 input capture unit.
+ *
+ *  When the selected edge arrives on the ICP1 pin, Timer1 copies its count
+ *  into the ICR1 register in hardware. The time is latched when the edge
+ *  happens, not when the interrupt gets to run, so it isn't affected by
+ *  micros() only counting in 4 us steps or by the time it takes to get into
+ *  the ISR (including waiting for other interrupts like the millis() timer).
+ *
+ *  Timer1 is the cycle timer from cycle_timer.h, running at the full CPU
+ *  clock, which is 62.5 ns per tick at 16 MHz. The captured count is
+ *  extended to 32 bits with the cycle timer's overflow count, so the edge
+ *  times are on the same scale as now_cycles() and wrap around every 268
+ *  seconds. That's fine for working out intervals with unsigned subtraction.
+ *
+ *  The ISR must read ICR1 before the next edge arrives, so the edges need
+ *  to be at least a few tens of microseconds apart.
+ *
+ *  Note that this uses all of Timer1, so you can't use it at the same time
+ *  as analogWrite() on pins 9 and 10 or the Servo library.
+ *
+ *  The input pin is 8 on the Uno and Nano and 4 on the Leonardo.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _INPUT_CAPTURE_H_
+#define _INPUT_CAPTURE_H_
+
+#include "Arduino.h"
+#include "cycle_timer.h"
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+#define ICP1_PIN 8
+#elif defined(__AVR_ATmega32U4__)
+#define ICP1_PIN 4
+#else
+#error "The Timer1 input capture pin isn't available on this board"
+#endif
+
+// The number of timer ticks in a microsecond
+#define ICP_TICKS_PER_US CYCLES_PER_US
+
+/// \brief The function called from the capture ISR for each edge.
+/// \param capture_time The Timer1 count when the edge arrived, extended to 32 bits.
+typedef void (*IcpHandler)(uint32_t capture_time);
+
+/// \brief Start timestamping edges on ICP1_PIN.
+/// \param handler The function to call from the ISR with the time of each edge.
+/// \param edge RISING or FALLING.
+/// \param noise_canceler If true the input must be steady for 4 clock cycles
+/// before an edge is accepted. This rejects glitches but adds a fixed 4 cycle delay.
+void inputCaptureBegin(IcpHandler handler, uint8_t edge, bool noise_canceler = false);
+
+/// \brief Stop the capture interrupts.
+/// Timer1 keeps running as it's the cycle timer.
+void inputCaptureEnd();
+
+/// \brief Get the current 32-bit Timer1 count.
+/// This is on the same scale as the times passed to the handler. It's the
+/// same as now_cycles().
+uint32_t inputCaptureTicks();
+
+#endif // _INPUT_CAPTURE_H_
@@ -0,0 +1,74 @@
+/** \file input_capture.cpp
+ *  \brief Hardware timestamps for input edges using the Timer1 input capture unit.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// This is only built when the sketch asks for it, so the capture
+// interrupt is left alone otherwise.
+#ifdef USE_INPUT_CAPTURE
+
+#include "input_capture.h"
+
+static volatile IcpHandler s_icp_handler = NULL;
+
+void inputCaptureBegin(IcpHandler handler, uint8_t edge, bool noise_canceler)
+{
+  pinMode(ICP1_PIN, INPUT);
+
+  // Timer1 counts every CPU clock for the cycle timer and we use the same count
+  cycle_timer_begin();
+  s_icp_handler = handler;
+
+  uint8_t sreg = SREG;
+  cli();
+  TCCR1B = (TCCR1B & ~(bit(ICNC1) | bit(ICES1)))
+         | (noise_canceler ? bit(ICNC1) : 0)
+         | ((edge == RISING) ? bit(ICES1) : 0);
+
+  // changing the edge can set the flag so clear it before we turn on the interrupt
+  TIFR1 = bit(ICF1);
+  TIMSK1 |= bit(ICIE1);
+  SREG = sreg;
+}
+
+void inputCaptureEnd()
+{
+  TIMSK1 &= ~bit(ICIE1);
+}
+
+uint32_t inputCaptureTicks()
+{
+  return now_cycles();
+}
+
+ISR(TIMER1_CAPT_vect)
+{
+  uint32_t capture_time = cycles_extend(ICR1);
+  IcpHandler handler = s_icp_handler;
+  if (handler) {
+    handler(capture_time);
+  }
+}
+
+#endif // USE_INPUT_CAPTURE
@@ -1,16 +1,29 @@
 /*
  * This example shows how to perform timing of an external hardware event using an interrupt.
- * It compares the results of doing the timing using an interrupt with timing done using
- * calls to micros() in the foreground code.
+ * It compares the results of doing the timing using an interrupt with timing done
+ * in the foreground code. Both read the CPU cycle counter from cycle_timer.h, which
+ * is much finer than the 4 us steps of micros() and quicker to call from the ISR.
  * An external signal source can be used to drive the input, or the squarewave generated from
  * a PWM output in the example. So, if you don't have an external source to use, just connect
  * the PWM output to both the input sampling pins and run the app.
  * Please note that the code is simplified in a few places to keep it short.
- * In particular the stats binning code assumes that the mean interval is about 1,024 us. 
- * If you use a different input source frequency, you'll need to edit the code accordingly.
+ * The histogram bins are set up in setup() for a mean interval of about 1,024 us.
+ * If you use a different input source frequency, change them there or use
+ * setAutoRange() to have VarCalc pick them (see var_calc.h).
  * Note also that this does not work on RedBoard Artemis as the locking scheme is different.
  * Please see the article on portable critical sections for a fix.
  * 
+ * If USE_INPUT_CAPTURE is defined, a third measurement is made with the Timer1 input
+ * capture unit, which latches the edge time in hardware with 62.5 ns resolution.
+ * Connect the PWM output to ICP1_PIN (pin 8 on an Uno) as well for that one.
+ * See input_capture.h for the details.
+ * 
+ * The foreground spins while it waits for the input to change. Define FG_SLEEP
+ * to have it sleep until the next interrupt with the scheduler in task_sched.h
+ * instead. That saves power but it's no longer a fair comparison: whatever ISR
+ * wakes it, usually the background one for the same edge or a Timer0
+ * overflow, adds its time and the wake up time to the foreground times.
+ * 
  * Refs: 
  * https://www.arduino.cc/reference/en/language/functions/external-interrupts/attachinterrupt/
  * https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
@@ -19,7 +32,22 @@
  */
 
 #include "Arduino.h"
-#include "util/atomic.h" // for ATOMIC_BLOCK macro
+#include "var_calc.h"
+#include "fast_pin.h"
+#include "cycle_timer.h"
+#include "task_sched.h"
+
+// Comment this out if you need Timer1 for something else or your board
+// doesn't have the input capture pin
+#define USE_INPUT_CAPTURE
+
+// Uncomment this to have the foreground sleep while it waits for the input
+// rather than spin. See above for what it does to the foreground times.
+//#define FG_SLEEP
+
+#ifdef USE_INPUT_CAPTURE
+#include "input_capture.h"
+#endif
 
 
 // Define the pins we will use for our inputs and outputs
@@ -28,106 +56,28 @@
 #define PWM_OUTPUT_PIN  6   // PWM test signal output to this pin 
 #define ISR_MONITOR_PIN 4   // Pin we can watch on a scope to see ISR timing
 
-// Define a class to do the math required to compute mean and variance
-// on a stream input of sample values.
-// Ref: https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
-// The class update method is safe to be used inside the ISR. 
-// The get... functions can be safely used in the foreground code.
-class VarCalc 
-{
-public:
-  VarCalc(const char* display_name)
-  : n(0)
-  , K(0)
-  , Ex(0)
-  , Ex2(0)
-  , title(display_name)
-  {      
-    memset(bins, 0, sizeof(bins));
-  }
-
-  // Update the computation with a new sample value
-  void update(float x)
-  {
-    if (n == 0) {
-      K = x;
-    }
-    n += 1;
-    Ex += x - K;
-    Ex2 += (x - K) * (x - K);
-
-    // Determine the bin to put this sample into.
-    // We are cheating a lot here because we happen to know the data :)
-    // The mean value is around 1024 so we bin around that
-    x -= 1024; // distance from mean (approx)
-    x /= 25; // bin size in microseconds --> bin number from center
-    int i = 4 + (int) x; // abs bin number
-    if ((i >= 0) && (i < 10)) {
-      bins[i]++;
-    }
-  }
-
-  float getMean()
-  {
-    float mean = 0;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      mean = K + Ex / n;
-    }
-    return mean;
-  }
-
-  float getVariance()
-  {
-    float var = 0;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      var = (Ex2 - (Ex * Ex) / n) / (n - 1);
-    }
-    return var;
-  }
-
-  // Copy the bin data. 
-  // Your bin array MUST be >=10 elements as we don't check the size here
-  void getBins(uint32_t* op_bins)
-  {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      memcpy(op_bins, bins, sizeof(bins));
-    }    
-  }
-
-  // Print out what we have
-  void print()
-  {
-    Serial.print(title);
-    Serial.print(": Mean: ");
-    Serial.print(getMean());
-    Serial.print(" us, Variance: ");
-    Serial.print(getVariance());
-    Serial.println();
-    
-    uint32_t bins[10];
-    getBins(bins);
-    for (uint8_t n = 0; n < 10; n++) {
-      char buf[10];
-      sprintf(buf, " %5ld  ", bins[n]);
-      Serial.print(buf);
-    }
-    Serial.println();
-  }
-
-private:
-  uint32_t n;
-  float K;
-  float Ex;
-  float Ex2;
-  uint32_t bins[10];
-  const char* title;
-};
+// digitalWrite() would add about 8 us to the ISR we're trying to watch,
+// so we set the monitor pin directly
+typedef FastPin<ISR_MONITOR_PIN> IsrMonitorPin;
 
 // Create two variance calculators: one for the foreground code and one for 
 // the background in the ISR. The names are only used when printing
 // out the data.
-VarCalc g_fgVar("Foreground");
-VarCalc g_bgVar("Background");
+// The times are CPU cycles so we use integer math. That keeps the ISR
+// short as the ATmega has no floating point hardware. They are scaled to
+// microseconds when they're printed.
+VarCalc<uint32_t> g_fgVar("Foreground", 1.0f / CYCLES_PER_US);
+VarCalc<uint32_t> g_bgVar("Background", 1.0f / CYCLES_PER_US);
+#ifdef USE_INPUT_CAPTURE
+// the input capture times are on the same scale
+VarCalc<uint32_t> g_icpVar("Input capture", 1.0f / ICP_TICKS_PER_US);
+#endif
+
+#ifdef FG_SLEEP
+// Used to sleep while the foreground waits. It has no tasks so run() just
+// sleeps until the next interrupt.
+Scheduler g_sched;
+#endif
 
 void setup()
 {
@@ -135,6 +85,19 @@ void setup()
   Serial.begin(115200);
   Serial.println("\n\n\n\n\n\nTiming tests\n");
   
+  // Start the cycle counter everything is timed with
+  cycle_timer_begin();
+#ifdef FG_SLEEP
+  g_sched.begin();
+#endif
+
+  // Set up the histograms: 10 bins of 25 us around 1,024 us
+  g_fgVar.setBins(1024 * CYCLES_PER_US, 25 * CYCLES_PER_US);
+  g_bgVar.setBins(1024 * CYCLES_PER_US, 25 * CYCLES_PER_US);
+#ifdef USE_INPUT_CAPTURE
+  g_icpVar.setBins(1024 * ICP_TICKS_PER_US, 25 * ICP_TICKS_PER_US);
+#endif
+
   // Set up the PWM squarewave output that is our test signal source
   pinMode(PWM_OUTPUT_PIN, OUTPUT);
   analogWrite(PWM_OUTPUT_PIN, 128); // 128 gives 50% duty cycle
@@ -145,12 +108,17 @@ void setup()
   pinMode(BG_INPUT_PIN, INPUT);
 
   // To watch the ISR timing we'll toggle an output pin
-  pinMode(ISR_MONITOR_PIN, OUTPUT);
+  IsrMonitorPin::output();
 
   // Attach our background input pin to our interrupt
   // service routine (ISR) and trigger on the falling edge
   // of the signal.
   attachInterrupt(digitalPinToInterrupt(BG_INPUT_PIN), myISR, FALLING);
+
+#ifdef USE_INPUT_CAPTURE
+  // Have Timer1 timestamp the falling edges on the capture pin too
+  inputCaptureBegin(captureISR, FALLING);
+#endif
 }
 
 // A global variable to count the program loops
@@ -167,22 +135,22 @@ void loop()
   // in the foreground code.
 
   // Wait for the input to go high
-  while (digitalRead(FG_INPUT_PIN) == LOW);
+  waitFor(FG_INPUT_PIN, HIGH);
   
   // Wait for the input to go low
-  while (digitalRead(FG_INPUT_PIN) == HIGH);
+  waitFor(FG_INPUT_PIN, LOW);
 
   // Start the timer
-  uint32_t start = micros();
+  cycles_t start = now_cycles();
 
   // Wait for the input to go high
-  while (digitalRead(FG_INPUT_PIN) == LOW);
+  waitFor(FG_INPUT_PIN, HIGH);
 
   // Wait for the input to go low again
-  while (digitalRead(FG_INPUT_PIN) == HIGH);
+  waitFor(FG_INPUT_PIN, LOW);
 
   // Measure the elapsed time
-  uint32_t interval = micros() - start;
+  cycles_t interval = cycles_since(start);
 
   // Update the variance calculation
   g_fgVar.update(interval);
@@ -194,24 +162,38 @@ void loop()
     // show what we've got so far
     g_fgVar.print();
     g_bgVar.print();    
+#ifdef USE_INPUT_CAPTURE
+    g_icpVar.print();
+#endif
     Serial.println();
   }
 
 }
 
+// Wait for an input pin to get to a level. With FG_SLEEP we sleep until
+// the next interrupt before each look at the pin rather than spinning.
+void waitFor(uint8_t pin, uint8_t level)
+{
+  while (digitalRead(pin) != level) {
+#ifdef FG_SLEEP
+    g_sched.run();
+#endif
+  }
+}
+
 // variable to keep track of the previous ISR time
-uint32_t g_prev_edge_time = 0;
+cycles_t g_prev_edge_time = 0;
 
 // Our ISR which gets called when the background input pin changes state
 // from high to low.
 void myISR()
 {
   // Get the time of the falling edge of the input signal
-  uint32_t edge_time = micros();
+  cycles_t edge_time = now_cycles();
   
   // We toggle an output pin here so we can see it on the scope and use
   // the high time to measure how long we are inside the ISR.
-  digitalWrite(ISR_MONITOR_PIN, HIGH); // mark the start of the ISR
+  IsrMonitorPin::high(); // mark the start of the ISR
 
   if (g_prev_edge_time != 0) {
     // Compute the elapsed time since the previous input edge
@@ -225,6 +207,28 @@ void myISR()
   g_prev_edge_time = edge_time;
 
   // toggle the scope pin again just before we exit the ISR
-  digitalWrite(ISR_MONITOR_PIN, LOW); // mark the end of the ISR
+  IsrMonitorPin::low(); // mark the end of the ISR
   
 }
+
+#ifdef USE_INPUT_CAPTURE
+
+// The previous capture time, in Timer1 ticks
+uint32_t g_prev_capture_time = 0;
+bool g_have_capture = false;
+
+// Called from the Timer1 capture ISR with the time each falling edge
+// arrived on the capture pin. The time was latched by the hardware so it
+// doesn't matter how long it took to get here.
+void captureISR(uint32_t capture_time)
+{
+  if (g_have_capture) {
+    // the interval is in timer ticks
+    g_icpVar.update(capture_time - g_prev_capture_time);
+  }
+
+  g_prev_capture_time = capture_time;
+  g_have_capture = true;
+}
+
+#endif // USE_INPUT_CAPTURE
@@ -0,0 +1,356 @@
+/** \file var_calc.h
+ *  \brief Mean, variance and a histogram of a stream of sample values.
+ *
+ *  VarCalc<T> uses the shifted data algorithm: the first sample is kept as K
+ *  and we add up x - K and (x - K)^2 as the samples arrive. When T is an
+ *  integer type those sums are kept in int32_t and int64_t, so update() does
+ *  no floating point math at all. That matters on the ATmega boards which
+ *  have no FPU and where update() is called from an ISR. If the distance
+ *  from K fits in 16 bits, which it nearly always does for timing jitter, the
+ *  square is a single 16x16 bit hardware multiply. The floating point math is
+ *  only done by the get... functions in the foreground code.
+ *  The get... functions read the sums and bins with a sequence lock (see
+ *  critical_section.h) so they never turn the interrupts off.
+ *  VarCalc<float> still works the old way with float sums.
+ *
+ *  The histogram can be set up in one of three ways:
+ *    setBins(centre, width)    NUM_BINS bins of the same width around centre
+ *    setLog2Bins(centre)       bin 0 is exactly centre, bin n holds values
+ *                              between 2^(n-1) and 2^n - 1 away from it
+ *    setAutoRange(n)           look at the first n samples then pick the
+ *                              centre and width to suit them (the default)
+ *  Samples outside the linear bins are not put in any bin. In log2 mode the
+ *  last bin holds everything too far away for the others.
+ *
+ *  Ref: https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _VAR_CALC_H_
+#define _VAR_CALC_H_
+
+#include "Arduino.h"
+#include "critical_section.h"
+
+// How many samples the default auto-range looks at
+#define VAR_CALC_AUTO_SAMPLES 64
+
+// The sums for each sample type. Integer samples use integer sums.
+template <typename T>
+struct _VarSums
+{
+  typedef int32_t Sum;
+  typedef int64_t Sum2;
+
+  static Sum2 square(Sum d)
+  {
+    if ((d >= -32767) && (d <= 32767)) {
+      // most of the time this is all we need
+      return (int32_t)(int16_t)d * (int16_t)d;
+    }
+    return (int64_t)d * d;
+  }
+};
+
+template <>
+struct _VarSums<float>
+{
+  typedef float Sum;
+  typedef float Sum2;
+
+  static Sum2 square(Sum d)
+  {
+    return d * d;
+  }
+};
+
+// Class to do the math required to compute mean and variance
+// on a stream input of sample values.
+// The class update method is safe to be used inside the ISR.
+// The get... functions can be safely used in the foreground code.
+template <typename T, uint8_t NUM_BINS = 10>
+class VarCalc
+{
+public:
+  typedef typename _VarSums<T>::Sum Sum;
+  typedef typename _VarSums<T>::Sum2 Sum2;
+
+  /// \brief Construct the calculator.
+  /// \param display_name The name used by print().
+  /// \param scale What to multiply the values by to get microseconds.
+  /// This is only used by the get... functions and print(), so you can
+  /// give update() raw timer ticks for example.
+  VarCalc(const char* display_name, float scale = 1.0f)
+  : n(0)
+  , K(0)
+  , Ex(0)
+  , Ex2(0)
+  , title(display_name)
+  , m_scale(scale)
+  {
+    setAutoRange(VAR_CALC_AUTO_SAMPLES);
+  }
+
+  /// \brief Use NUM_BINS bins of the same width.
+  /// \param centre The value in the middle of the bins.
+  /// \param width The width of each bin, in the same units as the samples.
+  void setBins(T centre, uint32_t width)
+  {
+    CS_LOCK
+    _setBins(centre, width);
+  }
+
+  /// \brief Use bins that double in width as they get further from centre.
+  /// \param centre The value to measure the distances from.
+  void setLog2Bins(T centre)
+  {
+    CS_LOCK
+    memset(bins, 0, sizeof(bins));
+    m_mode = LOG2;
+    m_bin_lo = centre;
+  }
+
+  /// \brief Set up the bins from the first few samples.
+  /// The samples looked at to pick the range are not put in the histogram
+  /// but they do count towards the mean and variance.
+  /// \param num_samples How many samples to look at.
+  /// \param log2 Use log2 bins around the middle of the range rather than linear ones.
+  void setAutoRange(uint16_t num_samples, bool log2 = false)
+  {
+    CS_LOCK
+    memset(bins, 0, sizeof(bins));
+    m_mode = log2 ? AUTO_LOG2 : AUTO_LINEAR;
+    m_auto_left = num_samples ? num_samples : 1;
+    m_auto_first = true;
+  }
+
+  // Update the computation with a new sample value
+  void update(T x)
+  {
+    SEQ_WRITE(m_lock) {
+      _update(x);
+    }
+  }
+
+  // Get the number of samples so far
+  uint32_t getCount()
+  {
+    uint32_t count;
+    SEQ_READ(m_lock) {
+      count = n;
+    }
+    return count;
+  }
+
+  float getMean()
+  {
+    uint32_t count;
+    T k;
+    Sum ex;
+    SEQ_READ(m_lock) {
+      count = n;
+      k = K;
+      ex = Ex;
+    }
+    if (count == 0) {
+      return 0;
+    }
+
+    // do the math after we have a copy
+    return ((float)k + (float)ex / count) * m_scale;
+  }
+
+  float getVariance()
+  {
+    uint32_t count;
+    Sum ex;
+    Sum2 ex2;
+    SEQ_READ(m_lock) {
+      count = n;
+      ex = Ex;
+      ex2 = Ex2;
+    }
+    if (count < 2) {
+      return 0;
+    }
+    float fex = ex;
+    return ((float)ex2 - (fex * fex) / count) / (count - 1) * m_scale * m_scale;
+  }
+
+  // Copy the bin data.
+  // Your bin array MUST be >= NUM_BINS elements as we don't check the size here
+  void getBins(uint32_t* op_bins)
+  {
+    SEQ_READ(m_lock) {
+      memcpy(op_bins, bins, sizeof(bins));
+    }
+  }
+
+  // Print out what we have
+  void print()
+  {
+    Serial.print(title);
+    Serial.print(": Mean: ");
+    Serial.print(getMean(), 3);
+    Serial.print(" us, Variance: ");
+    Serial.print(getVariance(), 4);
+    Serial.println();
+
+    uint32_t bins[NUM_BINS];
+    getBins(bins);
+    for (uint8_t n = 0; n < NUM_BINS; n++) {
+      char buf[16];
+      sprintf(buf, " %5lu  ", (unsigned long)bins[n]);
+      Serial.print(buf);
+    }
+    Serial.println();
+  }
+
+private:
+  enum Mode : uint8_t
+  {
+    LINEAR,
+    LOG2,
+    AUTO_LINEAR,
+    AUTO_LOG2
+  };
+
+  // Add a sample. Called with the sequence lock taken.
+  void _update(T x)
+  {
+    if (n == 0) {
+      K = x;
+    }
+    n += 1;
+    Sum d = (Sum)(x - K);
+    Ex += d;
+    Ex2 += _VarSums<T>::square(d);
+
+    // Determine the bin to put this sample into.
+    switch (m_mode) {
+    case LINEAR:
+      if (x >= m_bin_lo) {
+        uint32_t offset = (uint32_t)(x - m_bin_lo);
+        if (offset < m_bin_range) {
+          bins[_linearBin(offset)]++;
+        }
+      }
+      break;
+
+    case LOG2:
+      {
+        uint32_t offset = (x >= m_bin_lo) ? (uint32_t)(x - m_bin_lo) : (uint32_t)(m_bin_lo - x);
+        uint8_t i = offset ? sizeof(unsigned long) * 8 - __builtin_clzl(offset) : 0;
+        bins[(i < NUM_BINS) ? i : NUM_BINS - 1]++;
+      }
+      break;
+
+    default: // one of the auto-ranging modes
+      _autoRange(x);
+      break;
+    }
+  }
+
+  // Set up the linear bins. Call this with interrupts off.
+  void _setBins(T centre, uint32_t width)
+  {
+    if (width == 0) {
+      width = 1;
+    }
+    memset(bins, 0, sizeof(bins));
+    m_bin_width = width;
+    m_bin_range = width * NUM_BINS;
+    m_bin_lo = centre - (T)(m_bin_range / 2);
+    if (m_bin_lo > centre) {
+      // an unsigned type went below zero
+      m_bin_lo = 0;
+    }
+
+    // If the whole range fits in 16 bits we can find the bin with a
+    // multiply rather than a divide. The reciprocal is rounded up so the
+    // answer is never too small and at most one too big.
+    m_bin_recip = (m_bin_range <= 65536UL) ? (65536UL + width - 1) / width : 0;
+    m_mode = LINEAR;
+  }
+
+  // Work out which linear bin a sample goes into.
+  // offset is how far above the bottom of the first bin it is.
+  uint8_t _linearBin(uint32_t offset)
+  {
+    if (m_bin_recip) {
+      uint8_t i = (offset * m_bin_recip) >> 16;
+      if ((uint32_t)i * m_bin_width > offset) {
+        i--;
+      }
+      return i;
+    }
+    return offset / m_bin_width;
+  }
+
+  // Collect the range of the first few samples then set up the bins
+  void _autoRange(T x)
+  {
+    if (m_auto_first || (x < m_auto_min)) m_auto_min = x;
+    if (m_auto_first || (x > m_auto_max)) m_auto_max = x;
+    m_auto_first = false;
+    if (--m_auto_left) {
+      return;
+    }
+
+    T centre = m_auto_min + (m_auto_max - m_auto_min) / 2;
+    if (m_mode == AUTO_LOG2) {
+      m_bin_lo = centre;
+      m_mode = LOG2;
+    } else {
+      // leave one spare bin at each end
+      uint32_t span = (uint32_t)(m_auto_max - m_auto_min) + 1;
+      uint8_t num = (NUM_BINS > 2) ? NUM_BINS - 2 : 1;
+      _setBins(centre, (span + num - 1) / num);
+    }
+  }
+
+  uint32_t n;
+  T K;
+  Sum Ex;
+  Sum2 Ex2;
+  uint32_t bins[NUM_BINS];
+  const char* title;
+  float m_scale;
+  SeqLock m_lock; // for reading the sums and bins the ISR writes
+
+  // histogram setup
+  Mode m_mode;
+  T m_bin_lo; // bottom of the first linear bin, or the log2 centre
+  uint32_t m_bin_width;
+  uint32_t m_bin_range; // width of all the bins together
+  uint32_t m_bin_recip; // 65536 / width rounded up, or 0 if we have to divide
+
+  // auto range state
+  uint16_t m_auto_left;
+  bool m_auto_first;
+  T m_auto_min;
+  T m_auto_max;
+};
+
+#endif // _VAR_CALC_H_
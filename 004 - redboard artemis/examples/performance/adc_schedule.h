@@ -0,0 +1,245 @@
+/** \file adc_schedule.h
+ *
+ * ADC conversion schedules for the FastAdc class.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ * A schedule is a table of slots. Each slot says which port to convert,
+ * the exact ADMUX value to use for it, and what the ISR should do once the
+ * conversion is done. The ISR just steps through the table so it doesn't
+ * need to work out which port is next or convert port numbers at run time.
+ *
+ * AdcSchedule<AdcPorts<...>, AdcPorts<...>> builds the table at compile time
+ * for the usual pattern of one pass of the fast list then one slow port.
+ * For the fast list {A0} and slow list {A1, A2, A3} the table is:
+ *   A0 A1 A0 A2 A0 A3
+ *
+ * On the Apollo 3 the ADC steps through its own slots in hardware, so
+ * FastAdc turns the table into a set of slots instead. See fast_adc_apollo3.ino.
+ *
+ * buildAdcSchedule() builds a table at run time from a list of channels
+ * that each have a weight. A channel with a weight of 4 is converted four
+ * times as often as one with a weight of 1, and the conversions for each
+ * channel are spread out as evenly as we can through the table.
+ * For A0 with weight 4 and A1, A2 with weight 1 the table is:
+ *   A0 A0 A1 A0 A2 A0
+ *
+ */
+
+#ifndef _ADC_SCHEDULE_H_
+#define _ADC_SCHEDULE_H_
+
+#include "Arduino.h"
+
+#if defined (ARDUINO_ARCH_APOLLO3)
+
+// The Apollo 3 has 10 single ended ADC inputs, SE0..SE9. We keep the
+// samples by the input number, not the pad or pin number.
+#define NUM_ANALOG_PORTS 10
+
+#elif defined (__AVR_ATmega2560__)
+
+// The Arduino Mega has 16 analog ports. We allow for the max here as it simplifies storing and
+// retrieving the ADC samples
+#define NUM_ANALOG_PORTS 16
+
+#else
+// Assume we are on Uno with 8 ADC inputs,
+// although it really only has 6 accesible
+
+#define NUM_ANALOG_PORTS 8
+
+#endif // (ARDUINO_ARCH_APOLLO3)
+
+// Flags for what the ISR does when the conversion for a slot is complete
+#define SLOT_FAST       0x01 // the sample is from the fast list
+#define SLOT_FAST_DONE  0x02 // call onFastUpdate()
+#define SLOT_SLOW_DONE  0x04 // call onSlowUpdate()
+#define SLOT_MUX5       0x08 // Mega only: port is in the 8..15 bank
+
+/// \brief One entry in an ADC schedule.
+struct AdcSlot
+{
+  uint8_t port;  // analog port index 0..15
+  uint8_t admux; // the value to write to ADMUX for this port, not used on the Apollo 3
+  uint8_t flags; // SLOT_xxx flags
+};
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+// Convert a pad number to the ADC input it's connected to (0..9).
+// The input numbers themselves are left alone so you can use those too.
+// Pads that aren't connected to the ADC give ADC_NO_PORT.
+#define ADC_NO_PORT 0xFF
+
+constexpr uint8_t _adcPortIndex(uint8_t pad)
+{
+  return (pad < NUM_ANALOG_PORTS) ? pad
+      : (pad == 16) ? 0 : (pad == 29) ? 1 : (pad == 11) ? 2 : (pad == 31) ? 3
+      : (pad == 32) ? 4 : (pad == 33) ? 5 : (pad == 34) ? 6 : (pad == 35) ? 7
+      : (pad == 13) ? 8 : (pad == 12) ? 9 : ADC_NO_PORT;
+}
+
+#else
+
+// Convert an analog pin identifier like A0 to the analog port
+// index number (0..N-1).
+constexpr uint8_t _adcPortIndex(uint8_t pin)
+{
+  return (pin < NUM_ANALOG_PORTS) ? pin : (pin - A0);
+}
+
+#endif
+
+/// \brief Build a schedule slot for a pin.
+/// \param pin The analog pin like A0 or the port index like 0.
+/// \param flags What the ISR should do after converting this pin.
+constexpr AdcSlot adcSlot(uint8_t pin, uint8_t flags)
+{
+#ifdef ARDUINO_ARCH_APOLLO3
+  // The Apollo 3 works out its ADC slots from the ports in the table
+  return AdcSlot {_adcPortIndex(pin), 0, flags};
+#else
+  return AdcSlot {
+    _adcPortIndex(pin),
+    (uint8_t)(bit(REFS0) | (_adcPortIndex(pin) & 0x07)),
+    (uint8_t)(flags | ((_adcPortIndex(pin) > 7) ? SLOT_MUX5 : 0))
+  };
+#endif
+}
+
+/// \brief A compile-time list of analog pins like AdcPorts<A0, A1>.
+template <uint8_t... PINS>
+struct AdcPorts
+{
+  static const uint8_t count = sizeof...(PINS);
+};
+
+// Get the i-th value from a list of pins
+constexpr uint8_t _adcNth(uint8_t)
+{
+  return 0;
+}
+
+template <typename... T>
+constexpr uint8_t _adcNth(uint8_t i, uint8_t first, T... rest)
+{
+  return (i == 0) ? first : _adcNth(i - 1, rest...);
+}
+
+// A list of slot numbers 0..N-1 so we can expand the table
+template <uint16_t... I>
+struct _AdcSeq
+{
+};
+
+template <uint16_t N, uint16_t... I>
+struct _AdcMakeSeq : _AdcMakeSeq<N - 1, N - 1, I...>
+{
+};
+
+template <uint16_t... I>
+struct _AdcMakeSeq<0, I...>
+{
+  typedef _AdcSeq<I...> type;
+};
+
+template <class FAST, class SLOW, class SEQ>
+struct _AdcScheduleTable;
+
+template <uint8_t... F, uint8_t... S, uint16_t... I>
+struct _AdcScheduleTable<AdcPorts<F...>, AdcPorts<S...>, _AdcSeq<I...> >
+{
+  static const uint8_t NUM_FAST = sizeof...(F);
+  static const uint8_t NUM_SLOW = sizeof...(S);
+
+  // each pass is the whole fast list followed by one slow port
+  static const uint8_t PERIOD = NUM_SLOW ? (NUM_FAST + 1) : NUM_FAST;
+
+  static constexpr AdcSlot slot(uint16_t i)
+  {
+    return ((i % PERIOD) < NUM_FAST)
+      ? adcSlot(_adcNth(i % PERIOD, F...),
+                SLOT_FAST | (((i % PERIOD) == NUM_FAST - 1) ? SLOT_FAST_DONE : 0))
+      : adcSlot(_adcNth(i / PERIOD, S...),
+                ((i / PERIOD) == NUM_SLOW - 1) ? SLOT_SLOW_DONE : 0);
+  }
+
+  static const AdcSlot table[sizeof...(I)];
+};
+
+template <uint8_t... F, uint8_t... S, uint16_t... I>
+const AdcSlot _AdcScheduleTable<AdcPorts<F...>, AdcPorts<S...>, _AdcSeq<I...> >::table[sizeof...(I)] = {
+  slot(I)...
+};
+
+/// \brief The schedule for a fast list and a slow list, built at compile time.
+/// Use it like this:
+///   typedef AdcSchedule<AdcPorts<A0>, AdcPorts<A1, A2, A3> > MySchedule;
+///   MySchedule::table() is the table and MySchedule::NUM_SLOTS is its size.
+template <class FAST, class SLOW>
+struct AdcSchedule
+{
+  static_assert(FAST::count > 0, "The fast list cannot be empty");
+
+  static const uint16_t NUM_SLOTS = SLOW::count
+    ? (uint16_t)((FAST::count + 1) * SLOW::count)
+    : (uint16_t)FAST::count;
+
+  typedef _AdcScheduleTable<FAST, SLOW, typename _AdcMakeSeq<NUM_SLOTS>::type> _Table;
+
+  static const AdcSlot* table()
+  {
+    return _Table::table;
+  }
+};
+
+/// \brief A channel for a weighted schedule.
+struct AdcChannel
+{
+  uint8_t pin;    // the analog pin like A0
+  uint8_t weight; // how many times per schedule to convert it: 1..255
+  bool fast;      // true to treat it as a fast list port (ring, blocks, onFastUpdate)
+};
+
+/// \brief Build a weighted schedule table.
+/// The table has one slot per unit of weight so its size is the sum of all
+/// the weights. onFastUpdate() is called each time every fast channel has been
+/// converted at least once and onSlowUpdate() is called at the end of the table.
+///
+/// The weights only go up to 255 and each unit of weight costs a 3 byte slot
+/// in RAM, so the rates can't be very far apart. The slowest channel gets one
+/// conversion per table. A channel at 1 Hz next to one at 1 kHz would need a
+/// table of more than 1000 slots, and a weight the fast channel can't have.
+/// For a channel that slow give it a weight of 1 and count the
+/// onSlowUpdate() calls, keeping only every Nth value of it.
+/// \param p_channels The list of channels. At most NUM_ANALOG_PORTS of them.
+/// \param num_channels The number of channels in the list.
+/// \param p_table Where to build the table.
+/// \param max_slots The number of slots p_table has room for.
+/// \return The number of slots used, or zero if the table isn't big enough
+/// or the channel list isn't valid.
+uint16_t buildAdcSchedule(const AdcChannel* p_channels, uint8_t num_channels,
+                          AdcSlot* p_table, uint16_t max_slots);
+
+#endif // _ADC_SCHEDULE_H_
@@ -0,0 +1,90 @@
+/** \file adc_schedule.cpp
+ *
+ * Weighted ADC schedule builder
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "adc_schedule.h"
+
+// We use the "smooth weighted round robin" method to order the slots.
+// Each channel has a running credit. For every slot we add each channel's
+// weight to its credit, pick the channel with the most credit and take the
+// total weight off it. Over the whole table each channel gets picked exactly
+// weight times and the picks are spaced out evenly.
+uint16_t buildAdcSchedule(const AdcChannel* p_channels, uint8_t num_channels,
+                          AdcSlot* p_table, uint16_t max_slots)
+{
+  if ((num_channels == 0) || (num_channels > NUM_ANALOG_PORTS)) {
+    return 0;
+  }
+
+  // add up the weights and make a mask of the fast channels
+  int16_t total = 0;
+  uint16_t fast_mask = 0;
+  for (uint8_t c = 0; c < num_channels; c++) {
+    if (p_channels[c].weight == 0) {
+      return 0;
+    }
+    total += p_channels[c].weight;
+    if (p_channels[c].fast) {
+      fast_mask |= (1 << c);
+    }
+  }
+  if (total > (int16_t)max_slots) {
+    return 0;
+  }
+
+  int16_t credit[NUM_ANALOG_PORTS];
+  memset(credit, 0, sizeof(credit));
+
+  uint16_t fast_seen = 0;
+  for (int16_t n = 0; n < total; n++) {
+    // pick the channel with the most credit
+    uint8_t best = 0;
+    for (uint8_t c = 0; c < num_channels; c++) {
+      credit[c] += p_channels[c].weight;
+      if (credit[c] > credit[best]) {
+        best = c;
+      }
+    }
+    credit[best] -= total;
+
+    uint8_t flags = 0;
+    if (p_channels[best].fast) {
+      flags |= SLOT_FAST;
+      // tell the app once every fast channel has a new sample
+      fast_seen |= (1 << best);
+      if (fast_seen == fast_mask) {
+        flags |= SLOT_FAST_DONE;
+        fast_seen = 0;
+      }
+    }
+    if (n == total - 1) {
+      // every channel has been done at least once now
+      flags |= SLOT_SLOW_DONE;
+    }
+    p_table[n] = adcSlot(p_channels[best].pin, flags);
+  }
+
+  return (uint16_t)total;
+}
@@ -0,0 +1,168 @@
+/** \file bench.h
+ *  \brief A small benchmark harness that runs on the Uno and the Artemis boards.
+ *
+ *  Write each benchmark like a function. The body is one operation:
+ *
+ *    BENCH(float_multiply) {
+ *      g_float_c = g_float_a * g_float_b;
+ *    }
+ *
+ *  and call benchRunAll() from setup(). For each benchmark the harness:
+ *    - works out how many times to run the body so one trial takes
+ *      about BENCH_TRIAL_US microseconds
+ *    - runs BENCH_TRIALS trials of that many operations
+ *    - takes off the time it takes to call an empty benchmark the same
+ *      way, so the loop and the call aren't counted
+ *    - reports the min, median and standard deviation of the time per
+ *      operation, in CPU cycles and nanoseconds
+ *  Use variables declared volatile in the body so the compiler can't
+ *  throw the work away.
+ *
+ *  Some things can't be timed by calling them in a loop, like how long
+ *  an ISR takes or how long it is before an interrupt is taken. For those
+ *  use BENCH_TRIAL(name) and time one trial yourself:
+ *
+ *    BENCH_TRIAL(my_isr) {
+ *      ... do ops operations and time them with now_cycles() ...
+ *      return elapsed_cycles; // or set ops to 0 to skip it
+ *    }
+ *
+ *  The harness runs BENCH_TRIALS of them and works out the stats the
+ *  same way, but it doesn't subtract any overhead for you.
+ *
+ *  The results are printed as a table as each benchmark runs, and then
+ *  again as CSV lines so they can be pasted into a spreadsheet and the
+ *  results from different boards put side by side.
+ *
+ *  The timing uses now_cycles() from cycle_timer.h, which benchRunAll()
+ *  starts. The interrupts are left on, so the millis() timer interrupt
+ *  adds about 0.5% on an Uno.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "Arduino.h"
+#include "cycle_timer.h"
+
+// How long each trial should take
+#ifndef BENCH_TRIAL_US
+#define BENCH_TRIAL_US 20000L
+#endif
+#define BENCH_TRIAL_CYCLES (BENCH_TRIAL_US * CYCLES_PER_US)
+
+// How many trials to run of each benchmark
+#ifndef BENCH_TRIALS
+#define BENCH_TRIALS 9
+#endif
+
+// Output formats for benchRunAll()
+#define BENCH_TEXT 1
+#define BENCH_CSV  2
+
+// The name of the board type for the CSV output
+#ifdef ARDUINO_ARCH_APOLLO3
+#define BENCH_BOARD "Apollo3"
+#else
+#define BENCH_BOARD "ATmega"
+#endif
+
+typedef void (*BenchFn)();
+
+// A benchmark that times itself. It sets ops to the number of operations
+// it did and returns how many CPU cycles they took.
+typedef cycles_t (*BenchTrialFn)(uint32_t& ops);
+
+/// \brief The results of one benchmark. The times are per operation.
+struct BenchResult
+{
+  uint32_t iterations; // operations in each trial, zero if it was skipped
+  float min_ns;
+  float median_ns;
+  float stddev_ns;
+};
+
+/// \brief One registered benchmark. BENCH() creates these for you.
+class BenchEntry
+{
+public:
+  /// \brief Add a benchmark to the list.
+  /// The benchmarks run in the order they are created.
+  BenchEntry(const char* name, BenchFn fn);
+  BenchEntry(const char* name, BenchTrialFn trial);
+
+  const char* m_name;
+  BenchFn m_fn; // one of these is null
+  BenchTrialFn m_trial;
+  BenchResult m_result;
+  BenchEntry* m_p_next;
+
+  static BenchEntry* s_p_first;
+  static BenchEntry* s_p_last;
+
+private:
+  void _add();
+};
+
+/// \brief Declare a benchmark. Follow it with the body in { }.
+#define BENCH(name) \
+  static void __bench_##name(); \
+  static BenchEntry __bench_entry_##name(#name, __bench_##name); \
+  static void __bench_##name()
+
+/// \brief Declare a benchmark that times itself. Follow it with the
+/// body of one trial in { }. It gets passed uint32_t& ops.
+#define BENCH_TRIAL(name) \
+  static cycles_t __bench_##name(uint32_t& ops); \
+  static BenchEntry __bench_entry_##name(#name, __bench_##name); \
+  static cycles_t __bench_##name(uint32_t& ops)
+
+/// \brief Run one benchmark function.
+/// \param fn The function to time. It is called once for each operation.
+/// \param result Where to put the results.
+void benchRun(BenchFn fn, BenchResult& result);
+
+/// \brief Run one benchmark that times itself.
+/// \param trial The function that does one trial.
+/// \param result Where to put the results.
+void benchRun(BenchTrialFn trial, BenchResult& result);
+
+/// \brief Run all the benchmarks and print the results.
+/// \param format BENCH_TEXT, BENCH_CSV or both.
+void benchRunAll(uint8_t format = BENCH_TEXT | BENCH_CSV);
+
+/// \brief Convert a time to CPU cycles.
+inline float benchCycles(float ns)
+{
+  return ns * CYCLES_PER_US / 1000.0f;
+}
+
+/// \brief Convert CPU cycles to a time in nanoseconds.
+inline float benchNs(float cycles)
+{
+  return cycles * 1000.0f / CYCLES_PER_US;
+}
+
+#endif // _BENCH_H_
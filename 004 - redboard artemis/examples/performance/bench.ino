@@ -0,0 +1,255 @@
+/** \file bench.cpp
+ *  \brief A small benchmark harness that runs on the Uno and the Artemis boards.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "bench.h"
+
+BenchEntry* BenchEntry::s_p_first = NULL;
+BenchEntry* BenchEntry::s_p_last = NULL;
+
+BenchEntry::BenchEntry(const char* name, BenchFn fn)
+: m_name(name)
+, m_fn(fn)
+, m_trial(NULL)
+, m_p_next(NULL)
+{
+  _add();
+}
+
+BenchEntry::BenchEntry(const char* name, BenchTrialFn trial)
+: m_name(name)
+, m_fn(NULL)
+, m_trial(trial)
+, m_p_next(NULL)
+{
+  _add();
+}
+
+void BenchEntry::_add()
+{
+  memset(&m_result, 0, sizeof(m_result));
+
+  // add it to the end of the list
+  if (s_p_last) {
+    s_p_last->m_p_next = this;
+  } else {
+    s_p_first = this;
+  }
+  s_p_last = this;
+}
+
+// What we measure the loop and call overhead with.
+// noinline so it really gets called like the others.
+static void __attribute__((noinline)) _benchEmpty()
+{
+  __asm__ __volatile__ ("" ::: "memory");
+}
+
+// Time n calls of fn in CPU cycles
+static cycles_t _benchTime(BenchFn fn, uint32_t n)
+{
+  cycles_t start = now_cycles();
+  for (uint32_t i = 0; i < n; i++) {
+    fn();
+  }
+  return cycles_since(start);
+}
+
+// Work out how many calls it takes to fill a trial
+static uint32_t _benchCalibrate(BenchFn fn)
+{
+  // double it until it takes long enough to measure properly, then
+  // scale it up to the full trial time
+  uint32_t n = 1;
+  cycles_t t;
+  while ((t = _benchTime(fn, n)) < BENCH_TRIAL_CYCLES / 8) {
+    n *= 2;
+  }
+  float scaled = (float)n * BENCH_TRIAL_CYCLES / t;
+  return (scaled < 1) ? 1 : (uint32_t)scaled;
+}
+
+// Sort a few values into order
+static void _benchSort(float* p, uint8_t n)
+{
+  for (uint8_t i = 1; i < n; i++) {
+    float v = p[i];
+    uint8_t j = i;
+    while ((j > 0) && (p[j - 1] > v)) {
+      p[j] = p[j - 1];
+      j--;
+    }
+    p[j] = v;
+  }
+}
+
+// Work out the stats from the time per operation of each trial
+static void _benchStats(float* times, uint32_t n, BenchResult& result)
+{
+  float sum = 0;
+  for (uint8_t i = 0; i < BENCH_TRIALS; i++) {
+    sum += times[i];
+  }
+  float mean = sum / BENCH_TRIALS;
+  float var = 0;
+  for (uint8_t i = 0; i < BENCH_TRIALS; i++) {
+    var += (times[i] - mean) * (times[i] - mean);
+  }
+
+  _benchSort(times, BENCH_TRIALS);
+  result.iterations = n;
+  result.min_ns = times[0];
+  result.median_ns = times[BENCH_TRIALS / 2];
+  result.stddev_ns = (BENCH_TRIALS > 1) ? sqrt(var / (BENCH_TRIALS - 1)) : 0;
+}
+
+// Run the trials of n operations and take the overhead off each one
+static void _benchTrials(BenchFn fn, uint32_t n, float overhead_ns, BenchResult& result)
+{
+  float times[BENCH_TRIALS];
+  for (uint8_t i = 0; i < BENCH_TRIALS; i++) {
+    float t = benchNs(_benchTime(fn, n)) / n - overhead_ns;
+    times[i] = (t > 0) ? t : 0;
+  }
+  _benchStats(times, n, result);
+}
+
+// The time it takes to call an empty benchmark, per call
+static float s_overhead_ns = -1;
+
+void benchRun(BenchFn fn, BenchResult& result)
+{
+  if (s_overhead_ns < 0) {
+    // measure the overhead the first time. We use the fastest
+    // trial since nothing can make it quicker than it really is.
+    BenchResult empty;
+    _benchTrials(_benchEmpty, _benchCalibrate(_benchEmpty), 0, empty);
+    s_overhead_ns = empty.min_ns;
+  }
+  _benchTrials(fn, _benchCalibrate(fn), s_overhead_ns, result);
+}
+
+void benchRun(BenchTrialFn trial, BenchResult& result)
+{
+  float times[BENCH_TRIALS];
+  uint32_t ops = 0;
+  for (uint8_t i = 0; i < BENCH_TRIALS; i++) {
+    ops = 0;
+    cycles_t cycles = trial(ops);
+    if (ops == 0) {
+      // it couldn't run, maybe something isn't wired up
+      memset(&result, 0, sizeof(result));
+      return;
+    }
+    float t = benchNs(cycles) / ops;
+    times[i] = (t > 0) ? t : 0;
+  }
+  _benchStats(times, ops, result);
+}
+
+// Print a value in a column of the given width
+static void _benchPrint(float value, uint8_t width, uint8_t places)
+{
+  uint8_t len = 1 + places + (places ? 1 : 0);
+  for (float v = (value < 0) ? -value : value; v >= 10; v /= 10) {
+    len++;
+  }
+  for (; len < width; len++) {
+    Serial.print(' ');
+  }
+  Serial.print(value, places);
+}
+
+static void _benchPrintName(const char* name, uint8_t width)
+{
+  Serial.print(name);
+  for (uint8_t len = strlen(name); len < width; len++) {
+    Serial.print(' ');
+  }
+}
+
+void benchRunAll(uint8_t format)
+{
+  cycle_timer_begin();
+
+  if (format & BENCH_TEXT) {
+    Serial.println("Benchmark                 cycles/op (median     min  stddev)  ns/op (median)");
+  }
+
+  for (BenchEntry* p = BenchEntry::s_p_first; p; p = p->m_p_next) {
+    if (p->m_fn) {
+      benchRun(p->m_fn, p->m_result);
+    } else {
+      benchRun(p->m_trial, p->m_result);
+    }
+    if (format & BENCH_TEXT) {
+      const BenchResult& r = p->m_result;
+      _benchPrintName(p->m_name, 26);
+      if (r.iterations == 0) {
+        Serial.println("         skipped");
+        continue;
+      }
+      _benchPrint(benchCycles(r.median_ns), 16, 1);
+      _benchPrint(benchCycles(r.min_ns), 8, 1);
+      _benchPrint(benchCycles(r.stddev_ns), 8, 1);
+      _benchPrint(r.median_ns, 16, 1);
+      Serial.println();
+    }
+  }
+
+  if (format & BENCH_CSV) {
+    Serial.println();
+    Serial.println("board,f_cpu,name,iterations,trials,min_cycles,median_cycles,stddev_cycles,min_ns,median_ns,stddev_ns");
+    for (BenchEntry* p = BenchEntry::s_p_first; p; p = p->m_p_next) {
+      const BenchResult& r = p->m_result;
+      Serial.print(BENCH_BOARD);
+      Serial.print(',');
+      Serial.print((uint32_t)F_CPU);
+      Serial.print(',');
+      Serial.print(p->m_name);
+      Serial.print(',');
+      Serial.print(r.iterations);
+      Serial.print(',');
+      Serial.print(BENCH_TRIALS);
+      Serial.print(',');
+      if (r.iterations == 0) {
+        // leave the times empty so they don't look like real results
+        Serial.println(",,,,,");
+        continue;
+      }
+      Serial.print(benchCycles(r.min_ns), 2);
+      Serial.print(',');
+      Serial.print(benchCycles(r.median_ns), 2);
+      Serial.print(',');
+      Serial.print(benchCycles(r.stddev_ns), 2);
+      Serial.print(',');
+      Serial.print(r.min_ns, 1);
+      Serial.print(',');
+      Serial.print(r.median_ns, 1);
+      Serial.print(',');
+      Serial.println(r.stddev_ns, 1);
+    }
+  }
+}
@@ -0,0 +1,347 @@
+/** \file bench_suite.cpp
+ *  \brief Benchmarks for the code the other examples depend on.
+ *
+ *  These time the paths we care about when we change one of the
+ *  shared files, so a change that slows one of them down shows up:
+ *    - analogRead() as used by ex1_analog_read
+ *    - the FastAdc ISR, per conversion
+ *    - sending a line with Serial.write(), serial_printf() and sout
+ *    - f2s()
+ *    - CS_LOCK, the partial locks and the sequence locks
+ *    - how long attachInterrupt() takes to get to your ISR
+ *  The files they use are copies of the ones in the other examples.
+ *
+ *  The interrupt latency test needs BENCH_LOOP_OUT_PIN wired to
+ *  BENCH_LOOP_IN_PIN. It's skipped if they aren't connected.
+ *  On the Artemis the FastAdc tests convert pad 16 (ADC input 0), and
+ *  the ISR only runs once per DMA buffer so the time is shared between
+ *  all the samples in it.
+ *  There can only be one FastAdc in a sketch, so the FastAdc test uses the
+ *  port lists unless BENCH_ADC_SCHEDULE is defined, when it's the schedule
+ *  table from FastAdcT.
+ *
+ */
+
+#include "bench.h"
+#include "serial_utils.h"
+#include "critical_section.h"
+#include "fast_pin.h"
+#include "fast_adc.h"
+#include "cycle_timer.h"
+
+// The pins for the interrupt latency test. Wire them together.
+// We drive the output with FastPin so on the Artemis it's a pad number,
+// which is the same as the pin number on the RedBoard Artemis ATP.
+#ifndef BENCH_LOOP_OUT_PIN
+#define BENCH_LOOP_OUT_PIN 4
+#endif
+#ifndef BENCH_LOOP_IN_PIN
+#define BENCH_LOOP_IN_PIN 2
+#endif
+
+typedef FastPin<BENCH_LOOP_OUT_PIN> BenchLoopPin;
+
+// How many edges we time in each interrupt latency trial
+#define BENCH_INT_EDGES 32
+
+// How many lines we send in each serial trial
+#define BENCH_SERIAL_LINES 8
+
+volatile uint16_t g_adc_value;
+volatile float g_f2s_value = 3.14159f;
+volatile int16_t g_line_a = 12345;
+volatile int16_t g_line_b = -6789;
+
+// The serial tests all send this line. It starts with # so it's easy
+// to tell apart from the results.
+static const char s_line[] = "#bench 12345 -6789\r\n";
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ADC
+
+// The port the FastAdc tests convert. On the Artemis it's a pad number.
+#ifdef ARDUINO_ARCH_APOLLO3
+#define BENCH_ADC_PORT 16
+#else
+#define BENCH_ADC_PORT A0
+#endif
+
+// A FastAdc that just samples one port and counts the conversions.
+// There is no slow list so onFastUpdate() is called for all of them.
+static const uint8_t s_bench_adc_ports[] = {BENCH_ADC_PORT};
+
+#ifndef BENCH_ADC_SCHEDULE
+
+class BenchAdc : public FastAdc<BenchAdc>
+{
+public:
+  BenchAdc()
+  : FastAdc<BenchAdc>(s_bench_adc_ports, 1, NULL, 0)
+  , m_count(0)
+  {
+  }
+
+  void onFastUpdate()
+  {
+    m_count++;
+  }
+
+  volatile uint32_t m_count;
+};
+
+#else
+
+// The same with a schedule table built at compile time
+class BenchAdc : public FastAdcT<BenchAdc, AdcPorts<BENCH_ADC_PORT>, AdcPorts<> >
+{
+public:
+  BenchAdc()
+  : m_count(0)
+  {
+  }
+
+  void onFastUpdate()
+  {
+    m_count++;
+  }
+
+  volatile uint32_t m_count;
+};
+
+#endif // BENCH_ADC_SCHEDULE
+
+BenchAdc g_bench_adc;
+FAST_ADC_ISR(g_bench_adc);
+
+// Count how many times we can go round a loop in BENCH_TRIAL_US
+static uint32_t _benchSpin()
+{
+  uint32_t count = 0;
+  cycles_t start = now_cycles();
+  while (cycles_since(start) < BENCH_TRIAL_CYCLES) {
+    count++;
+  }
+  return count;
+}
+
+// Find out how much time the ISR takes for each conversion. We can't
+// time the ISR from the outside, so we count how many times we can go
+// round a loop with the ADC stopped and then again with it running.
+// The time the loop lost is the time the ISR took.
+// If FastAdc can't get the ADC there are no conversions and the test is skipped.
+static cycles_t _benchAdcTrial(FastAdcBase& adc, volatile uint32_t& count, uint32_t& ops)
+{
+#ifndef ARDUINO_ARCH_APOLLO3
+  // save the analogRead() settings so we can put them back
+  uint8_t adcsra = ADCSRA;
+  uint8_t admux = ADMUX;
+  uint8_t adcsrb = ADCSRB;
+#endif
+
+  uint32_t idle = _benchSpin();
+  count = 0;
+  if (!adc.begin()) {
+    Serial.println("FastAdc::begin() failed. Is the ADC in use or is FAST_ADC_ISR() missing?");
+    ops = 0;
+    return 0;
+  }
+  uint32_t busy = _benchSpin();
+  adc.end();
+
+  // the ISR has stopped so we can read the count
+  ops = count;
+
+#ifndef ARDUINO_ARCH_APOLLO3
+  // let the last conversion finish before analogRead() gets the ADC back
+  while (ADCSRA & bit(ADSC));
+  ADCSRA = adcsra;
+  ADMUX = admux;
+  ADCSRB = adcsrb;
+#endif
+
+  // a noisy trial can go round more times with the ADC running
+  if (busy >= idle) {
+    return 0;
+  }
+  return (float)(idle - busy) * BENCH_TRIAL_CYCLES / idle;
+}
+
+#ifndef BENCH_ADC_SCHEDULE
+BENCH_TRIAL(fast_adc_isr)
+#else
+BENCH_TRIAL(fast_adc_isr_schedule)
+#endif
+{
+  return _benchAdcTrial(g_bench_adc, g_bench_adc.m_count, ops);
+}
+
+// This comes after the FastAdc tests because on the Artemis analogRead()
+// can keep hold of the ADC once it has used it
+BENCH(analog_read)
+{
+  g_adc_value = analogRead(A0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Serial output
+
+// Time sending BENCH_SERIAL_LINES lines one at a time. We wait for each
+// one to go before we send the next so there's always room in the
+// transmit buffer. That way we time the work it takes to get the line
+// into the buffer, not how long it takes to go down the wire.
+static cycles_t _benchSerialTrial(void (*send)(), uint32_t& ops)
+{
+  cycles_t total = 0;
+  for (uint8_t i = 0; i < BENCH_SERIAL_LINES; i++) {
+    Serial.flush();
+    cycles_t start = now_cycles();
+    send();
+    total += cycles_since(start);
+  }
+  Serial.flush();
+  ops = BENCH_SERIAL_LINES;
+  return total;
+}
+
+static void _benchSendWrite()
+{
+  Serial.write((const uint8_t*)s_line, sizeof(s_line) - 1);
+}
+
+static void _benchSendPrintf()
+{
+  serial_printf("#bench %5d %5d", g_line_a, g_line_b);
+}
+
+static void _benchSendSout()
+{
+  int16_t a = g_line_a;
+  int16_t b = g_line_b;
+  sout("#bench %5d %5d", a, b);
+}
+
+BENCH_TRIAL(serial_write_line)
+{
+  return _benchSerialTrial(_benchSendWrite, ops);
+}
+
+BENCH_TRIAL(serial_printf_line)
+{
+  return _benchSerialTrial(_benchSendPrintf, ops);
+}
+
+BENCH_TRIAL(sout_line)
+{
+  return _benchSerialTrial(_benchSendSout, ops);
+}
+
+// How long each byte takes when we send faster than the port can go.
+// This is the most we can send at this baud rate.
+BENCH_TRIAL(serial_wire_byte)
+{
+  Serial.flush();
+  cycles_t start = now_cycles();
+  for (uint8_t i = 0; i < BENCH_SERIAL_LINES; i++) {
+    Serial.write((const uint8_t*)s_line, sizeof(s_line) - 1);
+  }
+  Serial.flush();
+  ops = BENCH_SERIAL_LINES * (sizeof(s_line) - 1);
+  return cycles_since(start);
+}
+
+BENCH(f2s)
+{
+  char buf[F2S_MAX_LEN];
+  f2s(g_f2s_value, 3, buf, sizeof(buf));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Critical sections
+
+SeqLock g_bench_seq;
+volatile uint16_t g_bench_shared;
+
+// Turning all the interrupts off and back on
+BENCH(cs_lock)
+{
+  CS_LOCK
+}
+
+// Only holding off some of them
+BENCH(cs_lock_partial)
+{
+#ifdef ARDUINO_ARCH_APOLLO3
+  CS_LOCK_PRIO(4)
+#else
+  CS_LOCK_INT0
+#endif
+}
+
+BENCH(seq_write)
+{
+  SEQ_WRITE(g_bench_seq) {
+    g_bench_shared = 1;
+  }
+}
+
+BENCH(seq_read)
+{
+  uint16_t v;
+  SEQ_READ(g_bench_seq) {
+    v = g_bench_shared;
+  }
+  g_adc_value = v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Interrupt latency
+
+static volatile cycles_t s_int_time;
+static volatile bool s_int_seen;
+
+static void _benchIntIsr()
+{
+  s_int_time = now_cycles();
+  s_int_seen = true;
+}
+
+// The time from the output pin going high to the ISR attachInterrupt()
+// calls reading the time. Reading the time takes a few cycles so we time
+// the same thing without the interrupt and take that off.
+BENCH_TRIAL(attach_interrupt_latency)
+{
+  BenchLoopPin::output();
+  BenchLoopPin::low();
+  pinMode(BENCH_LOOP_IN_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(BENCH_LOOP_IN_PIN), _benchIntIsr, RISING);
+
+  cycles_t total = 0;
+  for (uint8_t i = 0; i < BENCH_INT_EDGES; i++) {
+    // writing LOW when it's already low doesn't make an edge, so
+    // this is the time it takes without the interrupt
+    cycles_t start = now_cycles();
+    BenchLoopPin::low();
+    cycles_t base = cycles_since(start);
+    delayMicroseconds(20);
+
+    s_int_seen = false;
+    start = now_cycles();
+    BenchLoopPin::high();
+    while (!s_int_seen) {
+      if (cycles_since(start) > 1000 * CYCLES_PER_US) {
+        // nothing came, the pins can't be wired together
+        detachInterrupt(digitalPinToInterrupt(BENCH_LOOP_IN_PIN));
+        BenchLoopPin::low();
+        return 0;
+      }
+    }
+    cycles_t latency = s_int_time - start;
+    total += (latency > base) ? latency - base : 0;
+    BenchLoopPin::low();
+    delayMicroseconds(20);
+  }
+
+  detachInterrupt(digitalPinToInterrupt(BENCH_LOOP_IN_PIN));
+  ops = BENCH_INT_EDGES;
+  return total;
+}
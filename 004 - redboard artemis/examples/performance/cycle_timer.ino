@@ -0,0 +1,71 @@
+/** \file cycle_timer.cpp
+ *  \brief A CPU cycle counter for timing code and events.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cycle_timer.h"
+
+#if defined(ARDUINO_ARCH_APOLLO3)
+
+void cycle_timer_begin()
+{
+  // turn on the trace unit then the cycle counter
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+#elif defined(__AVR__)
+
+volatile uint16_t _cycle_overflows = 0;
+
+void cycle_timer_begin()
+{
+  uint8_t sreg = SREG;
+  cli();
+  if ((TCCR1A != 0) || ((TCCR1B & (bit(WGM13) | bit(WGM12) | bit(CS12) | bit(CS11) | bit(CS10))) != bit(CS10))) {
+    // Normal mode, counting all the way to 0xFFFF at the CPU clock.
+    // The Arduino core sets Timer1 up for PWM so this is the first time.
+    // Leave the input capture bits alone.
+    TCCR1A = 0;
+    TCCR1B = (TCCR1B & (bit(ICNC1) | bit(ICES1))) | bit(CS10);
+    TCNT1 = 0;
+    _cycle_overflows = 0;
+    TIFR1 = bit(TOV1);
+  }
+  TIMSK1 |= bit(TOIE1);
+  SREG = sreg;
+}
+
+ISR(TIMER1_OVF_vect)
+{
+  _cycle_overflows++;
+}
+
+#else
+
+void cycle_timer_begin()
+{
+}
+
+#endif
@@ -0,0 +1,743 @@
+/** \file fast_adc.h
+ *
+ * Fast ADC class declration.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _FAST_ADC_H_
+#define _FAST_ADC_H_
+
+#include "Arduino.h"
+// Sequence locks so the get functions don't turn the interrupts off,
+// and an ADC-only lock for the rest
+#include "critical_section.h"
+#include "sample_ring.h"
+#include "adc_schedule.h"
+// The ISR and conversion times are measured in CPU cycles
+#include "cycle_timer.h"
+
+#ifdef FAST_ADC_STATS
+
+// Define FAST_ADC_STATS before you include fast_adc.h and FastAdc keeps stats
+// of the ISR and conversion times as well as the last ones. It costs about
+// 160 bytes of RAM and a few dozen cycles in each ISR.
+
+// The number of histogram bins. Bin n counts the times from 2^n up to
+// 2^(n+1)-1 cycles, and the last bin counts everything longer than that.
+#ifndef FAST_ADC_STATS_BINS
+#define FAST_ADC_STATS_BINS 16
+#endif
+
+// The moving average takes 1/2^n of each new time
+#ifndef FAST_ADC_EWMA_SHIFT
+#define FAST_ADC_EWMA_SHIFT 4
+#endif
+
+// The histogram bin for a time. The Cortex-M4 can count the leading zeros
+// in one instruction. The ATmega can't so we look at fewer bits each step.
+inline uint8_t _fastAdcBin(cycles_t t)
+{
+#if defined(__arm__)
+  uint8_t n = t ? (31 - __builtin_clz(t)) : 0;
+#else
+  uint8_t n = 0;
+  if (t >> 16) { n = 16; t >>= 16; }
+  if (t >> 8) { n += 8; t >>= 8; }
+  if (t >> 4) { n += 4; t >>= 4; }
+  if (t >> 2) { n += 2; t >>= 2; }
+  if (t >> 1) { n += 1; }
+#endif
+  return (n < FAST_ADC_STATS_BINS) ? n : (FAST_ADC_STATS_BINS - 1);
+}
+
+/// \brief Stats for one of the times FastAdc measures.
+/// All the times are in CPU cycles. Use cycles_to_ns() or cycles_to_us()
+/// from cycle_timer.h to turn them into times.
+struct FastAdcTimeStats
+{
+  uint32_t count;       // how many times have been added
+  cycles_t min_time;
+  cycles_t max_time;
+  cycles_t ewma_scaled; // the moving average times 2^FAST_ADC_EWMA_SHIFT
+  uint32_t bins[FAST_ADC_STATS_BINS];
+
+  void reset()
+  {
+    memset(this, 0, sizeof(*this));
+    min_time = (cycles_t)-1;
+  }
+
+  /// \brief Add a time. This is called from the ISR.
+  void add(cycles_t t)
+  {
+    if (count++ == 0) {
+      ewma_scaled = t << FAST_ADC_EWMA_SHIFT;
+    } else {
+      ewma_scaled += t - (ewma_scaled >> FAST_ADC_EWMA_SHIFT);
+    }
+    if (t < min_time) {
+      min_time = t;
+    }
+    if (t > max_time) {
+      max_time = t;
+    }
+    bins[_fastAdcBin(t)]++;
+  }
+
+  /// \brief The moving average, weighted to the most recent times.
+  cycles_t average() const
+  {
+    return ewma_scaled >> FAST_ADC_EWMA_SHIFT;
+  }
+
+  /// \brief The time that pct percent of the times were at or under.
+  /// The histogram only knows which power of two each time was under, so
+  /// this is the top of a bin, or the longest time if that's shorter.
+  cycles_t percentile(uint8_t pct) const
+  {
+    uint32_t target = (uint32_t)((uint64_t)count * pct / 100);
+    uint32_t seen = 0;
+    for (uint8_t n = 0; n < FAST_ADC_STATS_BINS - 1; n++) {
+      seen += bins[n];
+      if (seen >= target) {
+        cycles_t top = ((cycles_t)2 << n) - 1;
+        return (top < max_time) ? top : max_time;
+      }
+    }
+    return max_time;
+  }
+};
+
+#endif // FAST_ADC_STATS
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+// How many FIFO entries the DMA copies before we get an interrupt. Each
+// of the two buffers takes 4 bytes per entry.
+#ifndef FAST_ADC_DMA_WORDS
+#define FAST_ADC_DMA_WORDS 64
+#endif
+
+// The resolution of the samples. Ten bits is the same as analogRead() and
+// the ATmega boards so the application code doesn't need to change. The
+// sample ring only has room for 12 bits.
+#ifndef FAST_ADC_PRECISION
+#define FAST_ADC_PRECISION AM_HAL_ADC_SLOT_10BIT
+#endif
+
+// The NVIC priority begin() gives the ADC interrupt, 1 (most urgent) to 7.
+// It can't be 0 as the stats are read with CS_LOCK_PRIO, which can only
+// hold off priorities of 1 or more.
+#ifndef FAST_ADC_IRQ_PRIO
+#define FAST_ADC_IRQ_PRIO 4
+#endif
+
+#else
+
+// If the ISR runs this close to when the next timed conversion was due, in
+// CPU cycles, it starts the timing again from now rather than risk the
+// compare being passed before OCR1B is written.
+#ifndef FAST_ADC_REARM_MARGIN
+#define FAST_ADC_REARM_MARGIN 16
+#endif
+
+#endif // ARDUINO_ARCH_APOLLO3
+
+/// \brief The parts of the fast ADC that don't depend on your class.
+/// Derive your class from FastAdc below, not from this. Everything that
+/// isn't the ISR is in here so it's only compiled once.
+/// On the Artemis (Apollo 3) boards the ports are pad numbers like 16 or
+/// 29, or the ADC input numbers 0..9. The ADC steps through up to 8 slots
+/// in hardware and DMA copies the results out, so the ISR only runs once
+/// every FAST_ADC_DMA_WORDS samples. See fast_adc_apollo3.ino.
+class FastAdcBase
+{
+public:
+  /// \brief Construct with a list of fast ports and a list of slow ports.
+  /// The constructor takes pointers to two lists of analog port numbers to sample
+  /// a null pointer can be used to say that a specific list isn't present.
+  /// Values in either list should be like A0, A2, A5, etc.
+  /// \param p_fast_list A pointer to the list of analog ports to be sampled
+  /// as fast as possible. This list cannot be empty.
+  /// \param num_fast The number of ports in the fast list. This must be at least one.
+  /// \param p_slow_list A pointer to the list of analog ports to be sampled
+  /// slowly.
+  /// \param num_slow The number of ports in the slow list.
+  /// \param sample_rate If this is zero (the default) each conversion is started
+  /// by the ISR as soon as the previous one completes. Otherwise it's the number
+  /// of conversions per second you want. Timer1 compare B is used to trigger each
+  /// conversion in hardware so the sample interval doesn't depend on how long the
+  /// ISR takes. Timer1 keeps counting every CPU clock for the cycle timer, so the
+  /// slowest rate is F_CPU / 65535, which is 245 per second at 16 MHz.
+  /// FastAdc always uses the cycle timer to time the ISR, so on the ATmega you can't
+  /// use Timer1 for anything else (analogWrite on pins 9 and 10, the Servo library
+  /// etc.). The rate must be low enough that each conversion and the ISR are done
+  /// before the next trigger.
+  /// On the Apollo 3 the hardware always triggers the conversions, using timer A3.
+  /// There the rate is the number of times per second every port in the lists is
+  /// converted, and zero means as fast as the ADC can go.
+  FastAdcBase(const uint8_t* p_fast_list, uint8_t num_fast,
+              const uint8_t* p_slow_list, uint8_t num_slow,
+              uint32_t sample_rate = 0);
+
+  /// \brief Construct with a schedule table.
+  /// The ISR steps through the table one slot per conversion and goes back
+  /// to the start when it gets to the end. See adc_schedule.h and the
+  /// FastAdcT template below for how to build the table at compile time.
+  /// The table must stay around for as long as the FastAdc object does.
+  /// \param p_schedule A pointer to the schedule table.
+  /// \param num_slots The number of slots in the table. This must be at least one.
+  /// \param sample_rate As for the other constructor.
+  FastAdcBase(const AdcSlot* p_schedule, uint16_t num_slots,
+              uint32_t sample_rate = 0);
+
+  /// \brief Call this to set up the ADc conversions.
+  /// Call this from your application's \c setup() function to
+  /// start the conversion process.
+  /// \return False if this isn't the FastAdc that FAST_ADC_ISR() hooked up
+  /// to the ADC interrupt, or on the Apollo 3 if something else like
+  /// analogRead() has the ADC, or if the schedule table is empty. Check it,
+  /// as nothing else tells you.
+  bool begin();
+
+  /// \brief Stop the conversions.
+  /// The last samples are still there to read. Call \c begin() to start again.
+  void end();
+
+  /// \brief Keep every sample from the fast list in a ring buffer.
+  /// Call this before \c begin(). The ISR pushes each fast list sample into
+  /// the ring and your \c loop() can drain it with \c SampleRingBase::read().
+  /// Pass a null pointer to stop using the ring.
+  /// \param p_ring The ring to fill. Create it with the SampleRing template.
+  void setSampleRing(SampleRingBase* p_ring);
+
+  /// \brief Start the conversions and capture the fast samples in blocks.
+  /// Call this instead of \c begin(). The ISR fills one buffer with fast list
+  /// samples while your code works on the other. When a buffer is full the ISR
+  /// hands it over and moves on to the other one. Call \c poll() from your
+  /// \c loop() and it will call \c onBlockReady() outside the ISR for each full
+  /// buffer. If you still have the other buffer when the ISR fills the current
+  /// one, the ISR throws the new block away, counts an overrun and starts
+  /// filling it again.
+  /// If you have more than one port in the fast list the samples are interleaved
+  /// in fast list order, so make \p n a multiple of the fast list size.
+  /// \param bufA The first buffer to fill.
+  /// \param bufB The second buffer to fill.
+  /// \param n The number of samples each buffer can hold.
+  /// \return What \c begin() returned.
+  bool beginBlockCapture(uint16_t* bufA, uint16_t* bufB, size_t n);
+
+  /// \brief Get the number of blocks that were thrown away because the
+  /// application still had the other buffer.
+  uint32_t getBlockOverruns();
+
+  /// \brief Get a set of samples.
+  /// Copies the already sampled values to a buffer. The buffer must be
+  /// big enough for the samples to be copied. Max samples is 8 for Uno
+  /// and 16 for Mega. Note that the first sample in the buffer is A0, the
+  /// seconds is A1 and so on.
+  const void getSamples(uint16_t* buf, uint8_t num_samples);
+
+  /// \brief Get a sampled value.
+  /// Returns a single sample for a specific port.
+  /// \param port can be like A3 or just the index index like 3.
+  /// \return The sample value.
+  uint16_t sample(uint8_t port);
+
+  /// \brief Get the most recent ISR run time
+  /// On the Apollo 3 this is the time to handle a whole DMA buffer.
+  /// \return Returns the ISR time in microseconds
+  uint32_t getIsrTime();
+
+  /// \brief Get the most recent ADC conversion time.
+  /// When Timer1 triggers the conversions this is the time from the end of
+  /// one ISR to the start of the next so it includes the idle time.
+  /// On the Apollo 3 it's the time between DMA buffers divided by the number
+  /// of samples in each one.
+  /// \brief Returns the ADC conversion time in microseconds;
+  uint32_t getAdcTime();
+
+  /// \brief Get the actual sample rate when Timer1 triggers the conversions.
+  /// This can be a little different from the rate you asked for because
+  /// the timer can only divide the CPU clock by whole numbers.
+  /// \return The number of conversions per second or zero if Timer1 isn't used.
+  /// On the Apollo 3 it's the number of scans of all the slots per second.
+  uint32_t getSampleRate();
+
+#ifdef FAST_ADC_STATS
+  /// \brief Get a copy of the ISR time stats.
+  /// On the ATmega this holds off the ADC interrupt while it copies them,
+  /// so if the ISR starts the conversions there is a small gap in the samples.
+  /// On the Apollo 3 each time is for a whole DMA buffer.
+  void getIsrStats(FastAdcTimeStats& stats);
+
+  /// \brief Get a copy of the conversion time stats.
+  /// See getAdcTime() for what the time is.
+  void getAdcStats(FastAdcTimeStats& stats);
+
+  /// \brief Clear both sets of stats.
+  void resetStats();
+#endif
+
+protected:
+  // This array is where the ISR stores the analog values it reads
+  // Not all entries may be used
+  volatile uint16_t m_adc_samples[NUM_ANALOG_PORTS];
+
+  // The ISR takes this while it changes m_adc_samples, the times and the
+  // overrun count. The get functions use it to read them without
+  // turning the interrupts off.
+  SeqLock m_seq;
+
+  // The ISR in FastAdc is made of these so it can call the callbacks in
+  // between. They say which callbacks are due with the SLOT_FAST_DONE and
+  // SLOT_SLOW_DONE flags.
+#ifdef ARDUINO_ARCH_APOLLO3
+  // Swap the DMA buffers over and return the full one, or null if the
+  // interrupt wasn't for a full buffer
+  const uint32_t* _takeDmaBuffer();
+  // Store a sample from the DMA buffer
+  inline uint8_t _dmaSample(uint32_t entry);
+  // Work out the times when the whole buffer is done
+  inline void _endDmaIsr(cycles_t isr_start_time);
+#else
+  // Store the conversion and set the mux for the next one
+  uint8_t _nextSample();
+  // Start the next conversion and work out the times
+  inline void _endIsr(cycles_t isr_start_time);
+#endif
+
+  // The block poll() hands over, or null if there isn't one yet
+  const uint16_t* _readyBlock(size_t& n) const
+  {
+    // m_block_ready is a single byte so we don't need a lock to read it
+    uint8_t ready = m_block_ready;
+    if (ready == NO_BLOCK) {
+      return 0;
+    }
+    n = m_block_size;
+    return m_p_block[ready];
+  }
+
+  // Give the block back to the ISR
+  void _releaseBlock()
+  {
+    m_block_ready = NO_BLOCK;
+  }
+
+private:
+  // the lists of fast and slow update ports to sample
+  const uint8_t* m_p_fast_list;
+  const uint8_t m_num_fast;
+  const uint8_t* m_p_slow_list;
+  const uint8_t m_num_slow;
+
+  // the sample rate we were asked for and the one the timer really gives us.
+  // Zero means we start the conversions in the ISR.
+  const uint32_t m_sample_rate;
+  uint32_t m_actual_rate;
+
+  // the schedule table if we have one, and the slot being converted now
+  const AdcSlot* m_p_schedule;
+  const uint16_t m_num_slots;
+  volatile uint16_t m_slot;
+
+  // optional ring that gets a copy of every fast list sample
+  SampleRingBase* volatile m_p_ring;
+
+  // Ping pong buffers for block capture. The ISR fills m_p_block[m_block_active]
+  // and sets m_block_ready to the index of the buffer it has handed over.
+  // The foreground sets it back to NO_BLOCK when it's done with it.
+  static const uint8_t NO_BLOCK = 0xFF;
+  uint16_t* m_p_block[2];
+  size_t m_block_size;
+  size_t m_block_fill;
+  uint8_t m_block_active;
+  volatile uint8_t m_block_ready;
+  volatile uint32_t m_block_overruns;
+
+  // A bunch of variables we use inside the ISR to keep track of which port
+  // we are doing next
+  volatile uint8_t m_adc_pin; // the analog pin we are currently sampling
+  volatile bool m_adc_hiprio; // true if we are on the hi priority list now
+  volatile uint8_t m_adc_hipri_index; // The high prio port we do next
+  volatile uint8_t m_adc_lopri_index; // The low prio port we do next
+
+  // data so we can see how long the ISR takes, in CPU cycles
+  volatile cycles_t m_adc_start_time;
+  volatile cycles_t m_adc_conv_time;
+  volatile cycles_t m_isr_time;
+
+#ifdef FAST_ADC_STATS
+  // and the stats for them, only the ISR changes these
+  FastAdcTimeStats m_isr_stats;
+  FastAdcTimeStats m_adc_stats;
+#endif
+
+
+  // fn to convert the analog pin identifiers like A0 to the analog port
+  // index numer (0..N-1)
+  // On the UNO A0 is 14
+  // On the Apollo 3 it's the pad number or the ADC input number
+  inline uint8_t _ATOPN(uint8_t p)
+  {
+    return _adcPortIndex(p);
+  }
+
+  inline void _captureFast(uint8_t port, uint16_t value);
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+  // The ADC has 8 slots. Each scan converts every slot that's turned on.
+  static const uint8_t MAX_ADC_SLOTS = 8;
+
+  void* m_adc_handle;
+  uint8_t m_num_adc_slots;
+  uint8_t m_slot_port[MAX_ADC_SLOTS];  // the ADC input each slot converts
+  uint8_t m_slot_flags[MAX_ADC_SLOTS]; // SLOT_xxx flags for each slot
+  uint8_t m_slot_avg[MAX_ADC_SLOTS];   // each slot averages 2^n scans for each sample
+  uint8_t m_slow_mask; // the slots for the slow ports
+  uint8_t m_slow_seen; // the slow slots with a new sample since onSlowUpdate()
+
+  // The DMA fills one of these while the ISR works on the other
+  uint32_t m_dma_buf[2][FAST_ADC_DMA_WORDS];
+  uint8_t m_dma_active;
+
+  void _addAdcSlot(uint8_t port, uint8_t flags, uint16_t count, uint16_t* p_counts);
+  void _buildAdcSlots();
+  void _setupTimerA3(uint32_t scan_rate);
+  void _startDma();
+
+#else
+
+  // the number of Timer1 ticks between conversions when it triggers them
+  uint16_t m_timer_interval;
+
+  void _setAdcMux(uint8_t analogPin);
+  void _setupTimer1(uint32_t sample_rate);
+  void _setAdcMux(const AdcSlot* p_slot);
+  uint8_t _nextFromLists(uint16_t value);
+  uint8_t _nextFromSchedule(uint16_t value);
+  inline void _startNext();
+
+#endif
+
+};
+
+
+// Copy a fast list sample to the ring and the capture blocks
+inline void FastAdcBase::_captureFast(uint8_t port, uint16_t value)
+{
+  // keep a copy of fast list samples if we have a ring to put them in
+  if (m_p_ring) {
+    m_p_ring->push(RING_ENTRY(port, value));
+  }
+
+  // and fill the current block if we are doing block capture
+  if (m_block_size) {
+    m_p_block[m_block_active][m_block_fill++] = value;
+    if (m_block_fill == m_block_size) {
+      if (m_block_ready == NO_BLOCK) {
+        // make sure the samples are stored before we hand the block over
+        __asm__ __volatile__ ("" ::: "memory");
+        m_block_ready = m_block_active;
+        m_block_active ^= 1;
+      } else {
+        // the foreground still has the other one so we lose this block
+        SEQ_WRITE(m_seq) {
+          m_block_overruns++;
+        }
+      }
+      m_block_fill = 0;
+    }
+  }
+}
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+inline uint8_t FastAdcBase::_dmaSample(uint32_t entry)
+{
+  uint8_t slot = AM_HAL_ADC_FIFO_SLOT(entry);
+  if (slot >= m_num_adc_slots) {
+    return 0;
+  }
+  uint16_t value = AM_HAL_ADC_FIFO_SAMPLE(entry);
+  uint8_t port = m_slot_port[slot];
+  uint8_t flags = m_slot_flags[slot];
+
+  SEQ_WRITE(m_seq) {
+    m_adc_samples[port] = value;
+  }
+  if (flags & SLOT_FAST) {
+    _captureFast(port, value);
+  }
+
+  // onSlowUpdate() is due when every slow slot has a new sample
+  uint8_t done = flags & SLOT_FAST_DONE;
+  if (m_slow_mask & bit(slot)) {
+    m_slow_seen |= bit(slot);
+    if (m_slow_seen == m_slow_mask) {
+      m_slow_seen = 0;
+      done |= SLOT_SLOW_DONE;
+    }
+  }
+  return done;
+}
+
+inline void FastAdcBase::_endDmaIsr(cycles_t isr_start_time)
+{
+  // The callbacks have been done by now so it's safe to take the lock
+  cycles_t conv_time = (isr_start_time - m_adc_start_time) / FAST_ADC_DMA_WORDS;
+  cycles_t isr_time = now_cycles() - isr_start_time;
+  SEQ_WRITE(m_seq) {
+    m_adc_conv_time = conv_time;
+    m_isr_time = isr_time;
+  }
+  m_adc_start_time = isr_start_time;
+
+#ifdef FAST_ADC_STATS
+  m_isr_stats.add(isr_time);
+  m_adc_stats.add(conv_time);
+#endif
+}
+
+#else
+
+// Get the next conversion going
+inline void FastAdcBase::_startNext()
+{
+  if (m_sample_rate) {
+    // Timer1 starts the next conversion one interval after this one. The trigger
+    // is the rising edge of the compare match flag so we need to clear it, and we
+    // do that after setting the mux so the new channel is used for the next conversion.
+    m_adc_start_time = now_cycles();
+    if ((uint32_t)(uint16_t)(TCNT1 - OCR1B) + FAST_ADC_REARM_MARGIN < m_timer_interval) {
+      OCR1B += m_timer_interval;
+    } else {
+      // We're so late the next compare would already be behind the count
+      // and we'd wait for the timer to go all the way round. Skip that
+      // sample and start again from now.
+      OCR1B = TCNT1 + m_timer_interval;
+    }
+    TIFR1 = bit(OCF1B);
+  } else {
+    // start the next ADC conversion
+    m_adc_start_time = now_cycles();
+    ADCSRA |= bit (ADSC) | bit (ADIE);
+  }
+}
+
+inline void FastAdcBase::_endIsr(cycles_t isr_start_time)
+{
+  // the time since the last conversion started
+  cycles_t conv_time = isr_start_time - m_adc_start_time;
+
+  _startNext();
+
+  // The callbacks have been done by now so it's safe to take the lock
+  cycles_t isr_time = m_adc_start_time - isr_start_time;
+  SEQ_WRITE(m_seq) {
+    m_adc_conv_time = conv_time;
+    m_isr_time = isr_time;
+  }
+
+#ifdef FAST_ADC_STATS
+  m_isr_stats.add(isr_time);
+  m_adc_stats.add(conv_time);
+#endif
+}
+
+#endif // ARDUINO_ARCH_APOLLO3
+
+/// \brief Hook a FastAdc up to the ADC interrupt.
+/// Put this in your sketch after the object, like FAST_ADC_ISR(my_adc);
+/// It writes the ISR, which uses the object directly, and fastAdcInstance()
+/// so begin() can tell it's the one.
+#ifdef ARDUINO_ARCH_APOLLO3
+#define FAST_ADC_ISR(adc) \
+  FastAdcBase* fastAdcInstance() { return &(adc); } \
+  extern "C" void am_adc_isr(void) { (adc)._isr(); }
+extern "C" void am_adc_isr(void);
+#else
+#define FAST_ADC_ISR(adc) \
+  FastAdcBase* fastAdcInstance() { return &(adc); } \
+  ISR(ADC_vect) { (adc)._isr(); }
+#endif
+
+// FAST_ADC_ISR() writes this. There's only one ADC so there can only be one
+// FastAdc: if the compiler says this is defined twice you have used
+// FAST_ADC_ISR() twice, and if the linker says it's missing you haven't
+// used it at all.
+FastAdcBase* fastAdcInstance();
+
+/// \brief Fast analog to digital converter (ADC)
+/// Derive your class from this with the class itself as the template
+/// parameter and hook it up to the ADC interrupt with FAST_ADC_ISR():
+///
+///   class MyAdc : public FastAdc<MyAdc>
+///   {
+///   public:
+///     MyAdc()
+///     : FastAdc<MyAdc>(fast_ports, NUM_FAST_PORTS, slow_ports, NUM_SLOW_PORTS)
+///     {
+///     }
+///
+///     void onFastUpdate()
+///     {
+///       ... in the ISR each time the fast list has been converted ...
+///     }
+///   };
+///
+///   MyAdc my_adc;
+///   FAST_ADC_ISR(my_adc);
+///
+/// The ISR is compiled for your class and your object, so it calls your
+/// callbacks directly, usually inline, with no pointer to look up and no
+/// virtual function. Write whichever of the callbacks below you want with
+/// the same name and arguments, and don't make them virtual. If they're
+/// protected or private make FastAdc<MyAdc> a friend of your class.
+template <class DERIVED>
+class FastAdc : public FastAdcBase
+{
+public:
+  /// \brief Construct with a list of fast ports and a list of slow ports.
+  /// See FastAdcBase for the arguments.
+  FastAdc(const uint8_t* p_fast_list, uint8_t num_fast,
+          const uint8_t* p_slow_list, uint8_t num_slow,
+          uint32_t sample_rate = 0)
+  : FastAdcBase(p_fast_list, num_fast, p_slow_list, num_slow, sample_rate)
+  {
+  }
+
+  /// \brief Construct with a schedule table.
+  /// See FastAdcBase for the arguments.
+  FastAdc(const AdcSlot* p_schedule, uint16_t num_slots,
+          uint32_t sample_rate = 0)
+  : FastAdcBase(p_schedule, num_slots, sample_rate)
+  {
+  }
+
+  /// \brief Deliver a full block of samples if there is one.
+  /// Call this from your \c loop() when you are using \c beginBlockCapture().
+  /// \return True if \c onBlockReady() was called.
+  bool poll()
+  {
+    size_t n;
+    const uint16_t* p_block = _readyBlock(n);
+    if (!p_block) {
+      return false;
+    }
+    _derived()->onBlockReady(p_block, n);
+    _releaseBlock();
+    return true;
+  }
+
+  // The ISR. FAST_ADC_ISR() calls it, you don't need to.
+  inline void _isr()
+  {
+    cycles_t isr_start_time = now_cycles();
+
+#ifdef ARDUINO_ARCH_APOLLO3
+    const uint32_t* p_buf = _takeDmaBuffer();
+    if (!p_buf) {
+      return;
+    }
+    for (uint16_t i = 0; i < FAST_ADC_DMA_WORDS; i++) {
+      uint8_t done = _dmaSample(p_buf[i]);
+      if (done & SLOT_FAST_DONE) {
+        _derived()->onFastUpdate();
+      }
+      if (done & SLOT_SLOW_DONE) {
+        _derived()->onSlowUpdate();
+      }
+    }
+    _endDmaIsr(isr_start_time);
+#else
+    uint8_t done = _nextSample();
+    if (done & SLOT_FAST_DONE) {
+      _derived()->onFastUpdate();
+    }
+    if (done & SLOT_SLOW_DONE) {
+      _derived()->onSlowUpdate();
+    }
+    _endIsr(isr_start_time);
+#endif
+  }
+
+protected:
+  /// \brief Callback when fast samples are available.
+  /// Write this function in your class to be called when all the
+  /// fast list has been updated. Note that your code is inside the ISR so
+  /// it needs to be fast and not interfere with foreground variables etc.
+  void onFastUpdate()
+  {
+  }
+
+  /// \brief Callback when the slow sampled inputs are available.
+  /// Write this function in your class to be called when all the
+  /// slow list has been updated. Note that your code is inside the ISR so
+  /// it needs to be fast and not interfere with foreground variables etc.
+  void onSlowUpdate()
+  {
+  }
+
+  /// \brief Callback when a block of fast samples is ready.
+  /// Write this function in your class to process the blocks
+  /// when you use \c beginBlockCapture(). This is called from \c poll()
+  /// so it is NOT inside the ISR and it can take as long as it likes, as long
+  /// as it's done before the ISR fills the other buffer.
+  /// \param buf The block of samples.
+  /// \param n The number of samples in the block.
+  void onBlockReady(const uint16_t* /* buf */, size_t /* n */)
+  {
+  }
+
+private:
+  inline DERIVED* _derived()
+  {
+    return static_cast<DERIVED*>(this);
+  }
+};
+
+/// \brief Fast ADC with the conversion schedule built at compile time.
+/// Use this just like FastAdc but give it the port lists as template parameters
+/// after your class:
+///   class MyAdc : public FastAdcT<MyAdc, AdcPorts<A0>, AdcPorts<A1, A2, A3> >
+/// The ISR then just steps through a table of ready-made ADMUX values.
+/// On the Apollo 3 the table is turned into ADC slots when you call begin().
+template <class DERIVED, class FAST, class SLOW>
+class FastAdcT : public FastAdc<DERIVED>
+{
+public:
+  typedef AdcSchedule<FAST, SLOW> Schedule;
+
+  /// \brief Construct the ADC.
+  /// \param sample_rate As for the FastAdc constructor.
+  FastAdcT(uint32_t sample_rate = 0)
+  : FastAdc<DERIVED>(Schedule::table(), Schedule::NUM_SLOTS, sample_rate)
+  {
+  }
+};
+
+#endif // _FAST_ADC_H_
@@ -0,0 +1,310 @@
+/** \file fast_adc_apollo3.ino
+ *  \brief FastAdc for the Artemis boards.
+ *
+ *  The Apollo 3 ADC works quite differently from the ATmega one. It has
+ *  8 slots that each convert one input, and a scan converts every slot
+ *  that's turned on, one after the other, with no help from the CPU. The
+ *  results go into an 8 entry FIFO and the DMA copies them from there to
+ *  memory. So rather than the ISR picking the next port after every
+ *  conversion like it does on the ATmega, we set the slots up once in
+ *  begin() and the ISR only runs when a DMA buffer is full.
+ *
+ *  The fast ports get the first slots and the slow ports the rest, so
+ *  there can be at most 8 ports in the two lists together. The slow ports
+ *  are converted in every scan too, but their slots average 2^n scans for
+ *  each sample. That way they come out about as often, compared to the
+ *  fast ports, as they do on the ATmega, and the extra conversions make
+ *  them less noisy. A schedule table works the same way: each port in the
+ *  table gets a slot and averages enough scans to match how many times it
+ *  is in the table.
+ *
+ *  Timer A3 triggers each scan. While the ISR is working on one DMA buffer
+ *  the DMA fills the other, and the FIFO holds anything that comes in
+ *  while we swap them over.
+ *
+ *  FastAdc owns the ADC while it's running so don't use analogRead() until
+ *  you call end().
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+#include "fast_adc.h"
+
+// The most conversions a second we ask for. The ADC can do about 1.2M
+// at 14 bits and we leave it some room.
+#define FAST_ADC_MAX_CONVERSIONS 1000000L
+
+// The pad each ADC input is on. They all connect to the ADC with function 0.
+static const uint8_t s_adc_pads[NUM_ANALOG_PORTS] = {16, 29, 11, 31, 32, 33, 34, 35, 13, 12};
+
+// Give a port a slot if it doesn't have one yet and count how many times
+// it comes up
+void FastAdcBase::_addAdcSlot(uint8_t port, uint8_t flags, uint16_t count, uint16_t* p_counts)
+{
+  if (port >= NUM_ANALOG_PORTS) {
+    return;
+  }
+  uint8_t slot = 0;
+  while ((slot < m_num_adc_slots) && (m_slot_port[slot] != port)) {
+    slot++;
+  }
+  if (slot == m_num_adc_slots) {
+    if (m_num_adc_slots == MAX_ADC_SLOTS) {
+      // there's no room for any more
+      return;
+    }
+    m_num_adc_slots++;
+    m_slot_port[slot] = port;
+    m_slot_flags[slot] = 0;
+    p_counts[slot] = 0;
+  }
+  m_slot_flags[slot] |= flags & SLOT_FAST;
+  p_counts[slot] += count;
+}
+
+// Work out the slots from the port lists or the schedule table
+void FastAdcBase::_buildAdcSlots()
+{
+  uint16_t counts[MAX_ADC_SLOTS];
+  m_num_adc_slots = 0;
+
+  if (m_p_schedule) {
+    // the fast ports first so they get the first slots
+    for (uint16_t i = 0; i < m_num_slots; i++) {
+      if (m_p_schedule[i].flags & SLOT_FAST) {
+        _addAdcSlot(m_p_schedule[i].port, SLOT_FAST, 1, counts);
+      }
+    }
+    for (uint16_t i = 0; i < m_num_slots; i++) {
+      if (!(m_p_schedule[i].flags & SLOT_FAST)) {
+        _addAdcSlot(m_p_schedule[i].port, 0, 1, counts);
+      }
+    }
+  } else {
+    // on the ATmega the fast list is done once for each slow port
+    uint16_t fast_count = m_num_slow ? m_num_slow : 1;
+    for (uint8_t i = 0; i < m_num_fast; i++) {
+      _addAdcSlot(_ATOPN(m_p_fast_list[i]), SLOT_FAST, fast_count, counts);
+    }
+    for (uint8_t i = 0; i < m_num_slow; i++) {
+      _addAdcSlot(_ATOPN(m_p_slow_list[i]), 0, 1, counts);
+    }
+  }
+
+  uint16_t most = 0;
+  for (uint8_t slot = 0; slot < m_num_adc_slots; slot++) {
+    if (counts[slot] > most) {
+      most = counts[slot];
+    }
+  }
+
+  // The ports that come up less often average more scans. The ADC can
+  // only average a power of two, from 1 to 128 scans.
+  m_slow_mask = 0;
+  uint8_t last_fast = MAX_ADC_SLOTS;
+  for (uint8_t slot = 0; slot < m_num_adc_slots; slot++) {
+    uint16_t ratio = most / counts[slot];
+    uint8_t avg = 0;
+    while ((avg < 7) && ((2 << avg) <= ratio)) {
+      avg++;
+    }
+    m_slot_avg[slot] = avg;
+
+    if (m_slot_flags[slot] & SLOT_FAST) {
+      last_fast = slot;
+    } else {
+      m_slow_mask |= bit(slot);
+    }
+  }
+
+  // onFastUpdate() comes after the last fast slot
+  if (last_fast < MAX_ADC_SLOTS) {
+    m_slot_flags[last_fast] |= SLOT_FAST_DONE;
+  }
+  m_slow_seen = 0;
+}
+
+bool FastAdcBase::begin()
+{
+  // Only the one FAST_ADC_ISR() hooked up to the ADC interrupt can have it
+  if (fastAdcInstance() != this) {
+    return false;
+  }
+  // an empty table, like when buildAdcSchedule() failed
+  if (m_p_schedule && (m_num_slots == 0)) {
+    return false;
+  }
+
+  if (!m_adc_handle) {
+    if (am_hal_adc_initialize(0, &m_adc_handle) != AM_HAL_STATUS_SUCCESS) {
+      // something else has the ADC, like analogRead()
+      m_adc_handle = 0;
+      return false;
+    }
+    am_hal_adc_power_control(m_adc_handle, AM_HAL_SYSCTRL_WAKE, false);
+  }
+
+  // we time the ISR with this
+  cycle_timer_begin();
+
+  _buildAdcSlots();
+
+  am_hal_adc_config_t config;
+  config.eClock = AM_HAL_ADC_CLKSEL_HFRC;
+  config.ePolarity = AM_HAL_ADC_TRIGPOL_RISING;
+  config.eTrigger = AM_HAL_ADC_TRIGSEL_SOFTWARE;
+  config.eReference = AM_HAL_ADC_REFSEL_INT_2P0;
+  config.eClockMode = AM_HAL_ADC_CLKMODE_LOW_LATENCY;
+  config.ePowerMode = AM_HAL_ADC_LPMODE0;
+  config.eRepeat = AM_HAL_ADC_REPEATING_SCAN;
+  am_hal_adc_configure(m_adc_handle, &config);
+
+  for (uint8_t slot = 0; slot < MAX_ADC_SLOTS; slot++) {
+    am_hal_adc_slot_config_t slot_config;
+    slot_config.bWindowCompare = false;
+    slot_config.ePrecisionMode = FAST_ADC_PRECISION;
+    if (slot < m_num_adc_slots) {
+      uint8_t port = m_slot_port[slot];
+      am_hal_gpio_pincfg_t pad_config = {0};
+      am_hal_gpio_pinconfig(s_adc_pads[port], pad_config);
+
+      slot_config.eMeasToAvg = (am_hal_adc_meas_avg_e)m_slot_avg[slot];
+      slot_config.eChannel = (am_hal_adc_slot_chan_e)(AM_HAL_ADC_SLOT_CHSEL_SE0 + port);
+      slot_config.bEnabled = true;
+    } else {
+      slot_config.eMeasToAvg = AM_HAL_ADC_SLOT_AVG_1;
+      slot_config.eChannel = AM_HAL_ADC_SLOT_CHSEL_SE0;
+      slot_config.bEnabled = false;
+    }
+    am_hal_adc_configure_slot(m_adc_handle, slot, &slot_config);
+  }
+
+  m_dma_active = 0;
+  _startDma();
+  am_hal_adc_enable(m_adc_handle);
+
+  am_hal_adc_interrupt_clear(m_adc_handle, 0xFFFFFFFF);
+  am_hal_adc_interrupt_enable(m_adc_handle, AM_HAL_ADC_INT_DCMP | AM_HAL_ADC_INT_DERR);
+  NVIC_SetPriority(ADC_IRQn, FAST_ADC_IRQ_PRIO);
+  NVIC_EnableIRQ(ADC_IRQn);
+
+  // In repeating scan mode the timer does all the triggers after this first one
+  uint32_t scan_rate = m_sample_rate;
+  if (!scan_rate) {
+    scan_rate = FAST_ADC_MAX_CONVERSIONS / (m_num_adc_slots ? m_num_adc_slots : 1);
+  }
+  _setupTimerA3(scan_rate);
+  m_adc_start_time = now_cycles();
+  am_hal_adc_sw_trigger(m_adc_handle);
+  return true;
+}
+
+void FastAdcBase::end()
+{
+  if (!m_adc_handle) {
+    return;
+  }
+  am_hal_ctimer_stop(3, AM_HAL_CTIMER_TIMERA);
+  am_hal_ctimer_adc_trigger_disable();
+
+  NVIC_DisableIRQ(ADC_IRQn);
+  am_hal_adc_interrupt_disable(m_adc_handle, 0xFFFFFFFF);
+  am_hal_adc_disable(m_adc_handle);
+
+  // give the ADC back so analogRead() can have it
+  am_hal_adc_power_control(m_adc_handle, AM_HAL_SYSCTRL_DEEPSLEEP, false);
+  am_hal_adc_deinitialize(m_adc_handle);
+  m_adc_handle = 0;
+}
+
+void FastAdcBase::_setupTimerA3(uint32_t scan_rate)
+{
+  // Timer A3 clock options. Like the ATmega prescalers, we want the
+  // fastest one that lets the 16-bit timer count the whole interval.
+  static const uint32_t clock_rates[] = {12000000L, 3000000L, 187500L, 46875L, 11719L};
+  static const uint32_t clock_selects[] = {
+    AM_HAL_CTIMER_HFRC_12MHZ,
+    AM_HAL_CTIMER_HFRC_3MHZ,
+    AM_HAL_CTIMER_HFRC_187_5KHZ,
+    AM_HAL_CTIMER_HFRC_47KHZ,
+    AM_HAL_CTIMER_HFRC_12KHZ
+  };
+
+  uint8_t n = 0;
+  while ((n < 4) && (clock_rates[n] / scan_rate > 65535L)) {
+    n++;
+  }
+  uint32_t period = clock_rates[n] / scan_rate;
+  if (period < 2) period = 2;
+  if (period > 65535L) period = 65535L;
+
+  am_hal_ctimer_stop(3, AM_HAL_CTIMER_TIMERA);
+  am_hal_ctimer_clear(3, AM_HAL_CTIMER_TIMERA);
+  am_hal_ctimer_config_single(3, AM_HAL_CTIMER_TIMERA,
+                              clock_selects[n] | AM_HAL_CTIMER_FN_REPEAT);
+  am_hal_ctimer_period_set(3, AM_HAL_CTIMER_TIMERA, period, period >> 1);
+  am_hal_ctimer_adc_trigger_enable();
+  am_hal_ctimer_start(3, AM_HAL_CTIMER_TIMERA);
+
+  m_actual_rate = clock_rates[n] / period;
+}
+
+// Point the DMA at the buffer we aren't working on
+void FastAdcBase::_startDma()
+{
+  am_hal_adc_dma_config_t dma_config;
+  dma_config.bDynamicPriority = true;
+  dma_config.ePriority = AM_HAL_ADC_PRIOR_SERVICE_IMMED;
+  dma_config.bDMAEnable = true;
+  dma_config.ui32SampleCount = FAST_ADC_DMA_WORDS;
+  dma_config.ui32TargetAddress = (uint32_t)m_dma_buf[m_dma_active];
+  am_hal_adc_configure_dma(m_adc_handle, &dma_config);
+}
+
+// The ISR itself is FastAdc::_isr() in fast_adc.h so it can call the
+// callbacks directly. This is the part that doesn't need them.
+const uint32_t* FastAdcBase::_takeDmaBuffer()
+{
+  uint32_t status;
+  am_hal_adc_interrupt_status(m_adc_handle, &status, true);
+  am_hal_adc_interrupt_clear(m_adc_handle, status);
+
+  if (status & AM_HAL_ADC_INT_DERR) {
+    // start the DMA again, we lose what was in the buffer
+    _startDma();
+    return 0;
+  }
+  if (!(status & AM_HAL_ADC_INT_DCMP)) {
+    return 0;
+  }
+
+  // swap the buffers straight away so the DMA can carry on
+  const uint32_t* p_buf = m_dma_buf[m_dma_active];
+  m_dma_active ^= 1;
+  _startDma();
+  return p_buf;
+}
+
+#endif // ARDUINO_ARCH_APOLLO3
@@ -1,92 +1,79 @@
 /*
  * A few very simple performance tests that will run on a standard
- * Arduino Uno board as well as on the SparkFun RedBoard Artemis and 
+ * Arduino Uno board as well as on the SparkFun RedBoard Artemis and
  * RedBoard Artemis ATP.
+ *
+ * Each BENCH() below is timed by the harness in bench.h. It prints how
+ * long one pass through the body takes on this board, and then the
+ * same results as CSV so the numbers from different boards can be
+ * compared side by side.
+ *
+ * bench_suite.ino adds benchmarks for the ADC, serial output, critical
+ * section and interrupt code the other examples use. For the interrupt
+ * latency one, wire pin 4 to pin 2. It's skipped if you don't.
  */
 
- 
-void setup() 
+#include "bench.h"
+
+// for the benchmarks in bench_suite.ino
+#include "serial_utils.h"
+#include "critical_section.h"
+#include "fast_pin.h"
+#include "fast_adc.h"
+
+// The operands are volatile so the compiler has to do the math every
+// time. They don't change so every pass through a benchmark does the same work.
+volatile long g_long_a = 37;
+volatile long g_long_b = 23;
+volatile long g_long_c;
+
+volatile float g_float_a = 37;
+volatile float g_float_b = 23;
+volatile float g_float_c;
+
+
+void setup()
 {
   // we're going to print stuff out so get the serial interface up
   Serial.begin(115200);
   Serial.println("\n\n\n\n\nBasic speed tests\n");
 
-  // Run the assorted speed tests. 
-  // These are not sophisticated, just very basic stuff to do
-  // an approximate speed comparison.
-
-  test_long_math();
-  test_float_math();
-  test_sqrt();
+  // Run the assorted speed tests.
+  // These are still very basic but they give a fair speed comparison.
+  benchRunAll();
 
   Serial.println("\nDone\n\n");
 }
 
-void loop() 
+void loop()
 {
   // These are not the droids you're looking for
 }
 
-void print_time(unsigned long elapsed)
+// Math on longs
+BENCH(long_multiply)
 {
-  Serial.print("  Elapsed time: ");
-  Serial.print(elapsed / 1000L);
-  Serial.println(" ms");
+  g_long_c = g_long_a * g_long_b;
 }
 
-// Test the time it takes to do some math on longs
-void test_long_math()
+BENCH(long_divide)
 {
-  Serial.println("Math on long variables...");
-  unsigned long start = micros();
-  unsigned long num_tests = 100000L;
-  volatile long a = 37;
-  volatile long b = 23;
-  for (unsigned long n = 0; n < num_tests; n++) {
-    volatile long c = a * b;
-    volatile long d = b / a;
-    a = c;
-    b = d;
-  }
-
-  unsigned long elapsed = micros() - start;
-  print_time(elapsed);
+  g_long_c = g_long_a / g_long_b;
 }
 
-// Test the time it takes to do some math on floats
-void test_float_math()
+// Math on floats
+BENCH(float_multiply)
 {
-  Serial.println("Math on float variables...");
-  unsigned long start = micros();
-  unsigned long num_tests = 100000L;
-  volatile float a = 37;
-  volatile float b = 23;
-  for (unsigned long n = 0; n < num_tests; n++) {
-    volatile float c = a * b;
-    volatile float d = b / a;
-    a = c;
-    b = d;
-  }
-
-  unsigned long elapsed = micros() - start;
-  print_time(elapsed);
+  g_float_c = g_float_a * g_float_b;
 }
 
-// Test the time it takes to do sqrt
-void test_sqrt()
+BENCH(float_divide)
 {
-  Serial.println("Math with sqrt...");
-  unsigned long start = micros();
-  unsigned long num_tests = 100000L;
-  volatile float a = 37;
-  volatile float b = 23;
-  for (unsigned long n = 0; n < num_tests; n++) {
-    volatile float c = sqrt(a);
-    volatile float d = sqrt(b);
-    a = c;
-    b = d;
-  }
+  g_float_c = g_float_a / g_float_b;
+}
 
-  unsigned long elapsed = micros() - start;
-  print_time(elapsed);
+// sqrt
+BENCH(float_sqrt)
+{
+  g_float_c = sqrt(g_float_a);
 }
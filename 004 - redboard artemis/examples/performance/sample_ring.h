@@ -0,0 +1,160 @@
+/** \file sample_ring.h
+ *
+ * Single producer, single consumer ring buffer for ADC samples.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ * The ISR is the only code that writes the head index and the foreground
+ * is the only code that writes the tail index. Both indices are single bytes
+ * so the ATmega can read and write them in one instruction, which is what
+ * lets us get away without disabling interrupts. The price is that the ring
+ * can hold at most 128 samples. At 13 us per conversion that's about 1.6 ms
+ * of data, so your loop() needs to drain the ring at least that often.
+ *
+ * Each entry holds the 10-bit ADC value in the low bits and the analog port
+ * index (0..15) in the top 4 bits so you can tell which input a sample came
+ * from even if some samples were dropped.
+ *
+ */
+
+#ifndef _SAMPLE_RING_H_
+#define _SAMPLE_RING_H_
+
+#include "Arduino.h"
+
+// Pack and unpack the port index and the sample value in a ring entry
+#define RING_ENTRY(port, value) ((uint16_t)(((port) << 12) | ((value) & 0x0FFF)))
+#define RING_PORT(entry) ((uint8_t)((entry) >> 12))
+#define RING_VALUE(entry) ((uint16_t)((entry) & 0x0FFF))
+
+/// \brief The non-template part of the sample ring.
+/// This is what the FastAdc class talks to so it doesn't need to know the
+/// capacity of the ring. Use the SampleRing template to create one.
+class SampleRingBase
+{
+public:
+  /// \brief Add a sample to the ring.
+  /// This must only be called from the ISR. If the ring is full the sample is
+  /// thrown away and the overrun counter is incremented.
+  /// \param entry The sample to add. Use RING_ENTRY() to build it.
+  inline void push(uint16_t entry)
+  {
+    uint8_t head = m_head;
+    if ((uint8_t)(head - m_tail) >= m_capacity) {
+      // the consumer has fallen behind
+      m_overruns++;
+      return;
+    }
+    m_p_buf[head & m_mask] = entry;
+    // publish the sample only after it has been stored
+    m_head = head + 1;
+  }
+
+  /// \brief Get the number of samples waiting to be read.
+  /// Safe to call from the foreground without a lock.
+  uint8_t available() const
+  {
+    return (uint8_t)(m_head - m_tail);
+  }
+
+  /// \brief Copy a block of samples out of the ring.
+  /// Safe to call from the foreground without a lock.
+  /// \param buf Where to copy the samples to.
+  /// \param max_samples The size of the buffer.
+  /// \return The number of samples copied, which may be zero.
+  uint8_t read(uint16_t* buf, uint8_t max_samples)
+  {
+    uint8_t tail = m_tail;
+    uint8_t count = (uint8_t)(m_head - tail);
+    if (count > max_samples) {
+      count = max_samples;
+    }
+    for (uint8_t n = 0; n < count; n++) {
+      buf[n] = m_p_buf[(uint8_t)(tail + n) & m_mask];
+    }
+    // free the slots only after we have copied them
+    m_tail = tail + count;
+    return count;
+  }
+
+  /// \brief Get the number of samples that were dropped because the ring was full.
+  uint32_t getOverruns() const
+  {
+    // The counter is more than one byte so the ISR could change it while we
+    // are reading it. Read it until we get the same value twice.
+    uint32_t a;
+    uint32_t b = m_overruns;
+    do {
+      a = b;
+      b = m_overruns;
+    } while (a != b);
+    return a;
+  }
+
+  /// \brief Discard everything in the ring.
+  /// Only call this from the foreground.
+  void flush()
+  {
+    m_tail = m_head;
+  }
+
+protected:
+  SampleRingBase(volatile uint16_t* p_buf, uint8_t capacity)
+  : m_p_buf(p_buf)
+  , m_capacity(capacity)
+  , m_mask(capacity - 1)
+  , m_head(0)
+  , m_tail(0)
+  , m_overruns(0)
+  {
+  }
+
+private:
+  volatile uint16_t* const m_p_buf;
+  const uint8_t m_capacity;
+  const uint8_t m_mask;
+  volatile uint8_t m_head; // only written by the ISR
+  volatile uint8_t m_tail; // only written by the foreground
+  volatile uint32_t m_overruns; // only written by the ISR
+};
+
+/// \brief A sample ring with storage for a fixed number of samples.
+/// \tparam CAPACITY The number of samples the ring can hold. This must be
+/// a power of two and no more than 128.
+template <uint8_t CAPACITY>
+class SampleRing : public SampleRingBase
+{
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SampleRing capacity must be a power of two");
+  static_assert((CAPACITY >= 2) && (CAPACITY <= 128), "SampleRing capacity must be 2..128");
+
+public:
+  SampleRing()
+  : SampleRingBase(m_buf, CAPACITY)
+  {
+  }
+
+private:
+  volatile uint16_t m_buf[CAPACITY];
+};
+
+#endif // _SAMPLE_RING_H_
@@ -32,6 +32,10 @@
  * The idea is expanadbale to other MCU families of course but the implementation
  * here will try to detect the Apollo 3 MCU or default to the ATmega MCU.
  * 
+ * If you define CS_INSTRUMENT before including this header, every CS_LOCK and
+ * CS_BEGIN/CS_END records how long it kept the interrupts off. See the
+ * instrumentation section below.
+ * 
  */
 
 #ifndef _CRITICAL_SECTION_H_
@@ -83,18 +87,93 @@
 // dtor it restores the state of the interrupt register.
 // The macro simply creates an instance of the class.
 
+#ifdef CS_INSTRUMENT
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Critical section instrumentation
+//
+// With CS_INSTRUMENT defined, each CS_LOCK (and CS_BEGIN/CS_END) reads a cycle
+// counter when it turns the interrupts off and again just before it turns them
+// back on. The count, total and longest time are kept for each place in the code
+// that takes a lock, which is named by the function and line number, or by the
+// tag you give CS_LOCK_TAG("name").
+//
+// Call csStatsBegin() in setup() to start the counter, then CS_STATS_DUMP() to
+// print the results with sout, so include serial_utils.h first if you want that.
+//
+// The counter is now_cycles() from cycle_timer.h, which csStatsBegin() starts.
+// That's DWT->CYCCNT on the Apollo 3 and Timer1 on the ATmega, so it's the same
+// clock FastAdc and the input capture code use.
+//
+// Each place that takes a lock costs about 20 bytes of RAM.
+
+#include "cycle_timer.h"
+
+typedef cycles_t cs_ticks_t;
+#define CS_TICKS() now_cycles()
+
+// The number of counter ticks in a microsecond
+#define CS_TICKS_PER_US CYCLES_PER_US
+
+// What we know about each place a lock is taken
+struct __CsSite
+{
+  const char* name;  // the function or tag
+  uint16_t line;
+  bool listed;       // true when it's in the list
+  cs_ticks_t max;    // longest lock in ticks
+  uint32_t count;    // number of locks
+  uint32_t total;    // total ticks locked
+  __CsSite* p_next;
+};
+
+// The list of all the places that have taken a lock so far
+extern __CsSite* volatile __cs_sites;
+
+/// \brief Start the cycle counter and clear the stats.
+/// On the ATmega this always sets Timer1 to count every CPU clock, as the
+/// Arduino core leaves it running at F_CPU / 64 for analogWrite(). The
+/// overflows are counted so locks up to 268 s at 16 MHz read right.
+void csStatsBegin();
+
+/// \brief Clear the stats from all the places that have taken a lock.
+void csStatsReset();
+
+/// \brief Print the stats for each place a lock has been taken with sout.
+/// The times are in microseconds.
+#define CS_STATS_DUMP() \
+  for (__CsSite* __p = __cs_sites; __p; __p = __p->p_next) { \
+    __CsSite __s; \
+    { CS_LOCK_UNTIMED __s = *__p; } \
+    sout("CS %s:%u count: %lu, max: %.2f us, mean: %.2f us", __s.name, __s.line, \
+        __s.count, (float)__s.max / CS_TICKS_PER_US, \
+        __s.count ? (float)__s.total / __s.count / CS_TICKS_PER_US : 0.0f); \
+  }
+
+#endif // CS_INSTRUMENT
+
 class __CsLock
 {
 public:
   __CsLock();
   ~__CsLock();
 
+#ifdef CS_INSTRUMENT
+  // a lock that records its time in the site
+  __CsLock(__CsSite& site);
+#endif
+
 private:
 #ifdef ARDUINO_ARCH_APOLLO3 // Atermis with Apollo 3 MCU
   volatile uint32_t m_int_master;
 #else // Assume normal ATmega processor boards
   volatile uint8_t m_sreg;
 #endif
+
+#ifdef CS_INSTRUMENT
+  __CsSite* m_p_site;
+  cs_ticks_t m_start;
+#endif
 };
 
 // A macro to use in the code like this:
@@ -106,6 +185,246 @@ private:
 //
 // The code block can be the body of an entire function or simply
 // a block between { and } anywhere in the code.
+#ifdef CS_INSTRUMENT
+
+// Each lock gets its own site record. It's all constant so there's no
+// start up code, it's just there in RAM.
+#define CS_LOCK_TAG(tag) \
+  static __CsSite __thisCsSite = {tag, __LINE__, false, 0, 0, 0, NULL}; \
+  __CsLock __thisCsLock(__thisCsSite);
+#define CS_LOCK CS_LOCK_TAG(__func__)
+
+// A lock that isn't measured, for the instrumentation itself
+#define CS_LOCK_UNTIMED __CsLock __thisCsLock;
+
+// Measure the paired macros too
+#undef CS_BEGIN
+#undef CS_END
+#define CS_BEGIN { CS_LOCK
+#define CS_END }
+
+#else // not CS_INSTRUMENT
+
 #define CS_LOCK __CsLock __thisCsLock;
+#define CS_LOCK_TAG(tag) CS_LOCK
+
+#endif // not CS_INSTRUMENT
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Critical sections that only hold off some of the interrupts
+//
+// CS_LOCK turns off all the interrupts, so the serial port, millis() and
+// everything else has to wait until the lock is released. If the data you are
+// protecting is only shared with one ISR you can use one of these instead.
+// They work the same way as CS_LOCK, in a scope block.
+//
+// CS_LOCK_PRIO(n)
+//   On the Apollo 3 this uses the Cortex-M4 BASEPRI register to hold off the
+//   interrupts with a priority number of n or more. The more urgent ones with
+//   a lower number still run. n must be at least 1 as 0 is the most urgent
+//   priority and writing 0 to BASEPRI turns the masking off. The Apollo 3 has
+//   3 priority bits so n can be up to 7.
+//   The ATmega has no interrupt priorities so there it's the same as CS_LOCK.
+//
+// CS_LOCK_MASK(reg, bits)
+//   ATmega only. Clears the interrupt enable bits in a register like EIMSK or
+//   TIMSK1 and puts them back at the end of the scope. An interrupt that comes
+//   in while it's masked is still flagged, so its ISR runs as soon as the lock
+//   is released.
+//
+// CS_LOCK_INT0, CS_LOCK_INT1
+//   ATmega only. Hold off one of the external interrupts (attachInterrupt()
+//   on pins 2 and 3 of an Uno).
+//
+// CS_LOCK_ADC
+//   ATmega only. Hold off the ADC conversion complete interrupt. The ADC
+//   interrupt flag is cleared by writing a 1 to it, so this takes care not to
+//   write it back. Note that if the ISR starts each conversion, masking it
+//   for a long time leaves a gap in the samples.
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+class __CsLockPrio
+{
+public:
+  __CsLockPrio(uint8_t prio);
+  ~__CsLockPrio();
+
+private:
+  volatile uint32_t m_basepri;
+};
+
+#define CS_LOCK_PRIO(n) __CsLockPrio __thisCsLockPrio(n);
+
+#else // Assume normal ATmega processor boards
+
+class __CsLockMask
+{
+public:
+  // w1c are the bits in the register that are cleared by writing a 1,
+  // like the ADIF flag in ADCSRA
+  __CsLockMask(volatile uint8_t& reg, uint8_t bits, uint8_t w1c = 0);
+  ~__CsLockMask();
+
+private:
+  volatile uint8_t& m_reg;
+  const uint8_t m_bits;
+  const uint8_t m_w1c;
+  uint8_t m_saved; // which of the bits were set
+};
+
+#define CS_LOCK_PRIO(n) CS_LOCK
+#define CS_LOCK_MASK(reg, bits) __CsLockMask __thisCsLockMask(reg, bits);
+#define CS_LOCK_INT0 CS_LOCK_MASK(EIMSK, bit(INT0))
+#define CS_LOCK_INT1 CS_LOCK_MASK(EIMSK, bit(INT1))
+#define CS_LOCK_ADC __CsLockMask __thisCsLockMask(ADCSRA, bit(ADIE), bit(ADIF));
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Sequence locks for reading data an ISR changes
+//
+// A sequence lock lets the foreground code read data that an ISR writes without
+// turning the interrupts off. The ISR adds one to a counter before it changes the
+// data and one after, so the count is odd while a write is going on. The reader
+// copies the data and then checks the count is even and hasn't changed. If it has,
+// the ISR ran while the data was being copied so the reader just copies it again.
+// The ISR never waits, and the other interrupts are never held up by the reader.
+//
+// This only works when there is one writer: an ISR, or the foreground code if
+// the data is only read by an ISR. Never read the data with SEQ_READ from
+// inside the writer while it is writing as that would wait for ever.
+// Don't use break or return inside SEQ_WRITE or the count stays odd.
+//
+// Usage:
+
+/*
+  SeqLock g_lock;
+  volatile uint32_t g_a;
+  volatile uint32_t g_b;
+
+  // in the ISR
+  SEQ_WRITE(g_lock) {
+    g_a = ...;
+    g_b = ...;
+  }
+
+  // in the foreground
+  uint32_t a, b;
+  SEQ_READ(g_lock) {
+    a = g_a;
+    b = g_b;
+  }
+*/
+
+// Stop the compiler moving memory reads and writes across this point
+#define CS_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+// The counter must be a size the processor can read and write in one go
+#ifdef ARDUINO_ARCH_APOLLO3
+typedef uint32_t cs_seq_t;
+#else
+typedef uint8_t cs_seq_t;
+#endif
+
+// A count that's never returned by readBegin(). SEQ_READ uses it to stop.
+#define CS_SEQ_DONE ((cs_seq_t)1)
+
+class SeqLock
+{
+public:
+  SeqLock()
+  : m_seq(0)
+  {
+  }
+
+  // Call before the writer changes the data
+  uint8_t writeBegin()
+  {
+    m_seq = m_seq + 1;
+    CS_BARRIER();
+    return 1;
+  }
+
+  // Call after the writer has changed the data
+  uint8_t writeEnd()
+  {
+    CS_BARRIER();
+    m_seq = m_seq + 1;
+    return 0;
+  }
+
+  // Call before reading the data. Waits if a write is going on, which
+  // can only happen if the writer is on another core or is a lower
+  // priority interrupt than the reader.
+  cs_seq_t readBegin() const
+  {
+    cs_seq_t seq;
+    do {
+      seq = m_seq;
+    } while (seq & 1);
+    CS_BARRIER();
+    return seq;
+  }
+
+  // Call after reading the data.
+  // Returns true if it changed while we were reading it so we need to read it again.
+  bool readRetry(cs_seq_t seq) const
+  {
+    CS_BARRIER();
+    return m_seq != seq;
+  }
+
+private:
+  volatile cs_seq_t m_seq;
+};
+
+// Run the following code block with the write count odd
+#define SEQ_WRITE(lock) for (uint8_t __seqw = (lock).writeBegin(); __seqw; __seqw = (lock).writeEnd())
+
+// Run the following code block again until it reads the data without a write happening
+#define SEQ_READ(lock) for (cs_seq_t __seqr = (lock).readBegin(); __seqr != CS_SEQ_DONE; \
+    __seqr = (lock).readRetry(__seqr) ? (lock).readBegin() : CS_SEQ_DONE)
+
+// A value of any type written by an ISR and read by the foreground code.
+// The value is copied out whole, however big it is, with the interrupts on.
+template <typename T>
+class Snapshot
+{
+public:
+  Snapshot()
+  : m_value()
+  {
+  }
+
+  // Change the value. Only the writer calls this.
+  void write(const T& value)
+  {
+    SEQ_WRITE(m_lock) {
+      m_value = value;
+    }
+  }
+
+  // Get the value. The writer can use this to see what it wrote last
+  // without paying for the lock.
+  const T& peek() const
+  {
+    return m_value;
+  }
+
+  // Get a copy of the value from the reader
+  T read() const
+  {
+    T value;
+    SEQ_READ(m_lock) {
+      value = m_value;
+    }
+    return value;
+  }
+
+private:
+  T m_value;
+  SeqLock m_lock;
+};
 
 #endif // _CRITICAL_SECTION_H_
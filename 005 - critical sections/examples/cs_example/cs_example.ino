@@ -13,6 +13,11 @@
  * 
  */
 
+// Define this to measure how long each critical section keeps the interrupts
+// off. The results are printed with sout at the end of each loop.
+//#define CS_INSTRUMENT
+
+#include "serial_utils.h"
 #include "critical_section.h"
 
 
@@ -21,6 +26,10 @@
 #define BG_INPUT_PIN    2   // Background code (on interrupt) will use this pin
 #define PWM_OUTPUT_PIN  6   // PWM test signal output to this pin 
 
+// The priority we give the pin interrupt on the Apollo 3 so that CS_LOCK_PRIO
+// can hold it off. 0 is the most urgent and 7 the least.
+#define BG_IRQ_PRIO 4
+
 // A couple of arbitrary values we use in the ISR
 #define ISR_VAL_1 0x11223344L
 #define ISR_VAL_2 0x55667788L
@@ -30,6 +39,11 @@ void setup()
   Serial.begin(115200);
   Serial.println("Critical section tests");
 
+#ifdef CS_INSTRUMENT
+  // start the cycle counter for the lock timing
+  csStatsBegin();
+#endif
+
   // Set up the PWM squarewave output that is our test signal source
   pinMode(PWM_OUTPUT_PIN, OUTPUT);
   analogWrite(PWM_OUTPUT_PIN, 128); // 128 gives 50% duty cycle
@@ -42,6 +56,11 @@ void setup()
   // of the signal.
   attachInterrupt(digitalPinToInterrupt(BG_INPUT_PIN), myISR, FALLING);
 
+#ifdef ARDUINO_ARCH_APOLLO3
+  // CS_LOCK_PRIO can only hold off interrupts that are less urgent than
+  // the priority we give it
+  NVIC_SetPriority(GPIO_IRQn, BG_IRQ_PRIO);
+#endif
 }
 
 // Some data values that are set by the ISR and interrogated
@@ -50,6 +69,9 @@ volatile uint32_t g_isr_count = 0;
 volatile uint32_t g_isr_value_a = 0;
 volatile uint32_t g_isr_value_b = 0;
 
+// The sequence lock the ISR uses when it changes the values
+SeqLock g_isr_lock;
+
 // Our ISR which gets called when the background input pin changes state
 // from high to low.
 void myISR()
@@ -58,13 +80,16 @@ void myISR()
   g_isr_count++;
 
   // We alternate writing one of two known values to the
-  // global values.
-  if (g_isr_count & 0x01) {
-    g_isr_value_a = ISR_VAL_1;
-    g_isr_value_b = ISR_VAL_1;
-  } else {
-    g_isr_value_a = ISR_VAL_2;
-    g_isr_value_b = ISR_VAL_2;
+  // global values. The sequence lock doesn't hold anything up here,
+  // it just lets test 5 see that the values were changed.
+  SEQ_WRITE(g_isr_lock) {
+    if (g_isr_count & 0x01) {
+      g_isr_value_a = ISR_VAL_1;
+      g_isr_value_b = ISR_VAL_1;
+    } else {
+      g_isr_value_a = ISR_VAL_2;
+      g_isr_value_b = ISR_VAL_2;
+    }
   }
 }
 
@@ -75,7 +100,15 @@ void loop()
   test_2();  
   test_3();
   test_4();
+  test_5();
+  test_6();
   test_1(); // just to be sure we didn't leave interrupts disabled
+
+#ifdef CS_INSTRUMENT
+  // show how long the locks kept the interrupts off
+  CS_STATS_DUMP();
+  csStatsReset();
+#endif
   
   delay(3000);
 }
@@ -199,3 +232,84 @@ void test_4()
   if (errs == 0) Serial.println("OK");
   
 }
+
+void test_5()
+{
+  Serial.println("Test 5 (sequence lock, interrupts left on, look for conflict)...");
+  uint32_t start = millis();
+  uint32_t errs = 0;
+  while ((millis() - start) < 10000) {
+    uint32_t vala;
+    uint32_t valb;
+    uint32_t cnt;
+
+    // Read the values again if the ISR changed them while we were reading
+    SEQ_READ(g_isr_lock) {
+      vala = g_isr_value_a;
+      valb = g_isr_value_b;
+      cnt = g_isr_count;
+    }
+
+    // Verify we got what we expected
+    if (((vala != ISR_VAL_1) && (vala != ISR_VAL_2))
+    || ((valb != ISR_VAL_1) && (valb != ISR_VAL_2))
+    || (vala != valb)) {
+      errs++;
+      Serial.print("Error ");
+      Serial.print(errs);
+      Serial.print(" (NOT expected) at count: ");
+      Serial.print(cnt);  
+      Serial.print(", Value A: ");
+      Serial.print(String(vala, HEX));
+      Serial.print(", Value B: ");
+      Serial.println(String(valb, HEX));
+      delay(500);  
+    }
+    if (errs >= 5) break;
+  }
+  if (errs == 0) Serial.println("OK");
+  
+}
+
+void test_6()
+{
+  Serial.println("Test 6 (only the pin interrupt held off, look for conflict)...");
+  uint32_t start = millis();
+  uint32_t errs = 0;
+  while ((millis() - start) < 10000) {
+    uint32_t vala;
+    uint32_t valb;
+    uint32_t cnt;
+
+    // Only hold off our ISR, the serial port and millis() keep going
+    { // begin lock scope
+#ifdef ARDUINO_ARCH_APOLLO3
+      CS_LOCK_PRIO(BG_IRQ_PRIO)
+#else
+      CS_LOCK_INT0 // pin 2 is INT0 on an Uno
+#endif
+      vala = g_isr_value_a;
+      valb = g_isr_value_b;
+      cnt = g_isr_count;
+    } // end of lock scope
+
+    // Verify we got what we expected
+    if (((vala != ISR_VAL_1) && (vala != ISR_VAL_2))
+    || ((valb != ISR_VAL_1) && (valb != ISR_VAL_2))
+    || (vala != valb)) {
+      errs++;
+      Serial.print("Error ");
+      Serial.print(errs);
+      Serial.print(" (NOT expected) at count: ");
+      Serial.print(cnt);  
+      Serial.print(", Value A: ");
+      Serial.print(String(vala, HEX));
+      Serial.print(", Value B: ");
+      Serial.println(String(valb, HEX));
+      delay(500);  
+    }
+    if (errs >= 5) break;
+  }
+  if (errs == 0) Serial.println("OK");
+  
+}
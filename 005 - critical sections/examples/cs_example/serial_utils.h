@@ -0,0 +1,564 @@
+/** \file serial_utils.h
+ *  \brief Macros and functions to support printf-like serial output.
+ *
+ *  This header contains a series of macros and functions to make
+ *  it easier to send printf-like output to the Arduino Serial Monitor app
+ *  when debugging your code.
+ *
+ *  The vsnprintf function on the ATmega boards cannot print floats, so
+ *  serial_printf handles %f itself with a fixed-point formatter that doesn't
+ *  use the heap. There are also some functions included to convert floats
+ *  to const char* strings so that they can be included in printf strings using %s
+ *  as the format.
+ *
+ *  sout and dbg use serial_fmt, a variadic template version of serial_printf
+ *  that formats each argument by its type without vsnprintf. See the
+ *  type-safe formatting section below.
+ *
+ *  If you define SERIAL_BINARY_LOG before including this header, sout and dbg
+ *  send the values in binary and the formatting is done on the host.
+ *  See the binary log section below.
+ *
+ */
+
+#ifndef _SERIAL_UTILS_H_
+#define _SERIAL_UTILS_H_
+
+#include "Arduino.h"
+
+
+/// \brief print to the serial port.
+///
+/// This allows the use of printf-like formatting including
+/// floats and doubles with %f (like %8.3f). It includes a line feed
+/// character at the end of the string.
+/// Each % conversion is handled one at a time. * for the width or
+/// precision is not supported. %e, %g, %a and 64-bit integers like %lld
+/// are shown as they are and their argument skipped. After any other
+/// conversion we don't know, the rest of fmt is shown as it is.
+///
+/// You must either call Serial.begin(baud_rate) before calling this function
+/// or call nt::core_begin().
+///
+/// Beware that the buffer used to format the output is only 128 chars
+/// so do not exceed this size. 
+///
+/// \param fmt The printf-like formatting string.
+/// \param ... The argument list to format.
+void serial_printf(const char* fmt, ...);
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Transmit queue support
+//
+// Serial.write() waits when the hardware transmit buffer is full, which is
+// only 64 bytes on an Uno. If you define SERIAL_TX_QUEUE_SIZE before you include
+// this header, everything sent by sout and dbg goes into a queue of that many
+// bytes instead, and is moved to the hardware buffer only when there is room.
+// Call serial_tx_poll() from your loop() to keep it moving.
+// SERIAL_TX_POLICY says what to do when the queue is full:
+//   SERIAL_TX_DROP_NEWEST  throw away the new message (the default)
+//   SERIAL_TX_DROP_OLDEST  throw away the oldest messages in the queue
+//   SERIAL_TX_BLOCK        wait for room, like Serial.write() does
+// The number of bytes thrown away is counted so you can see if you are
+// trying to send too much.
+//
+// The drop policies throw away whole messages so the host never sees half
+// a text line or half a COBS frame. Each sout, dbg or serial_printf line is
+// a message, and so is each serial_write() call on its own. Put
+// serial_msg_begin() and serial_msg_end() around several serial_write()
+// calls to make them one message. A message only goes to the hardware once
+// it's finished, and if it doesn't fit none of it is sent. The oldest
+// message is only thrown away if none of it has been sent yet, otherwise the
+// one after it goes. The queue also keeps the lengths of up to
+// SERIAL_TX_MAX_MESSAGES messages.
+
+// Queue full policies
+#define SERIAL_TX_DROP_NEWEST 0
+#define SERIAL_TX_DROP_OLDEST 1
+#define SERIAL_TX_BLOCK 2
+
+#ifndef SERIAL_TX_POLICY
+#define SERIAL_TX_POLICY SERIAL_TX_DROP_NEWEST
+#endif
+
+#ifndef SERIAL_TX_MAX_MESSAGES
+#define SERIAL_TX_MAX_MESSAGES 16
+#endif
+
+/// \brief Send bytes to the serial port.
+/// This goes through the transmit queue if there is one, otherwise it
+/// is just Serial.write().
+/// \param p_data The bytes to send.
+/// \param len The number of bytes.
+/// \return The number of bytes queued or sent.
+size_t serial_write(const uint8_t* p_data, size_t len);
+
+/// \brief Start a message made of several serial_write() calls.
+/// With a drop policy the message is sent or thrown away as a whole.
+/// It does nothing if there is no queue. Calls can be nested.
+void serial_msg_begin();
+
+/// \brief Finish the message started by serial_msg_begin().
+void serial_msg_end();
+
+/// \brief Move as much of the transmit queue as will fit to the hardware.
+/// This never waits. It does nothing if there is no queue.
+void serial_tx_poll();
+
+/// \brief Get the number of bytes waiting in the transmit queue.
+size_t serial_tx_pending();
+
+/// \brief Get the number of bytes that were thrown away because the queue was full.
+uint32_t serial_tx_dropped();
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Type-safe formatting
+//
+// sout and dbg normally use serial_fmt() rather than serial_printf(). It takes
+// the same format strings but it's a variadic template, so the type of each
+// argument is known at compile time and picks the code that formats it.
+// Nothing goes through vsnprintf, a 16-bit int given to %ld is still printed
+// correctly, and a string given to %d is printed as a string rather than
+// crashing. The text is sent straight to serial_write() a piece at a time,
+// so there's no 128 char limit.
+//
+// The compiler also counts the conversions in the format string and stops
+// with an error if that doesn't match the number of arguments, so the format
+// string must be a string literal. Use serial_printf() if you need to build
+// the format at run time, or define SERIAL_USE_PRINTF before including this
+// header to make sout and dbg use it again.
+//
+// Supported: %d %i %u %x %X %o %c %s %p %f %%, the - + space and 0 flags,
+// width and precision. l, h and L are accepted and ignored since the argument
+// type is already known. 64-bit integers aren't supported. %s takes a char*,
+// an F() string or a String, and %p shows 0x then the address in hex.
+
+// Flags for _SoutSpec
+#define SOUT_LEFT  1 // -
+#define SOUT_PLUS  2 // +
+#define SOUT_SPACE 4 // space
+#define SOUT_ZERO  8 // 0
+
+// One % conversion from the format string
+struct _SoutSpec
+{
+  char conv;          // the conversion character, like 'd'
+  uint8_t flags;      // SOUT_xxx
+  uint8_t width;      // 0 if not given
+  int8_t precision;   // -1 if not given
+};
+
+// Walks through the format string, sending the plain text as it goes
+class _SoutFmt
+{
+public:
+  _SoutFmt(const char* fmt)
+  : m_p(fmt)
+  {
+  }
+
+  // send the text up to the next conversion and read it into spec.
+  // Returns false if there are no more conversions.
+  bool next(_SoutSpec& spec);
+
+  // send the rest of the text and the line ending
+  void finish();
+
+private:
+  const char* m_p;
+};
+
+// The formatting for each kind of value. These aren't templates so there's
+// only one copy of each in the flash memory.
+void _soutInt(const _SoutSpec& spec, uint32_t value, bool negative);
+void _soutFloat(const _SoutSpec& spec, float value);
+void _soutStr(const _SoutSpec& spec, const char* s);
+void _soutStr(const _SoutSpec& spec, const __FlashStringHelper* s);
+
+// Test for a negative value without comparing unsigned types with zero
+template <bool SIGNED>
+struct _SoutSign
+{
+  template <typename T>
+  static bool negative(T v)
+  {
+    return v < 0;
+  }
+};
+
+template <>
+struct _SoutSign<false>
+{
+  template <typename T>
+  static bool negative(T)
+  {
+    return false;
+  }
+};
+
+// Format one argument. Any integer type uses the template and the
+// others have their own overloads.
+template <typename T>
+inline void _soutArg(const _SoutSpec& spec, T v)
+{
+  static_assert(sizeof(T) <= sizeof(uint32_t),
+      "sout only takes integers up to 32 bits, floats, pointers and strings");
+  bool negative = _SoutSign<((T)-1 < (T)0)>::negative(v);
+  if (negative && strchr("xXouc", spec.conv)) {
+    // like printf these take the bits as the unsigned type of the same size
+    _soutInt(spec, (uint32_t)v & (0xFFFFFFFFUL >> (32 - 8 * sizeof(T))), false);
+    return;
+  }
+  _soutInt(spec, negative ? (uint32_t)0 - (uint32_t)v : (uint32_t)v, negative);
+}
+
+template <typename T>
+inline void _soutArg(const _SoutSpec& spec, T* v)
+{
+  _SoutSpec hex = spec;
+  hex.conv = 'p';
+  _soutInt(hex, (uint32_t)(uintptr_t)v, false);
+}
+
+inline void _soutArg(const _SoutSpec& spec, float v)
+{
+  _soutFloat(spec, v);
+}
+
+inline void _soutArg(const _SoutSpec& spec, double v)
+{
+  _soutFloat(spec, (float)v);
+}
+
+inline void _soutArg(const _SoutSpec& spec, const char* v)
+{
+  _soutStr(spec, v);
+}
+
+inline void _soutArg(const _SoutSpec& spec, char* v)
+{
+  _soutStr(spec, v);
+}
+
+inline void _soutArg(const _SoutSpec& spec, const __FlashStringHelper* v)
+{
+  _soutStr(spec, v);
+}
+
+inline void _soutArg(const _SoutSpec& spec, const String& v)
+{
+  _soutStr(spec, v.c_str());
+}
+
+inline void _soutArgs(_SoutFmt&)
+{
+}
+
+template <typename T, typename... R>
+inline void _soutArgs(_SoutFmt& f, T v, R... rest)
+{
+  _SoutSpec spec;
+  if (f.next(spec)) {
+    _soutArg(spec, v);
+  }
+  _soutArgs(f, rest...);
+}
+
+/// \brief print to the serial port using the argument types to format them.
+///
+/// This takes the same format strings as serial_printf and also adds a
+/// line feed at the end, but it doesn't use vsnprintf or a buffer.
+/// You normally call it with sout or dbg so the arguments are checked.
+///
+/// \param fmt The printf-like formatting string.
+/// \param args The values to format.
+template <typename... A>
+void serial_fmt(const char* fmt, A... args)
+{
+  serial_msg_begin();
+  _SoutFmt f(fmt);
+  _soutArgs(f, args...);
+  f.finish();
+  serial_msg_end();
+}
+
+// Count the conversions in a format string at compile time
+constexpr uint8_t _soutCount(const char* s)
+{
+  return (*s == 0) ? 0
+      : (*s != '%') ? _soutCount(s + 1)
+      : (s[1] == '%') ? _soutCount(s + 2)
+      : (s[1] == 0) ? 0
+      : 1 + _soutCount(s + 1);
+}
+
+// Count the arguments without evaluating them. This is only used in sizeof().
+template <typename... A>
+char (&_soutNumArgs(const A&...))[sizeof...(A) + 1];
+
+// Stop the build if the format string and the arguments don't match
+template <uint8_t CONVERSIONS, uint8_t ARGS>
+struct _SoutCheck
+{
+  static_assert(CONVERSIONS == ARGS, "sout/dbg format string doesn't match the number of arguments");
+
+  static constexpr const char* check(const char* f)
+  {
+    return f;
+  }
+};
+
+#ifdef SERIAL_BINARY_LOG
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Binary log support
+//
+// When SERIAL_BINARY_LOG is defined before you include this header, sout and dbg
+// don't format anything on the board. They send a 32-bit ID for the format string
+// and the raw argument values, and python/serlogdecode.py does the formatting on
+// the host. The ID is a hash of the format string computed at compile time so
+// the format strings don't even end up in the flash memory. The decoder works out
+// the same IDs by reading the format strings from your sketch source code.
+//
+// The format string must be a string literal when you use this mode.
+//
+// Each message is sent like this before it is COBS encoded and a zero byte
+// is added to the end:
+//   id        32-bits  FNV-1a hash of the format string
+//   then for each argument:
+//     tag     8-bits   BLOG_xxx type in the top 4 bits, size in bytes in the low 4
+//     value            the value, little endian. Strings end with a zero.
+
+// Argument type tags
+#define BLOG_SIGNED   0x00
+#define BLOG_UNSIGNED 0x10
+#define BLOG_FLOAT    0x20
+#define BLOG_STRING   0x30
+
+// The largest message we send. Long strings get cut short.
+#define BLOG_MAX_MESSAGE 64
+
+// Compute the FNV-1a hash of a string at compile time
+constexpr uint32_t _blogHash(const char* s, uint32_t h = 2166136261UL)
+{
+  return *s ? _blogHash(s + 1, (h ^ (uint8_t)*s) * 16777619UL) : h;
+}
+
+// Make sure the hash is done by the compiler, not at run time
+template <uint32_t ID>
+struct _BlogId
+{
+  static const uint32_t value = ID;
+};
+
+// The buffer we build each message in
+class _BlogBuf
+{
+public:
+  _BlogBuf()
+  : m_len(0)
+  {
+  }
+
+  void put(const void* p_data, uint8_t len)
+  {
+    if (len > BLOG_MAX_MESSAGE - m_len) {
+      len = BLOG_MAX_MESSAGE - m_len;
+    }
+    memcpy(&m_buf[m_len], p_data, len);
+    m_len += len;
+  }
+
+  void putTag(uint8_t tag)
+  {
+    put(&tag, 1);
+  }
+
+  void putString(const char* s);
+  void putString(const __FlashStringHelper* s);
+
+  // encode the message and send it
+  void send();
+
+private:
+  uint8_t m_buf[BLOG_MAX_MESSAGE];
+  uint8_t m_len;
+};
+
+// Add one argument to the message. Any integer type uses the template
+// and the others have their own functions.
+template <typename T>
+inline void _blogArg(_BlogBuf& b, T v)
+{
+  b.putTag((((T)-1 < (T)0) ? BLOG_SIGNED : BLOG_UNSIGNED) | sizeof(T));
+  b.put(&v, sizeof(T));
+}
+
+inline void _blogArg(_BlogBuf& b, float v)
+{
+  b.putTag(BLOG_FLOAT | sizeof(v));
+  b.put(&v, sizeof(v));
+}
+
+inline void _blogArg(_BlogBuf& b, double v)
+{
+  b.putTag(BLOG_FLOAT | sizeof(v));
+  b.put(&v, sizeof(v));
+}
+
+inline void _blogArg(_BlogBuf& b, const char* v)
+{
+  b.putString(v);
+}
+
+// A char array or a non-const char* would match the template and send the
+// pointer, so send the string instead
+inline void _blogArg(_BlogBuf& b, char* v)
+{
+  b.putString(v);
+}
+
+inline void _blogArg(_BlogBuf& b, const __FlashStringHelper* v)
+{
+  b.putString(v);
+}
+
+inline void _blogArg(_BlogBuf& b, const String& v)
+{
+  b.putString(v.c_str());
+}
+
+inline void _blogArgs(_BlogBuf& b)
+{
+}
+
+template <typename T, typename... R>
+inline void _blogArgs(_BlogBuf& b, T v, R... rest)
+{
+  _blogArg(b, v);
+  _blogArgs(b, rest...);
+}
+
+/// \brief Send a binary log message.
+/// You don't call this directly, sout and dbg do it for you.
+/// \param id The format string ID.
+/// \param args The values to send.
+template <typename... A>
+void serial_blog(uint32_t id, A... args)
+{
+  _BlogBuf b;
+  b.put(&id, sizeof(id));
+  _blogArgs(b, args...);
+  b.send();
+}
+
+/// \brief In binary log mode sout sends the format ID and the arguments
+#define sout(fmt, ...) serial_blog(_BlogId<_blogHash(fmt)>::value, ##__VA_ARGS__)
+
+#elif defined(SERIAL_USE_PRINTF)
+
+/// \brief A macro to shorten nt::serial_printf
+#define sout serial_printf
+
+#else // type-safe formatting
+
+/// \brief sout checks the format string and arguments match then calls serial_fmt
+#define sout(fmt, ...) serial_fmt(_SoutCheck<_soutCount(fmt), \
+    sizeof(_soutNumArgs(__VA_ARGS__)) - 1>::check(fmt), ##__VA_ARGS__)
+
+#endif // type-safe formatting
+
+// The most characters a formatted float can need: sign, 10 digits,
+// point, 6 places and the zero on the end
+#define F2S_MAX_LEN 20
+
+// The number of f2s() results that can be in use at the same time
+#define F2S_NUM_BUFFERS 4
+
+/// \brief Format a float into a buffer you provide.
+/// This uses fixed-point math so there is no heap allocation and it's safe to
+/// call from anywhere. Values too big for 32 bits are formatted as "ovf",
+/// the same as Serial.print() does.
+///
+/// \param value The float value to format.
+/// \param places The number of decimal places to format the value with (0..6).
+/// \param buf Where to put the string.
+/// \param size The size of the buffer. F2S_MAX_LEN is always enough.
+/// \return buf.
+char* f2s(float value, uint8_t places, char* buf, size_t size);
+
+/// \brief Convert a float value to a const char* string.
+/// The function uses a small set of buffers in turn, so you can use up to
+/// F2S_NUM_BUFFERS of them in one sout() call, but do not store the returned
+/// char* pointer.
+///
+/// \param value The float value to format.
+/// \param places The number of decimal places to format the value with.
+/// \return A pointer to the formatted string.
+const char* f2s(float& value, uint8_t places);
+
+// A buffer for F2S() to return by value
+struct _F2sBuf
+{
+  char str[F2S_MAX_LEN];
+};
+
+inline _F2sBuf _f2sb(float value, uint8_t places)
+{
+  _F2sBuf b;
+  f2s(value, places, b.str, sizeof(b.str));
+  return b;
+}
+
+/// \brief Convert a float to a string on the caller's stack.
+/// The string lasts until the end of the statement it's used in, so
+/// this is safe as an argument to sout(), as often as you like:
+///   sout("x: %s, y: %s", F2S(x, 2), F2S(y, 2));
+#define F2S(value, places) (_f2sb((value), (places)).str)
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Debug support
+//
+// Ref: http://dbp-consulting.com/tutorials/SuppressingGCCWarnings.html
+#if ((__GNUC__ * 100) + __GNUC_MINOR__) >= 402
+#define GCC_DIAG_STR(s) #s
+#define GCC_DIAG_JOINSTR(x,y) GCC_DIAG_STR(x ## y)
+# define GCC_DIAG_DO_PRAGMA(x) _Pragma (#x)
+# define GCC_DIAG_PRAGMA(x) GCC_DIAG_DO_PRAGMA(GCC diagnostic x)
+# if ((__GNUC__ * 100) + __GNUC_MINOR__) >= 406
+#  define GCC_DIAG_OFF(x) GCC_DIAG_PRAGMA(push) \
+  GCC_DIAG_PRAGMA(ignored GCC_DIAG_JOINSTR(-W,x))
+#  define GCC_DIAG_ON(x) GCC_DIAG_PRAGMA(pop)
+# else
+#  define GCC_DIAG_OFF(x) GCC_DIAG_PRAGMA(ignored GCC_DIAG_JOINSTR(-W,x))
+#  define GCC_DIAG_ON(x)  GCC_DIAG_PRAGMA(warning GCC_DIAG_JOINSTR(-W,x))
+# endif
+#else
+# define GCC_DIAG_OFF(x)
+# define GCC_DIAG_ON(x)
+#endif
+
+#ifdef DEBUG
+
+#define dbg sout
+
+#else // not DEBUG
+
+GCC_DIAG_OFF(unused-value)
+
+/// \brief Write a debug message to the serial port.
+///
+/// Use this like serial_printf to format and print a message written
+/// to the serial port. The output is only generated when DEBUG
+/// is defined. You must #define NT_DEBUG before including this header
+/// or any other header that includes this one.
+#define dbg (void) // Note that this generates 'unused-value' warnings without prev macro
+
+#endif // not DEBUG
+
+
+#endif // _SERIAL_UTILS_H_
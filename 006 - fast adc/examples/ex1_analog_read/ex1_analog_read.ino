@@ -4,10 +4,14 @@
  * This doesn't need any wiring. It just reads the A0 input.
  * 
  * For the curios we toggle a port output bit each time we read a 
- * sample, so you can see the sample interval on a scope.
+ * sample, so you can see the sample interval on a scope. FastPin does
+ * that in one instruction so it hardly changes the times we measure.
  */
 
+#include "fast_pin.h"
+
 #define SAMPLE_TIMING_PIN 2
+typedef FastPin<SAMPLE_TIMING_PIN> SampleTimingPin;
 
 void setup() 
 {
@@ -19,7 +23,7 @@ void setup()
   pinMode(A0, INPUT);
 
   // scope monitor pin
-  pinMode(SAMPLE_TIMING_PIN, OUTPUT);
+  SampleTimingPin::output();
 
 }
 
@@ -34,9 +38,9 @@ void loop()
 
   // do some reads
   for (uint16_t n = 0; n < num_reads; n++) {
-    digitalWrite(SAMPLE_TIMING_PIN, HIGH);
+    SampleTimingPin::high();
     uint16_t aval = analogRead(A0);
-    digitalWrite(SAMPLE_TIMING_PIN, LOW);
+    SampleTimingPin::low();
   }
 
   // measure the time 
@@ -15,10 +15,17 @@
  * In any case, your code is running for a significant portion of the available CPU cycles, so this 
  * code will slow down the execution of the foreground code. No free lunch.
  * 
+ * The printing is a task for the scheduler in task_sched.h, so rather than
+ * wait in delay() the CPU sleeps between the ADC interrupts.
+ * 
  */
 
 // We use a locking mechanism from the AVR sources
 #include "util/atomic.h"
+// and direct port i/o for the scope pin
+#include "fast_pin.h"
+// and the scheduler for the printing
+#include "task_sched.h"
 
 // Choose the prescaler for the ADC. 16 works well and gives
 // 13 us conversion times. 8 is twice as fast (6.5 us) but you'll 
@@ -28,12 +35,14 @@
 // If you want a different prescaler, look at the MCU datasheet
 #define ADC_PRESCALER 16
 
-// define the port and port bit to use for the scope output
-// pin 2 is on Port D at bit 2 (0x04)
-#define DIRECT_PORT   PORTD   // The port to use
-#define DIRECT_DDR    DDRD    // Data direction register for the port
-#define DIRECT_BIT 2          // The bit number for the pin we want
-#define DIRECT_MASK (1 << DIRECT_BIT)
+// define the pin to use for the scope output.
+// FastPin works out the port and bit for it when the code is compiled.
+// Pin 2 is on Port D at bit 2 (0x04) so ScopePin::high() is just sbi PORTD, 2
+#define SCOPE_PIN 2
+typedef FastPin<SCOPE_PIN> ScopePin;
+
+// The scheduler that calls printSample() every 500 ms
+Scheduler g_sched;
 
 void setup()
 {
@@ -42,8 +51,8 @@ void setup()
 
   // Set up the port bit we will use to monitor the 
   // IST execution on the scope.
-  DIRECT_DDR |= DIRECT_MASK; // 1 = output
-  PORTD &= ~DIRECT_MASK; // low
+  ScopePin::output();
+  ScopePin::low();
 
   // Enable the ADC
   ADCSRA =  bit(ADEN);   // turn ADC on
@@ -72,6 +81,8 @@ void setup()
   // start the first conversion with the interrupt enabled
   ADCSRA |= bit(ADSC) | bit(ADIE);
 
+  g_sched.begin();
+  g_sched.every(500000L, printSample);
 }
 
 // This is where we will store the ADC conversion result
@@ -86,7 +97,7 @@ ISR (ADC_vect)
   // In a real app you'll be doing some processing of the ADC value in here.
   
   // Set the scope output pin high so we can see the timing on the scope.
-  PORTD |= DIRECT_MASK; // high
+  ScopePin::high();
 
   // get the conversion result
   g_adc_value = ADC;
@@ -101,10 +112,11 @@ ISR (ADC_vect)
   // ADC conversion before you do your math etc.
 
   // mark the end of the ISR so we can see it on the scope
-  PORTD &= ~DIRECT_MASK; // low
+  ScopePin::low();
 }
 
-void loop()
+// Called by the scheduler every 500 ms
+void printSample()
 {
   // Print out one of our samples occasionally.
   // Get the most recent sample. Note that this changes as fast as the ISR
@@ -119,6 +131,10 @@ void loop()
 
   Serial.print("A0: ");
   Serial.println(sample_value);
-  
-  delay(500);
+}
+
+void loop()
+{
+  // print when it's due then sleep until the next interrupt
+  g_sched.run();
 }
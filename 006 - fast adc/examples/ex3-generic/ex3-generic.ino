@@ -9,9 +9,23 @@
  * For this example we toggle a digital output pin each time we get a sample so we can see
  * the sample rate on an oscilloscope.
  *
+ * We also keep every A0 sample in a ring buffer and drain it in loop() to show how
+ * many samples per second we really collect.
+ *
+ * Rather than waiting in a loop the printing is a task for the scheduler in task_sched.h,
+ * which sleeps until the next interrupt. The ADC interrupts keep coming while it sleeps
+ * and loop() drains the ring each time one wakes it up.
+ *
+ * Define FAST_ADC_STATS to have FastAdc keep stats of how long the ISR takes. The
+ * worst case and the 99th percentile tell you how much more work you can put in
+ * onFastUpdate() before the ISR can't keep up.
+ *
  */
 
+//#define FAST_ADC_STATS
 #include "fast_adc.h" 
+#include "fast_pin.h"
+#include "task_sched.h"
 
 // Define the list of ports that we want to read as fast as possible.
 // We only have one in this example.
@@ -23,66 +37,122 @@ uint8_t fast_ports[] = {A0};
 uint8_t slow_ports[] = {A1, A2, A3};
 #define NUM_SLOW_PORTS sizeof(slow_ports) / sizeof(uint8_t)
 
+// Comment this out to use the port lists above. With it the same ports are
+// converted from a weighted schedule: A0 four times in every eight
+// conversions, A1 twice and A2 and A3 once each.
+#define WEIGHTED_SCHEDULE
+
+#ifdef WEIGHTED_SCHEDULE
+AdcChannel adc_channels[] = {
+  {A0, 4, true},
+  {A1, 2, false},
+  {A2, 1, false},
+  {A3, 1, false}
+};
+#define NUM_ADC_CHANNELS sizeof(adc_channels) / sizeof(AdcChannel)
+
+// The table needs a slot for each unit of weight
+#define NUM_ADC_SLOTS 8
+AdcSlot adc_schedule[NUM_ADC_SLOTS];
+#endif
+
+// Set this to the number of samples per second you want if you need the samples
+// to be evenly spaced in time (for an FFT etc.). Timer1 will then trigger each
+// conversion. Zero means go as fast as possible.
+#define SAMPLE_RATE 0
+
 // Define a digital port to use to measure timing with the scope.
-#define ISR_TIMING_PIN 2 // TBD replace with dorect port i/o
+// FastPin sets it in one instruction so it doesn't add much to the ISR time.
+#define ISR_TIMING_PIN 2
+typedef FastPin<ISR_TIMING_PIN> IsrTimingPin;
 
 // declare our class that derives from FastAdc and lets us process the samples as they are taken
-class MyAdc : public FastAdc
+// FastAdc is told which class it is so the ISR can call our onFastUpdate() directly.
+// If your port lists never change you can derive from
+// FastAdcT<MyAdc, AdcPorts<A0>, AdcPorts<A1, A2, A3> > instead and the order of the conversions is
+// worked out at compile time, which makes the ISR a little quicker.
+// If some inputs need to be sampled more often than others you can build a weighted
+// schedule with buildAdcSchedule() and pass the table to the FastAdc constructor,
+// which is what WEIGHTED_SCHEDULE does. If the table can't be built it's empty
+// and begin() fails.
+class MyAdc : public FastAdc<MyAdc>
 {
 public:
   MyAdc()
-  : FastAdc(fast_ports, NUM_FAST_PORTS, slow_ports, NUM_SLOW_PORTS)
-  , m_peak(0)
+#ifdef WEIGHTED_SCHEDULE
+  : FastAdc<MyAdc>(adc_schedule,
+      buildAdcSchedule(adc_channels, NUM_ADC_CHANNELS, adc_schedule, NUM_ADC_SLOTS),
+      SAMPLE_RATE)
+#else
+  : FastAdc<MyAdc>(fast_ports, NUM_FAST_PORTS, slow_ports, NUM_SLOW_PORTS, SAMPLE_RATE)
+#endif
+  , m_reset_peak(false)
   {
   }
 
-  // Overload the fast conversion completion function so we can process the
-  // samples as they are taken.
+  // Write our own fast conversion completion function so we can process the
+  // samples as they are taken. It's not virtual, FastAdc calls it directly.
   // This is ISR code so keep it short.
   // This example just looks for a peak value and toggles an output port
   // bit so we can see the performace on a scope
-  virtual void onFastUpdate()
+  void onFastUpdate()
   {
     // show this on the scope
-    digitalWrite(ISR_TIMING_PIN, HIGH);
+    IsrTimingPin::high();
 
     // get the sample for A0
     uint16_t s = m_adc_samples[0];
 
-    // update our peak value
-    if (s > m_peak) {
-      m_peak = s;
+    // update our peak value. Only the ISR changes it so resetPeak() just
+    // asks us to do it.
+    uint16_t peak = m_peak.peek();
+    if (m_reset_peak) {
+      m_reset_peak = false;
+      peak = 0;
+    }
+    if (s > peak) {
+      peak = s;
+    }
+    if (peak != m_peak.peek()) {
+      m_peak.write(peak);
     }
 
     // show that we're done on the scope
-    digitalWrite(ISR_TIMING_PIN, LOW);
+    IsrTimingPin::low();
   }
 
   // Get our peak value.
-  // Make sure this is safe to call from foreground
+  // The snapshot makes this safe to call from foreground without
+  // turning the interrupts off
   uint16_t getPeak()
   {
-    uint16_t p;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      p = m_peak;
-    }
-    return p;
+    return m_peak.read();
   }
 
-  // Reset the peak value
+  // Reset the peak value. This happens at the next fast sample.
   void resetPeak()
   {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      m_peak = 0;
-    }
+    m_reset_peak = true;
   }
 
 private:
-  uint16_t m_peak;
+  Snapshot<uint16_t> m_peak;
+  volatile bool m_reset_peak;
 };
 
 // Create the FastADC object that will sample the ports
+// and hook it up to the ADC interrupt
 MyAdc my_adc;
+FAST_ADC_ISR(my_adc);
+
+// A ring buffer to keep every fast sample in so we don't lose any
+SampleRing<128> g_ring;
+
+// The scheduler that calls printSamples() and sleeps in between
+Scheduler g_sched;
+
+// The samples we've taken out of the ring since the last print
+uint32_t g_num_samples = 0;
 
 void setup()
 {
@@ -90,12 +160,23 @@ void setup()
   Serial.println("\n\n\nFast ADC demo\n\n");
 
   // set up the timing pin
-  pinMode(ISR_TIMING_PIN, OUTPUT);
-  digitalWrite(ISR_TIMING_PIN, LOW);
+  IsrTimingPin::output();
+  IsrTimingPin::low();
 
   // start the ADC conversions
-  my_adc.begin();
+  my_adc.setSampleRing(&g_ring);
+  if (my_adc.begin()) {
+    Serial.print("Sample rate: ");
+    Serial.println(my_adc.getSampleRate());
+  } else {
+    Serial.println("FastAdc::begin() failed. Is my_adc the object in FAST_ADC_ISR() and is the schedule OK?");
+  }
 
+  // Print every 500 ms. The serial port has to keep going while we sleep
+  // so this can't use the deep sleep on the Artemis.
+  g_sched.begin();
+  g_sched.setSleep(SCHED_SLEEP_LIGHT);
+  g_sched.every(500000L, printSamples);
 }
 
 // convert ADC reading to voltage in millivolts
@@ -104,8 +185,25 @@ uint16_t stomv(uint16_t sample)
   return map(sample, 0, 1023, 0, 5000);
 }
 
+#ifdef FAST_ADC_STATS
+// Print the stats for one of the times FastAdc measures
+void printStats(const char* name, const FastAdcTimeStats& stats)
+{
+  char buf[100];
+  sprintf(buf, "%s: %lu samples, min %lu, mean %lu, 99%% %lu, max %lu ns", name,
+      (unsigned long)stats.count,
+      (unsigned long)cycles_to_ns(stats.min_time),
+      (unsigned long)cycles_to_ns(stats.average()),
+      (unsigned long)cycles_to_ns(stats.percentile(99)),
+      (unsigned long)cycles_to_ns(stats.max_time));
+  Serial.println(buf);
+}
+#endif
+
 uint32_t g_cycle = 0;
-void loop()
+
+// Called by the scheduler every 500 ms
+void printSamples()
 {
   // Print out our samples and the calculated peak occasionally.
   char buf[80];
@@ -124,5 +222,33 @@ void loop()
     Serial.println("Peak reset");
   }
 
-  delay(500);
+  // show how many samples came through the ring and how long we slept
+  sprintf(buf, "Ring: %lu samples in 500 ms, %lu overruns, asleep %u%%",
+      g_num_samples, g_ring.getOverruns(), g_sched.getSleepPercent());
+  Serial.println(buf);
+  g_num_samples = 0;
+
+#ifdef FAST_ADC_STATS
+  FastAdcTimeStats stats;
+  my_adc.getIsrStats(stats);
+  printStats("ISR time", stats);
+  my_adc.getAdcStats(stats);
+  printStats("Conversion time", stats);
+#endif
+}
+
+void loop()
+{
+  // Drain the ring and count how many samples we get.
+  // The ring only holds 1.6 ms of samples but every ADC interrupt wakes us
+  // up so we get back here in plenty of time.
+  uint16_t block[32];
+  uint8_t n;
+  while ((n = g_ring.read(block, 32)) > 0) {
+    g_num_samples += n;
+    // This is where you'd process the samples in block[0..n-1]
+  }
+
+  // run the print when it's due then sleep until the next interrupt
+  g_sched.run();
 }
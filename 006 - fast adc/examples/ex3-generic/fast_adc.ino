@@ -1,6 +1,6 @@
 /** \file fast_adc.cpp
  *
- * Fast ADC for Arduino Uno or Mega
+ * Fast ADC for Arduino Uno or Mega, and the Artemis boards
  * MIT License:
  *
  * Copyright 2022 Nigel Thompson
@@ -24,14 +24,29 @@
  *
  */
 
+// The parts that drive the ADC registers are for the ATmega boards.
+// The Apollo 3 versions are in fast_adc_apollo3.ino.
+
 #include "fast_adc.h"
 
- FastAdc::FastAdc(const uint8_t* p_fast_list, uint8_t num_fast,
-         const uint8_t* p_slow_list, uint8_t num_slow)
+ FastAdcBase::FastAdcBase(const uint8_t* p_fast_list, uint8_t num_fast,
+         const uint8_t* p_slow_list, uint8_t num_slow,
+         uint32_t sample_rate)
  : m_p_fast_list(p_fast_list)
  , m_num_fast(num_fast)
  , m_p_slow_list(p_slow_list)
  , m_num_slow(num_slow)
+ , m_sample_rate(sample_rate)
+ , m_actual_rate(0)
+ , m_p_schedule(0)
+ , m_num_slots(0)
+ , m_slot(0)
+ , m_p_ring(0)
+ , m_block_size(0)
+ , m_block_fill(0)
+ , m_block_active(0)
+ , m_block_ready(NO_BLOCK)
+ , m_block_overruns(0)
  , m_adc_pin(0)
  , m_adc_hiprio(true)
  , m_adc_hipri_index(0)
@@ -40,49 +55,195 @@
  , m_adc_conv_time(0)
  , m_isr_time(0)
  {
+  m_p_block[0] = 0;
+  m_p_block[1] = 0;
+#ifdef ARDUINO_ARCH_APOLLO3
+  m_adc_handle = 0;
+#else
+  m_timer_interval = 0;
+#endif
+#ifdef FAST_ADC_STATS
+  m_isr_stats.reset();
+  m_adc_stats.reset();
+#endif
 
  }
 
- void FastAdc::begin()
+ FastAdcBase::FastAdcBase(const AdcSlot* p_schedule, uint16_t num_slots,
+         uint32_t sample_rate)
+ : m_p_fast_list(0)
+ , m_num_fast(0)
+ , m_p_slow_list(0)
+ , m_num_slow(0)
+ , m_sample_rate(sample_rate)
+ , m_actual_rate(0)
+ , m_p_schedule(p_schedule)
+ , m_num_slots(num_slots)
+ , m_slot(0)
+ , m_p_ring(0)
+ , m_block_size(0)
+ , m_block_fill(0)
+ , m_block_active(0)
+ , m_block_ready(NO_BLOCK)
+ , m_block_overruns(0)
+ , m_adc_pin(p_schedule[0].port)
+ , m_adc_hiprio(true)
+ , m_adc_hipri_index(0)
+ , m_adc_lopri_index(0)
+ , m_adc_start_time(0)
+ , m_adc_conv_time(0)
+ , m_isr_time(0)
+ {
+  m_p_block[0] = 0;
+  m_p_block[1] = 0;
+#ifdef ARDUINO_ARCH_APOLLO3
+  m_adc_handle = 0;
+#else
+  m_timer_interval = 0;
+#endif
+#ifdef FAST_ADC_STATS
+  m_isr_stats.reset();
+  m_adc_stats.reset();
+#endif
+ }
+
+#ifndef ARDUINO_ARCH_APOLLO3
+
+ bool FastAdcBase::begin()
  {
-  // Oh so cheesy but this is how we roll so we can hook
-  // into the Arduino ISR system
-  FastAdc::s_pInst = this;
+  // Only the one FAST_ADC_ISR() hooked up to the ADC interrupt can have it
+  if (fastAdcInstance() != this) {
+    return false;
+  }
+  // an empty table, like when buildAdcSchedule() failed
+  if (m_p_schedule && (m_num_slots == 0)) {
+    return false;
+  }
 
   // Configure the ADC with a prescaler of 16 (so it's faster)
   ADCSRA =  bit(ADEN);   // turn ADC on
   ADCSRA |= bit(ADPS2);  // Prescaler of 16
 
-  // Set the mux for the first port in the hi prio list
-  _setAdcMux(m_p_fast_list[m_adc_hipri_index]);
+  if (m_p_schedule) {
+    // Set the mux for the first slot in the schedule
+    m_slot = 0;
+    _setAdcMux(&m_p_schedule[0]);
+  } else {
+    // Set the mux for the first port in the hi prio list
+    m_adc_pin = _ATOPN(m_p_fast_list[m_adc_hipri_index]);
+    _setAdcMux(m_adc_pin);
+  }
+
+  // we time the ISR with this
+  cycle_timer_begin();
 
-  // start the first conversion with interrupt enabled
-  m_adc_start_time = micros();
-  ADCSRA |= bit(ADSC) | bit(ADIE);
+  if (m_sample_rate) {
+    // Let Timer1 compare match B start each conversion.
+    // See ATmega328P spec section 23.9.4 and Table 23-6
+    ADCSRB = (ADCSRB & ~(bit(ADTS2) | bit(ADTS1) | bit(ADTS0))) | bit(ADTS2) | bit(ADTS0);
+    _setupTimer1(m_sample_rate);
+    m_adc_start_time = now_cycles();
+    ADCSRA |= bit(ADATE) | bit(ADIE);
+  } else {
+    // start the first conversion with interrupt enabled
+    m_adc_start_time = now_cycles();
+    ADCSRA |= bit(ADSC) | bit(ADIE);
+  }
+  return true;
 }
 
+void FastAdcBase::end()
+{
+  // stop the interrupts and the auto trigger, and clear any interrupt
+  // that is waiting so it doesn't go off when we start again.
+  // Timer1 keeps going as it's the cycle timer.
+  ADCSRA = (ADCSRA & ~(bit(ADIE) | bit(ADATE))) | bit(ADIF);
+}
+
+void FastAdcBase::_setupTimer1(uint32_t sample_rate)
+{
+  // Timer1 is counting every CPU clock all the way to 0xFFFF for the cycle
+  // timer, so we can't change its mode or prescaler. Instead each conversion
+  // starts when the count gets to OCR1B and the ISR moves OCR1B on by the
+  // sample interval. The conversions are still started by the hardware so
+  // the interval doesn't depend on how long the ISR takes.
+  uint32_t ticks = F_CPU / sample_rate;
+  if (ticks < 2) ticks = 2;
+  if (ticks > 65535L) ticks = 65535L;
+  m_timer_interval = ticks;
+
+  uint8_t sreg = SREG;
+  cli();
+  OCR1B = TCNT1 + m_timer_interval;
+  TIFR1 = bit(OCF1B);
+  SREG = sreg;
+
+  m_actual_rate = F_CPU / ticks;
+}
+
+#endif // ARDUINO_ARCH_APOLLO3
+
+uint32_t FastAdcBase::getSampleRate()
+{
+  return m_actual_rate;
+}
+
+ void FastAdcBase::setSampleRing(SampleRingBase* p_ring)
+ {
+  // The pointer is 16 bits on the ATmega so lock while we change it.
+  // Only the ADC ISR uses it so we don't need to hold up the others.
+  // On the Apollo 3 it's written in one go.
+#ifndef ARDUINO_ARCH_APOLLO3
+  CS_LOCK_ADC
+#endif
+  m_p_ring = p_ring;
+ }
+
+ bool FastAdcBase::beginBlockCapture(uint16_t* bufA, uint16_t* bufB, size_t n)
+ {
+  m_p_block[0] = bufA;
+  m_p_block[1] = bufB;
+  m_block_size = n;
+  m_block_fill = 0;
+  m_block_active = 0;
+  m_block_ready = NO_BLOCK;
+  m_block_overruns = 0;
+  return begin();
+ }
+
+ uint32_t FastAdcBase::getBlockOverruns()
+ {
+  uint32_t n;
+  SEQ_READ(m_seq) {
+    n = m_block_overruns;
+  }
+  return n;
+ }
+
  // Get the complete set of samples. The pointer must be to
  // an array NUM_ANALOG_PORTS in size
- const void FastAdc::getSamples(uint16_t* buf, uint8_t num_samples)
+ const void FastAdcBase::getSamples(uint16_t* buf, uint8_t num_samples)
  {
-	 ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	 SEQ_READ(m_seq) {
 		 memcpy(buf, (const void*)m_adc_samples, num_samples * sizeof(uint16_t));
 	 }
  }
 
 
  // get a sampled value. Port can be like A3 or the actual index like 3
- uint16_t FastAdc::sample(uint8_t port)
+ uint16_t FastAdcBase::sample(uint8_t port)
  {
 	 uint16_t s;
-	 ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	 SEQ_READ(m_seq) {
 		 s = m_adc_samples[_ATOPN(port)];
 	 }
 	 return s;
  }
 
 
-void FastAdc::_setAdcMux(uint8_t analogPin)
+#ifndef ARDUINO_ARCH_APOLLO3
+
+void FastAdcBase::_setAdcMux(uint8_t analogPin)
 {
   // set the ADC mux for the specified pin
   // like: A0..A15, or 0..15
@@ -95,30 +256,35 @@ void FastAdc::_setAdcMux(uint8_t analogPin)
 #if defined (__AVR_ATmega2560__)
 
   // Mega mux has another selector for 8..15
-  ADCSRB = (index > 7) ? bit(MUX5) : 0;
+  // Leave the auto trigger source bits alone
+  ADCSRB = (ADCSRB & ~bit(MUX5)) | ((index > 7) ? bit(MUX5) : 0);
 #endif
 
 }
 
-// Horrible global pointer to the instance to use
-FastAdc* FastAdc::s_pInst = 0;
-
-// Hook into the ADC interrupt vecotor
-ISR (ADC_vect)
+// Set the mux from a schedule slot where we already have the register values
+inline void FastAdcBase::_setAdcMux(const AdcSlot* p_slot)
 {
-  if (FastAdc::s_pInst) {
-    FastAdc::s_pInst->_isr();
-  }
+  ADMUX = p_slot->admux;
+
+#if defined (__AVR_ATmega2560__)
+
+  // Mega mux has another selector for 8..15
+  ADCSRB = (ADCSRB & ~bit(MUX5)) | ((p_slot->flags & SLOT_MUX5) ? bit(MUX5) : 0);
+#endif
+
 }
 
-void FastAdc::_isr()
+// Store the sample and work out which port is next from the fast and slow lists
+inline uint8_t FastAdcBase::_nextFromLists(uint16_t value)
 {
-  // compute the conversion time
-  unsigned long isr_start_time = micros();
-  m_adc_conv_time = isr_start_time - m_adc_start_time;
-
-  // read the 16-bit result of the previous conversion
-  m_adc_samples[m_adc_pin] = ADC;
+  uint8_t done = 0;
+  SEQ_WRITE(m_seq) {
+    m_adc_samples[m_adc_pin] = value;
+  }
+  if (m_adc_hiprio) {
+    _captureFast(m_adc_pin, value);
+  }
 
   // figure out which analog pin to sample next
   if (m_adc_hiprio) {
@@ -136,8 +302,8 @@ void FastAdc::_isr()
         m_adc_hiprio = true;
         m_adc_pin = _ATOPN(m_p_fast_list[0]);
       }
-      // notify derived class
-      onFastUpdate();
+      // onFastUpdate() is due
+      done = SLOT_FAST_DONE;
     } else {
       // set up for next one off the hi prio list
       m_adc_pin = _ATOPN(m_p_fast_list[m_adc_hipri_index]);
@@ -153,35 +319,99 @@ void FastAdc::_isr()
     if (m_adc_lopri_index >= m_num_slow) {
       // end of the low prio list
       m_adc_lopri_index = 0;
-      // notify derived class
-      onSlowUpdate();
+      // onSlowUpdate() is due
+      done = SLOT_SLOW_DONE;
     }
   }
 
   // set the mux for the next conversion
   _setAdcMux(m_adc_pin);
+  return done;
+}
+
+// Store the sample and step to the next slot in the schedule table.
+// All the decisions were made when the table was built.
+inline uint8_t FastAdcBase::_nextFromSchedule(uint16_t value)
+{
+  const AdcSlot* p_slot = &m_p_schedule[m_slot];
+  uint8_t flags = p_slot->flags;
+  SEQ_WRITE(m_seq) {
+    m_adc_samples[p_slot->port] = value;
+  }
+  if (flags & SLOT_FAST) {
+    _captureFast(p_slot->port, value);
+  }
 
-  // start the next ADC conversion
-  m_adc_start_time = micros();
-  ADCSRA |= bit (ADSC) | bit (ADIE);
+  uint16_t next = m_slot + 1;
+  if (next >= m_num_slots) {
+    next = 0;
+  }
+  m_slot = next;
+  _setAdcMux(&m_p_schedule[next]);
 
-  m_isr_time = m_adc_start_time - isr_start_time;
+  // say which callbacks are due
+  return flags & (SLOT_FAST_DONE | SLOT_SLOW_DONE);
 }
 
-uint32_t FastAdc::getIsrTime()
+uint8_t FastAdcBase::_nextSample()
 {
-  uint32_t t;
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+  // read the 16-bit result of the previous conversion
+  uint16_t value = ADC;
+
+  if (m_p_schedule) {
+    return _nextFromSchedule(value);
+  }
+  return _nextFromLists(value);
+}
+
+#endif // ARDUINO_ARCH_APOLLO3
+
+uint32_t FastAdcBase::getIsrTime()
+{
+  cycles_t t;
+  SEQ_READ(m_seq) {
     t = m_isr_time;
   }
-  return t;
+  return cycles_to_us(t);
 }
 
-uint32_t FastAdc::getAdcTime()
+uint32_t FastAdcBase::getAdcTime()
 {
-  uint32_t t;
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+  cycles_t t;
+  SEQ_READ(m_seq) {
     t = m_adc_conv_time;
   }
-  return t;
+  return cycles_to_us(t);
 }
+
+#ifdef FAST_ADC_STATS
+
+// The stats are too big to copy between two conversions so a sequence lock
+// could keep trying for ever. We hold off the ADC interrupt instead, and on
+// the Apollo 3 anything less urgent, but the more urgent ones still run.
+#ifdef ARDUINO_ARCH_APOLLO3
+#define _FAST_ADC_STATS_LOCK CS_LOCK_PRIO(FAST_ADC_IRQ_PRIO)
+#else
+#define _FAST_ADC_STATS_LOCK CS_LOCK_ADC
+#endif
+
+void FastAdcBase::getIsrStats(FastAdcTimeStats& stats)
+{
+  _FAST_ADC_STATS_LOCK
+  stats = m_isr_stats;
+}
+
+void FastAdcBase::getAdcStats(FastAdcTimeStats& stats)
+{
+  _FAST_ADC_STATS_LOCK
+  stats = m_adc_stats;
+}
+
+void FastAdcBase::resetStats()
+{
+  _FAST_ADC_STATS_LOCK
+  m_isr_stats.reset();
+  m_adc_stats.reset();
+}
+
+#endif // FAST_ADC_STATS
@@ -0,0 +1,178 @@
+/*
+ * Implementation for critical section locks
+ * 
+ * 
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * 
+ */
+
+#include "critical_section.h"
+
+#ifdef CS_INSTRUMENT
+
+__CsSite* volatile __cs_sites = NULL;
+
+// Add the time for one lock to its site. Called with the interrupts still off.
+static inline void __csRecord(__CsSite* p_site, cs_ticks_t start)
+{
+  if (p_site == NULL) {
+    return;
+  }
+  cs_ticks_t ticks = CS_TICKS() - start;
+  if (!p_site->listed) {
+    p_site->listed = true;
+    p_site->p_next = __cs_sites;
+    __cs_sites = p_site;
+  }
+  p_site->count++;
+  p_site->total += ticks;
+  if (ticks > p_site->max) {
+    p_site->max = ticks;
+  }
+}
+
+void csStatsBegin()
+{
+  cycle_timer_begin();
+  csStatsReset();
+}
+
+void csStatsReset()
+{
+  for (__CsSite* p = __cs_sites; p; p = p->p_next) {
+    CS_LOCK_UNTIMED
+    p->max = 0;
+    p->count = 0;
+    p->total = 0;
+  }
+}
+
+#endif // CS_INSTRUMENT
+
+#ifdef ARDUINO_ARCH_APOLLO3
+
+  // The constructor establishes the lock by disabling interrupts
+  __CsLock::__CsLock()
+  : m_int_master(am_hal_interrupt_master_disable())
+#ifdef CS_INSTRUMENT
+  , m_p_site(NULL)
+  , m_start(0)
+#endif
+  {  
+  }
+
+  // The destructor removes the lock by enabling interrupts again
+  __CsLock::~__CsLock()
+  {
+#ifdef CS_INSTRUMENT
+    __csRecord(m_p_site, m_start);
+#endif
+    am_hal_interrupt_master_set(m_int_master);
+  }
+
+#ifdef CS_INSTRUMENT
+  __CsLock::__CsLock(__CsSite& site)
+  : m_int_master(am_hal_interrupt_master_disable())
+  , m_p_site(&site)
+  , m_start(CS_TICKS())
+  {
+  }
+#endif
+
+  // Only hold off the interrupts at this priority or lower. BASEPRI uses the
+  // top bits of the byte so we shift the priority up to match. The _MAX
+  // version never lowers it, so we can't undo an outer lock that holds off more.
+  __CsLockPrio::__CsLockPrio(uint8_t prio)
+  : m_basepri(__get_BASEPRI())
+  {
+    __set_BASEPRI_MAX(prio << (8 - __NVIC_PRIO_BITS));
+  }
+
+  __CsLockPrio::~__CsLockPrio()
+  {
+    __set_BASEPRI(m_basepri);
+  }
+
+# else 
+// Assume normal ATmega processor boards
+
+  // The constructor establishes the lock by disabling interrupts
+  __CsLock::__CsLock()
+  : m_sreg(SREG)
+#ifdef CS_INSTRUMENT
+  , m_p_site(NULL)
+  , m_start(0)
+#endif
+  {
+    // disable the global interrupt flag
+    SREG &= ~(1 << SREG_I);
+  }
+
+  // The destructor removes the lock by enabling interrupts again
+  __CsLock::~__CsLock()
+  {
+#ifdef CS_INSTRUMENT
+    __csRecord(m_p_site, m_start);
+#endif
+    // restore the interrupt state
+    SREG = m_sreg;
+  }
+
+#ifdef CS_INSTRUMENT
+  __CsLock::__CsLock(__CsSite& site)
+  : m_sreg(SREG)
+  , m_p_site(&site)
+  {
+    SREG &= ~(1 << SREG_I);
+    // read the counter after the interrupts are off
+    m_start = CS_TICKS();
+  }
+#endif
+
+  // The constructor turns off the interrupt enable bits
+  __CsLockMask::__CsLockMask(volatile uint8_t& reg, uint8_t bits, uint8_t w1c)
+  : m_reg(reg)
+  , m_bits(bits)
+  , m_w1c(w1c)
+  {
+    // An ISR might change the register between our read and write so
+    // we do that bit with all the interrupts off. It's only a few cycles.
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t v = m_reg;
+    m_saved = v & m_bits;
+    m_reg = v & ~(m_bits | m_w1c);
+    SREG = sreg;
+  }
+
+  // The destructor puts back the bits that were set
+  __CsLockMask::~__CsLockMask()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    m_reg = (m_reg & ~m_w1c) | m_saved;
+    SREG = sreg;
+  }
+
+#endif
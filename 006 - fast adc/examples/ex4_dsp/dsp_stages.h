@@ -0,0 +1,369 @@
+/** \file dsp_stages.h
+ *  \brief Fixed-point filter stages for blocks of ADC samples.
+ *
+ *  A DspPipeline takes the blocks FastAdc hands to onBlockReady(), turns
+ *  the samples into signed Q15 numbers and passes them through a chain of
+ *  stages. Each stage works on the block in place and can give back fewer
+ *  samples than it was given, so a decimating stage shrinks the block and
+ *  the stages after it have less to do.
+ *
+ *    CicDecimator<3, 3> cic;                  // 3rd order, decimate by 8
+ *    FirFilter<23, 2> fir(lowpass_coeffs);    // low pass then decimate by 2
+ *    PeakRms meter(500);
+ *    DspPipeline pipeline;
+ *    pipeline.add(cic).add(fir).add(meter);
+ *
+ *    // in onBlockReady()
+ *    size_t n_out = pipeline.run(buf, n, out);
+ *
+ *  The stages are:
+ *    - FirFilter: a FIR filter with Q15 coefficients that can also decimate.
+ *      It only works out the outputs it keeps.
+ *    - CicDecimator: a cascaded integrator comb decimator. No multiplies at
+ *      all so it's the cheap way to make a big cut in the rate on the ATmega.
+ *      Follow it with a short FIR to flatten the droop and clean up.
+ *    - MovingAverage: a boxcar average over a power of two samples that can
+ *      also decimate.
+ *    - PeakRms: passes the samples through and measures the peak and RMS
+ *      over a window of samples.
+ *
+ *  Q15 means a 16-bit number that stands for -1.0 to just under +1.0, so
+ *  the 10-bit ADC range 0..1023 maps on to -32768..32704.
+ *
+ *  On the Artemis the FIR inner loop uses the Cortex-M4 SIMD instruction
+ *  that does two 16-bit multiply-accumulates at once, and the results are
+ *  saturated with SSAT. On the ATmega it's a plain 16 x 16 bit loop with a
+ *  32-bit accumulator, which is what its hardware multiplier is good at.
+ *
+ *  The stages run in the foreground from poll(), not in the ISR, so they
+ *  don't need any locks. They do need to finish each block before the ISR
+ *  fills the other buffer.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _DSP_STAGES_H_
+#define _DSP_STAGES_H_
+
+#include "Arduino.h"
+
+/// \brief Saturate a 32-bit value to the Q15 range.
+inline int16_t dspSat16(int32_t x)
+{
+#if defined(ARDUINO_ARCH_APOLLO3)
+  return (int16_t)__SSAT(x, 16);
+#else
+  if (x > 32767) {
+    return 32767;
+  }
+  if (x < -32768) {
+    return -32768;
+  }
+  return (int16_t)x;
+#endif
+}
+
+/// \brief Round a Q30 product sum back to Q15 and saturate it.
+inline int16_t dspRound15(int32_t acc)
+{
+  return dspSat16((acc + (1L << 14)) >> 15);
+}
+
+/// \brief Sum the products of two arrays of Q15 numbers.
+/// The result is Q30. It doesn't saturate so keep the sum of the absolute
+/// values of the coefficients under about 2.
+int32_t dspDotQ15(const int16_t* x, const int16_t* h, uint8_t n);
+
+/// \brief The integer square root of a 32-bit number.
+uint16_t dspSqrt32(uint32_t x);
+
+/// \brief One stage of a DspPipeline.
+/// Derive from this to make your own stages.
+class DspStage
+{
+public:
+  DspStage()
+  : m_p_next(0)
+  {
+  }
+
+  /// \brief Process a block of samples in place.
+  /// \param buf The Q15 samples. The outputs go back in the same buffer.
+  /// \param n The number of samples in \p buf.
+  /// \return The number of output samples, which can't be more than \p n.
+  virtual size_t process(int16_t* buf, size_t n) = 0;
+
+  /// \brief Clear the history so the next block starts from silence.
+  virtual void reset()
+  {
+  }
+
+private:
+  friend class DspPipeline;
+  DspStage* m_p_next;
+};
+
+/// \brief A FIR filter with Q15 coefficients.
+/// The history is kept twice, one copy after the other, so the last
+/// NUM_TAPS samples are always in one straight run of memory and the inner
+/// loop doesn't need to wrap around. It costs 2 x NUM_TAPS words of RAM.
+/// \tparam NUM_TAPS The number of coefficients.
+/// \tparam DECIMATE Keep one output in this many. 1 keeps them all.
+template <uint8_t NUM_TAPS, uint8_t DECIMATE = 1>
+class FirFilter : public DspStage
+{
+public:
+  /// \param p_coeffs The NUM_TAPS coefficients in Q15, h[0] first. The filter
+  /// keeps the pointer so they need to stay around.
+  FirFilter(const int16_t* p_coeffs)
+  : m_p_coeffs(p_coeffs)
+  {
+    reset();
+  }
+
+  virtual size_t process(int16_t* buf, size_t n)
+  {
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+      // The newest sample goes in front of the last one so m_history[m_pos]
+      // onwards is x[n], x[n-1], ... in the same order as the coefficients.
+      if (m_pos == 0) {
+        m_pos = NUM_TAPS;
+      }
+      m_pos--;
+      m_history[m_pos] = buf[i];
+      m_history[m_pos + NUM_TAPS] = buf[i];
+
+      if (++m_phase < DECIMATE) {
+        continue;
+      }
+      m_phase = 0;
+      // out never gets ahead of i so this doesn't write over a sample we still need
+      buf[out++] = dspRound15(dspDotQ15(&m_history[m_pos], m_p_coeffs, NUM_TAPS));
+    }
+    return out;
+  }
+
+  virtual void reset()
+  {
+    memset(m_history, 0, sizeof(m_history));
+    m_pos = 0;
+    m_phase = 0;
+  }
+
+private:
+  const int16_t* m_p_coeffs;
+  int16_t m_history[2 * NUM_TAPS];
+  uint8_t m_pos;
+  uint8_t m_phase;
+};
+
+/// \brief A cascaded integrator comb decimator.
+/// The gain is DECIMATE ^ ORDER, which is a power of two, so the output is
+/// shifted back down to Q15. The integrators are allowed to wrap around,
+/// the combs take the wrap back out as long as nothing needs more than 32
+/// bits, which is what the static_assert checks.
+/// The response is sinc ^ ORDER so it droops across the pass band, by about
+/// 1.4 dB at 0.18 of the output rate for the 3rd order.
+/// \tparam ORDER The number of integrator and comb stages.
+/// \tparam LOG2_DECIMATE Keep one output in 2 ^ LOG2_DECIMATE.
+template <uint8_t ORDER, uint8_t LOG2_DECIMATE>
+class CicDecimator : public DspStage
+{
+  static_assert(16 + ORDER * LOG2_DECIMATE <= 32, "The CIC needs more than 32 bits");
+  static_assert(LOG2_DECIMATE <= 15, "The CIC can't decimate by more than 32768");
+
+public:
+  CicDecimator()
+  {
+    reset();
+  }
+
+  virtual size_t process(int16_t* buf, size_t n)
+  {
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint32_t v = (uint32_t)(int32_t)buf[i];
+      for (uint8_t k = 0; k < ORDER; k++) {
+        m_integ[k] += v;
+        v = m_integ[k];
+      }
+
+      if (++m_phase < (1U << LOG2_DECIMATE)) {
+        continue;
+      }
+      m_phase = 0;
+      for (uint8_t k = 0; k < ORDER; k++) {
+        uint32_t d = v - m_comb[k];
+        m_comb[k] = v;
+        v = d;
+      }
+      buf[out++] = dspSat16((int32_t)v >> (ORDER * LOG2_DECIMATE));
+    }
+    return out;
+  }
+
+  virtual void reset()
+  {
+    memset(m_integ, 0, sizeof(m_integ));
+    memset(m_comb, 0, sizeof(m_comb));
+    m_phase = 0;
+  }
+
+private:
+  uint32_t m_integ[ORDER];
+  uint32_t m_comb[ORDER];
+  uint16_t m_phase;
+};
+
+/// \brief A moving average over 2 ^ LOG2_LENGTH samples.
+/// It keeps a running sum so each sample costs one add and one subtract
+/// however long the average is.
+/// \tparam LOG2_LENGTH The average is over 2 ^ LOG2_LENGTH samples.
+/// \tparam DECIMATE Keep one output in this many. 1 keeps them all.
+template <uint8_t LOG2_LENGTH, uint8_t DECIMATE = 1>
+class MovingAverage : public DspStage
+{
+  static_assert(LOG2_LENGTH <= 8, "The moving average can't be longer than 256");
+
+public:
+  MovingAverage()
+  {
+    reset();
+  }
+
+  virtual size_t process(int16_t* buf, size_t n)
+  {
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+      int16_t x = buf[i];
+      m_sum += (int32_t)x - m_history[m_pos];
+      m_history[m_pos] = x;
+      m_pos = (m_pos + 1) & (LENGTH - 1);
+
+      if (++m_phase < DECIMATE) {
+        continue;
+      }
+      m_phase = 0;
+      buf[out++] = (int16_t)(m_sum >> LOG2_LENGTH);
+    }
+    return out;
+  }
+
+  virtual void reset()
+  {
+    memset(m_history, 0, sizeof(m_history));
+    m_sum = 0;
+    m_pos = 0;
+    m_phase = 0;
+  }
+
+private:
+  static const uint16_t LENGTH = 1 << LOG2_LENGTH;
+  int16_t m_history[LENGTH];
+  int32_t m_sum;
+  uint8_t m_pos;
+  uint8_t m_phase;
+};
+
+/// \brief Measure the peak and RMS of the samples going through.
+/// The samples are passed on unchanged so you can put it anywhere in the
+/// pipeline. The results are for the last complete window.
+class PeakRms : public DspStage
+{
+public:
+  /// \param window The number of samples to measure over.
+  PeakRms(uint16_t window);
+
+  virtual size_t process(int16_t* buf, size_t n);
+
+  virtual void reset();
+
+  /// \brief See if a window has finished since the last getPeak() or getRms().
+  bool available()
+  {
+    return m_available;
+  }
+
+  /// \brief Get the largest absolute value in the last window, in Q15.
+  uint16_t getPeak()
+  {
+    m_available = false;
+    return m_peak;
+  }
+
+  /// \brief Get the RMS of the last window, in Q15.
+  uint16_t getRms()
+  {
+    m_available = false;
+    return m_rms;
+  }
+
+private:
+  uint16_t m_window;
+  uint16_t m_count;
+  uint16_t m_peak_sofar;
+  uint64_t m_sum_squares;
+  uint16_t m_peak;
+  uint16_t m_rms;
+  bool m_available;
+};
+
+/// \brief A chain of DspStages fed with blocks of ADC samples.
+class DspPipeline
+{
+public:
+  /// \param adc_bits The number of bits in the ADC samples.
+  DspPipeline(uint8_t adc_bits = 10);
+
+  /// \brief Add a stage to the end of the chain.
+  /// The pipeline keeps a pointer to it so it needs to stay around. A stage
+  /// can only be in one pipeline.
+  /// \return The pipeline so you can chain the calls.
+  DspPipeline& add(DspStage& stage);
+
+  /// \brief Reset all the stages.
+  void reset();
+
+  /// \brief Run a block of ADC samples through the stages.
+  /// If the block has more than one port in it, run one pipeline for
+  /// each port and use \p stride to pick out its samples.
+  /// \param samples The ADC samples.
+  /// \param n The number of samples to take from \p samples.
+  /// \param out Where the outputs go. It needs room for \p n samples as
+  /// it's used to work on the block.
+  /// \param stride The step between the samples to take.
+  /// \return The number of samples in \p out.
+  size_t run(const uint16_t* samples, size_t n, int16_t* out, uint8_t stride = 1);
+
+  /// \brief Run a block of Q15 samples through the stages in place.
+  /// \return The number of samples left in \p buf.
+  size_t run(int16_t* buf, size_t n);
+
+private:
+  DspStage* m_p_first;
+  DspStage* m_p_last;
+  uint8_t m_shift;
+};
+
+#endif // _DSP_STAGES_H_
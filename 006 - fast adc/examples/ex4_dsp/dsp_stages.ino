@@ -0,0 +1,175 @@
+/** \file dsp_stages.cpp
+ *  \brief Fixed-point filter stages for blocks of ADC samples.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "dsp_stages.h"
+
+#if defined(ARDUINO_ARCH_APOLLO3)
+
+int32_t dspDotQ15(const int16_t* x, const int16_t* h, uint8_t n)
+{
+  // SMLAD multiplies the two halves of each word and adds both products to
+  // the sum in one cycle. The history isn't always on a word boundary but the
+  // M4 is fine with unaligned single word loads, and memcpy() lets the
+  // compiler know that's what we're doing.
+  int32_t acc = 0;
+  for (; n >= 2; n -= 2) {
+    uint32_t xx, hh;
+    memcpy(&xx, x, sizeof(xx));
+    memcpy(&hh, h, sizeof(hh));
+    acc = (int32_t)__SMLAD(xx, hh, (uint32_t)acc);
+    x += 2;
+    h += 2;
+  }
+  if (n) {
+    acc += (int32_t)*x * *h;
+  }
+  return acc;
+}
+
+#else
+
+int32_t dspDotQ15(const int16_t* x, const int16_t* h, uint8_t n)
+{
+  // Two taps each time round keeps the loop overhead down. The casts make
+  // sure the compiler uses the 16 x 16 -> 32 bit multiply and not a 32 bit one.
+  int32_t acc = 0;
+  for (; n >= 2; n -= 2) {
+    acc += (int32_t)x[0] * h[0];
+    acc += (int32_t)x[1] * h[1];
+    x += 2;
+    h += 2;
+  }
+  if (n) {
+    acc += (int32_t)*x * *h;
+  }
+  return acc;
+}
+
+#endif
+
+uint16_t dspSqrt32(uint32_t x)
+{
+  // One bit of the result each time round, from the top
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > x) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint16_t)root;
+}
+
+PeakRms::PeakRms(uint16_t window)
+: m_window(window ? window : 1)
+{
+  reset();
+}
+
+size_t PeakRms::process(int16_t* buf, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    int16_t x = buf[i];
+    uint16_t mag = (x < 0) ? (uint16_t)(-(int32_t)x) : (uint16_t)x;
+    if (mag > m_peak_sofar) {
+      m_peak_sofar = mag;
+    }
+    m_sum_squares += (uint32_t)((int32_t)x * x);
+
+    if (++m_count >= m_window) {
+      // the mean square is at most 2^30 so it fits in 32 bits
+      m_peak = m_peak_sofar;
+      m_rms = dspSqrt32((uint32_t)(m_sum_squares / m_window));
+      m_available = true;
+      m_count = 0;
+      m_peak_sofar = 0;
+      m_sum_squares = 0;
+    }
+  }
+  return n;
+}
+
+void PeakRms::reset()
+{
+  m_count = 0;
+  m_peak_sofar = 0;
+  m_sum_squares = 0;
+  m_peak = 0;
+  m_rms = 0;
+  m_available = false;
+}
+
+DspPipeline::DspPipeline(uint8_t adc_bits)
+: m_p_first(0)
+, m_p_last(0)
+, m_shift(16 - adc_bits)
+{
+}
+
+DspPipeline& DspPipeline::add(DspStage& stage)
+{
+  stage.m_p_next = 0;
+  if (m_p_last) {
+    m_p_last->m_p_next = &stage;
+  } else {
+    m_p_first = &stage;
+  }
+  m_p_last = &stage;
+  return *this;
+}
+
+void DspPipeline::reset()
+{
+  for (DspStage* p = m_p_first; p; p = p->m_p_next) {
+    p->reset();
+  }
+}
+
+size_t DspPipeline::run(const uint16_t* samples, size_t n, int16_t* out, uint8_t stride)
+{
+  // Shift the sample up to the top of 16 bits and flip the top bit,
+  // which is the same as taking off half the range, so mid scale is zero.
+  for (size_t i = 0; i < n; i++) {
+    out[i] = (int16_t)((uint16_t)(*samples << m_shift) ^ 0x8000);
+    samples += stride;
+  }
+  return run(out, n);
+}
+
+size_t DspPipeline::run(int16_t* buf, size_t n)
+{
+  for (DspStage* p = m_p_first; p && n; p = p->m_p_next) {
+    n = p->process(buf, n);
+  }
+  return n;
+}
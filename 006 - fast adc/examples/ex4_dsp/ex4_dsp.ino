@@ -0,0 +1,138 @@
+/*
+ * Example 4 - Filtering and decimating the fast samples
+ *
+ * This example samples A0 at a steady 8000 samples per second in blocks and runs
+ * each block through a fixed-point filter pipeline before anything goes near the
+ * serial port. 8000 samples a second is more than 115200 baud can carry as text,
+ * so we filter out everything above about 180 Hz and only send 500 samples a second.
+ *
+ * The pipeline is:
+ *   - a 3rd order CIC decimator that takes the rate down by 8 to 1000 samples per
+ *     second. It doesn't need any multiplies so it's cheap enough on the ATmega
+ *     even at the full rate.
+ *   - a 23 tap low pass FIR that takes out what the CIC lets through above 200 Hz
+ *     and then decimates by 2 to 500 samples per second. It only works out the
+ *     outputs it keeps.
+ *   - a peak and RMS meter over one second of the filtered samples.
+ *
+ * Each filtered sample is printed on its own line as a signed Q15 number, which
+ * is the ADC value with mid scale at 0 and full scale at +/-32768, so you can watch
+ * it with the serial plotter. Once a second we print the peak, the RMS and the
+ * number of blocks we lost because the filters didn't keep up.
+ *
+ */
+
+#include "fast_adc.h"
+#include "dsp_stages.h"
+
+// The only port we sample. With no slow list every conversion is A0 so the
+// samples are evenly spaced at SAMPLE_RATE.
+uint8_t fast_ports[] = {A0};
+#define NUM_FAST_PORTS sizeof(fast_ports) / sizeof(uint8_t)
+
+#define SAMPLE_RATE 8000
+
+// The samples in each block. The ISR fills one of these every 8 ms.
+#define BLOCK_SIZE 64
+
+// The full scale of the ADC in mV for printing the peak and RMS
+#define ADC_FULL_SCALE_MV 5000
+
+// A 23 tap Hamming windowed low pass with the cutoff at 0.22 of its input rate.
+// At the 1000 samples per second coming out of the CIC it's flat to 150 Hz,
+// 3 dB down at 200 Hz, 15 dB down at 250 Hz and more than 50 dB down from
+// 300 Hz. 250 Hz is the Nyquist of the 500 samples per second we keep, so
+// 250 to 300 Hz isn't taken out all the way and folds back into 200 to
+// 250 Hz. Only trust the output up to 200 Hz. The taps add up to 32767.
+const int16_t lowpass_coeffs[23] = {
+  36, 98, -22, -310, -129, 744, 740, -1301, -2463, 1775, 10026, 14379,
+  10026, 1775, -2463, -1301, 740, 744, -129, -310, -22, 98, 36
+};
+
+// declare our class that derives from FastAdc and filters the blocks as they come in
+class MyAdc : public FastAdc<MyAdc>
+{
+public:
+  MyAdc()
+  : FastAdc<MyAdc>(fast_ports, NUM_FAST_PORTS, 0, 0, SAMPLE_RATE)
+  , m_fir(lowpass_coeffs)
+  , m_meter(SAMPLE_RATE / 16)
+  {
+    m_pipeline.add(m_cic).add(m_fir).add(m_meter);
+  }
+
+  // Get the peak and RMS meter
+  PeakRms& meter()
+  {
+    return m_meter;
+  }
+
+protected:
+  // FastAdc calls onBlockReady() directly so it needs to be able to see it
+  friend class FastAdc<MyAdc>;
+
+  // Called from poll() with each full block, outside the ISR.
+  // The filters have 8 ms to finish before the ISR needs this buffer back.
+  void onBlockReady(const uint16_t* buf, size_t n)
+  {
+    size_t n_out = m_pipeline.run(buf, n, m_out);
+
+    // a 64 sample block gives us 4 outputs, about 28 characters
+    for (size_t i = 0; i < n_out; i++) {
+      Serial.println(m_out[i]);
+    }
+  }
+
+private:
+  CicDecimator<3, 3> m_cic;
+  FirFilter<23, 2> m_fir;
+  PeakRms m_meter;
+  DspPipeline m_pipeline;
+  int16_t m_out[BLOCK_SIZE];
+};
+
+// Create the FastADC object that will sample the ports
+// and hook it up to the ADC interrupt
+MyAdc my_adc;
+FAST_ADC_ISR(my_adc);
+
+// The ping pong buffers the ISR fills
+uint16_t g_block_a[BLOCK_SIZE];
+uint16_t g_block_b[BLOCK_SIZE];
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println("\n\n\nFast ADC filter demo\n\n");
+
+  // start the ADC conversions. The samples come to onBlockReady()
+  if (!my_adc.beginBlockCapture(g_block_a, g_block_b, BLOCK_SIZE)) {
+    Serial.println("FastAdc::beginBlockCapture() failed. Is my_adc the object in FAST_ADC_ISR()?");
+    return;
+  }
+  Serial.print("Sample rate: ");
+  Serial.println(my_adc.getSampleRate());
+}
+
+// convert a Q15 magnitude to millivolts
+uint16_t q15tomv(uint16_t q)
+{
+  return (uint16_t)(((uint32_t)q * ADC_FULL_SCALE_MV) >> 16);
+}
+
+void loop()
+{
+  // filter any block that's ready
+  my_adc.poll();
+
+  // print the meter once a second when it has a new window
+  PeakRms& meter = my_adc.meter();
+  if (meter.available()) {
+    char buf[80];
+    uint16_t peak = meter.getPeak();
+    uint16_t rms = meter.getRms();
+    sprintf(buf, "Peak: %u mV, RMS: %u mV, %lu lost blocks",
+        q15tomv(peak), q15tomv(rms), (unsigned long)my_adc.getBlockOverruns());
+    Serial.println(buf);
+  }
+}
@@ -0,0 +1,119 @@
+/** \file cobs_frame.h
+ *  \brief Framing for binary data sent over the serial port.
+ *
+ *  Each frame looks like this before it is encoded:
+ *
+ *    seq       8-bits  frame sequence number, goes up by one for each frame
+ *    type      8-bits  what is in the payload (FRAME_TYPE_xxx)
+ *    payload   0..FRAME_MAX_PAYLOAD bytes
+ *    crc       16-bits CRC-16/CCITT-FALSE of seq, type and payload (little endian)
+ *
+ *  The whole thing is then COBS encoded (Consistent Overhead Byte Stuffing)
+ *  so there are no zero bytes in it, and a single zero byte is sent after
+ *  it to mark the end of the frame. The receiver can always find the start of
+ *  the next frame by looking for a zero, no matter what values are in the
+ *  data, and the CRC tells it if the frame was damaged. A gap in the sequence
+ *  numbers tells it that frames were lost.
+ *
+ *  Ref: https://en.wikipedia.org/wiki/Consistent_Overhead_Byte_Stuffing
+ *
+ *  The matching Python code is in python/framing.py
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _COBS_FRAME_H_
+#define _COBS_FRAME_H_
+
+#include "Arduino.h"
+
+// The largest payload we can put in one frame. The frame that's encoded is
+// the payload plus 4 bytes for the sequence number, type and CRC, and that
+// has to be 253 bytes or less so the COBS encoding only ever adds one byte.
+// So the payload can be up to 249 bytes.
+#ifndef FRAME_MAX_PAYLOAD
+#define FRAME_MAX_PAYLOAD 64
+#endif
+
+static_assert(FRAME_MAX_PAYLOAD + 4 <= 253, "FRAME_MAX_PAYLOAD is too big for one COBS block");
+
+// Frame payload types
+#define FRAME_TYPE_RECORDS 1 // a batch of (uint32 time, uint16 v1, uint16 v2) records
+#define FRAME_TYPE_DELTA   2 // delta compressed records (see delta_encoder.h)
+#define FRAME_TYPE_BANDS   3 // spectrum band levels (see the ex5_spectrum FastAdc example)
+#define FRAME_TYPE_PEAKS   4 // the biggest peaks in a spectrum
+
+/// \brief Compute a CRC-16/CCITT-FALSE over a block of bytes.
+/// \param p_data The bytes.
+/// \param len The number of bytes.
+/// \param crc The starting value. Use the result of a previous call
+/// to compute the CRC over several blocks.
+/// \return The CRC.
+uint16_t crc16(const uint8_t* p_data, size_t len, uint16_t crc = 0xFFFF);
+
+/// \brief COBS encode a block of bytes.
+/// This does not add the zero byte at the end.
+/// \param p_src The bytes to encode.
+/// \param len The number of bytes. Must be 253 or less, as this never
+/// starts a new block with a 0xFF code.
+/// \param p_dst Where to put the encoded bytes. This must have room for len + 1 bytes.
+/// \return The number of encoded bytes.
+size_t cobsEncode(const uint8_t* p_src, size_t len, uint8_t* p_dst);
+
+/// \brief Collects data into a frame and sends it.
+class FrameWriter
+{
+public:
+  /// \brief Construct the writer.
+  /// \param out Where to send the frames, usually Serial.
+  FrameWriter(Print& out);
+
+  /// \brief Add some data to the current frame.
+  /// \param p_data The data to add.
+  /// \param len The number of bytes to add.
+  /// \return False if there isn't room for it. Nothing is added in that case.
+  bool add(const void* p_data, uint8_t len);
+
+  /// \brief Get the number of payload bytes still free in the current frame.
+  uint8_t space() const
+  {
+    return FRAME_MAX_PAYLOAD - m_len;
+  }
+
+  /// \brief Encode the current frame and send it with a single write.
+  /// \param type The payload type (FRAME_TYPE_xxx).
+  void send(uint8_t type);
+
+private:
+  Print& m_out;
+  uint8_t m_seq;
+  uint8_t m_len; // payload bytes collected so far
+
+  // seq, type, payload, crc
+  uint8_t m_frame[2 + FRAME_MAX_PAYLOAD + 2];
+
+  // the encoded frame plus the COBS overhead byte and the zero at the end
+  uint8_t m_tx[sizeof(m_frame) + 2];
+};
+
+#endif // _COBS_FRAME_H_
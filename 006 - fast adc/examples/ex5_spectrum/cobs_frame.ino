@@ -0,0 +1,101 @@
+/** \file cobs_frame.cpp
+ *  \brief Framing for binary data sent over the serial port.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cobs_frame.h"
+
+uint16_t crc16(const uint8_t* p_data, size_t len, uint16_t crc)
+{
+  // This is the byte at a time version of the CCITT polynomial (0x1021)
+  // which is quick without needing a lookup table
+  while (len--) {
+    crc = (crc >> 8) | (crc << 8);
+    crc ^= *p_data++;
+    crc ^= (crc & 0xFF) >> 4;
+    crc ^= crc << 12;
+    crc ^= (crc & 0xFF) << 5;
+  }
+  return crc;
+}
+
+size_t cobsEncode(const uint8_t* p_src, size_t len, uint8_t* p_dst)
+{
+  // Each zero byte in the source is replaced by the distance to the next zero.
+  // The first output byte is the distance to the first zero.
+  uint8_t* p_code = p_dst; // where the current distance goes
+  uint8_t* p_out = p_dst + 1;
+  uint8_t code = 1;
+
+  for (size_t n = 0; n < len; n++) {
+    uint8_t b = p_src[n];
+    if (b == 0) {
+      *p_code = code;
+      p_code = p_out++;
+      code = 1;
+    } else {
+      *p_out++ = b;
+      code++;
+    }
+  }
+  *p_code = code;
+
+  return p_out - p_dst;
+}
+
+FrameWriter::FrameWriter(Print& out)
+: m_out(out)
+, m_seq(0)
+, m_len(0)
+{
+}
+
+bool FrameWriter::add(const void* p_data, uint8_t len)
+{
+  if (len > space()) {
+    return false;
+  }
+  memcpy(&m_frame[2 + m_len], p_data, len);
+  m_len += len;
+  return true;
+}
+
+void FrameWriter::send(uint8_t type)
+{
+  // fill in the header and the CRC
+  m_frame[0] = m_seq++;
+  m_frame[1] = type;
+  size_t len = 2 + m_len;
+  uint16_t crc = crc16(m_frame, len);
+  m_frame[len++] = crc & 0xFF;
+  m_frame[len++] = crc >> 8;
+
+  // encode it, add the end of frame marker and send it all in one go
+  size_t tx_len = cobsEncode(m_frame, len, m_tx);
+  m_tx[tx_len++] = 0;
+  m_out.write(m_tx, tx_len);
+
+  // start a new frame
+  m_len = 0;
+}
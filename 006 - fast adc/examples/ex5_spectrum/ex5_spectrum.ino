@@ -0,0 +1,156 @@
+/*
+ * Example 5 - Sending a spectrum instead of the samples
+ *
+ * This example samples A0 at a steady rate in blocks, does an FFT of each block on
+ * the board and sends a summary of the spectrum over the serial port rather than
+ * the samples, using the same COBS frames as the binary data capture example.
+ * Use python/spectrum.py in "002 - data capture" to receive it.
+ *
+ * For each block we can send:
+ *   - FRAME_TYPE_BANDS: the level in each of NUM_BANDS equal width bands
+ *   - FRAME_TYPE_PEAKS: the NUM_PEAKS biggest peaks and their frequencies
+ * Both together are about 80 bytes for each block, however big the FFT is.
+ *
+ * Both payloads start with the same header:
+ *   time       32-bits  micros() when the block was handed over
+ *   rate       32-bits  the sample rate in samples per second
+ *   log2n      8-bits   the FFT was 2 ^ log2n points, so bin k is at k x rate / 2 ^ log2n Hz
+ * A FRAME_TYPE_BANDS payload follows that with:
+ *   bins       8-bits   the number of FFT bins in each band, starting at bin 0
+ *   levels     16-bits  the level of each band
+ * A FRAME_TYPE_PEAKS payload follows it with, biggest first:
+ *   bin        16-bits  the FFT bin of the peak
+ *   level      16-bits  the level of the peak
+ * All the levels are the amplitude of a sine in Q15, so 32768 is a sine that swings
+ * over the whole ADC range. Everything is little endian.
+ *
+ */
+
+#include "fast_adc.h"
+#include "cobs_frame.h"
+#include "fft_q15.h"
+
+// The only port we sample. With no slow list every conversion is A0 so the
+// samples are evenly spaced at SAMPLE_RATE.
+uint8_t fast_ports[] = {A0};
+#define NUM_FAST_PORTS sizeof(fast_ports) / sizeof(uint8_t)
+
+#define SAMPLE_RATE 2048
+
+// The size of the FFT, and of each block of samples.
+// The blocks and the FFT arrays take 8 bytes for each point, which is all
+// the Uno can spare at 128 points.
+#ifdef ARDUINO_ARCH_APOLLO3
+#define FFT_LOG2 9
+#else
+#define FFT_LOG2 7
+#endif
+#define FFT_SIZE (1 << FFT_LOG2)
+#define NUM_BINS (FFT_SIZE / 2)
+
+// What to send for each block. Set either of these to 0 to turn it off.
+#define SEND_BANDS 1
+#define SEND_PEAKS 1
+#define NUM_BANDS 16
+#define NUM_PEAKS 5
+
+// The serial baud rate. Remember to tell spectrum.py with the -b option.
+#define BAUD_RATE 115200
+
+// The start of each spectrum payload.
+// Packed so there is no padding between the fields on any board.
+struct SpectrumHeader
+{
+  uint32_t time;
+  uint32_t rate;
+  uint8_t log2n;
+} __attribute__((packed));
+
+// The frame we send the spectrum summaries in
+FrameWriter g_frame(Serial);
+
+// declare our class that derives from FastAdc and does an FFT of each block
+class MyAdc : public FastAdc<MyAdc>
+{
+public:
+  MyAdc()
+  : FastAdc<MyAdc>(fast_ports, NUM_FAST_PORTS, 0, 0, SAMPLE_RATE)
+  {
+  }
+
+protected:
+  // FastAdc calls onBlockReady() directly so it needs to be able to see it
+  friend class FastAdc<MyAdc>;
+
+  // Called from poll() with each full block, outside the ISR.
+  // We have until the ISR fills the other buffer, FFT_SIZE / SAMPLE_RATE seconds.
+  void onBlockReady(const uint16_t* buf, size_t n)
+  {
+    SpectrumHeader header;
+    header.time = micros();
+    header.rate = getSampleRate();
+    header.log2n = FFT_LOG2;
+
+    // The 10-bit samples go to the top of 16 bits with mid scale at 0
+    for (size_t i = 0; i < FFT_SIZE; i++) {
+      m_re[i] = (int16_t)((uint16_t)(buf[i] << 6) ^ 0x8000);
+      m_im[i] = 0;
+    }
+    fftRemoveMean(m_re, FFT_LOG2);
+    fftWindowHann(m_re, FFT_LOG2);
+    uint8_t scale = fftQ15(m_re, m_im, FFT_LOG2);
+
+    // the magnitudes go back in m_re as it's not needed any more
+    uint16_t* mag = (uint16_t*)m_re;
+    fftMagnitudes(m_re, m_im, FFT_LOG2, scale, mag);
+
+#if SEND_BANDS
+    uint16_t bands[NUM_BANDS];
+    fftBands(mag, NUM_BINS, bands, NUM_BANDS);
+    uint8_t bins_per_band = NUM_BINS / NUM_BANDS;
+    g_frame.add(&header, sizeof(header));
+    g_frame.add(&bins_per_band, sizeof(bins_per_band));
+    g_frame.add(bands, sizeof(bands));
+    g_frame.send(FRAME_TYPE_BANDS);
+#endif
+
+#if SEND_PEAKS
+    FftPeak peaks[NUM_PEAKS];
+    uint8_t num_peaks = fftPeaks(mag, NUM_BINS, peaks, NUM_PEAKS);
+    g_frame.add(&header, sizeof(header));
+    g_frame.add(peaks, num_peaks * sizeof(FftPeak));
+    g_frame.send(FRAME_TYPE_PEAKS);
+#endif
+  }
+
+private:
+  int16_t m_re[FFT_SIZE];
+  int16_t m_im[FFT_SIZE];
+};
+
+// Create the FastADC object that will sample the ports
+// and hook it up to the ADC interrupt
+MyAdc my_adc;
+FAST_ADC_ISR(my_adc);
+
+// The ping pong buffers the ISR fills
+uint16_t g_block_a[FFT_SIZE];
+uint16_t g_block_b[FFT_SIZE];
+
+void setup()
+{
+  Serial.begin(BAUD_RATE);
+
+  // start the ADC conversions. The samples come to onBlockReady()
+  if (!my_adc.beginBlockCapture(g_block_a, g_block_b, FFT_SIZE)) {
+    // not a frame, so spectrum.py just counts it as a bad one, but you can
+    // read it in the Serial Monitor
+    Serial.println("FastAdc::beginBlockCapture() failed. Is my_adc the object in FAST_ADC_ISR()?");
+  }
+}
+
+void loop()
+{
+  // do the FFT of any block that's ready
+  my_adc.poll();
+}
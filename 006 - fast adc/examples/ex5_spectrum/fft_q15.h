@@ -0,0 +1,131 @@
+/** \file fft_q15.h
+ *  \brief A fixed-point FFT and spectrum summaries for blocks of samples.
+ *
+ *  This is a radix-2 decimation in time FFT on 16-bit Q15 numbers, done in
+ *  place on separate real and imaginary arrays:
+ *
+ *    int16_t re[128], im[128];
+ *    ... fill re with the samples and im with zeros ...
+ *    fftRemoveMean(re, 7);
+ *    fftWindowHann(re, 7);
+ *    uint8_t scale = fftQ15(re, im, 7);
+ *    fftMagnitudes(re, im, 7, scale, mag);   // 64 bins
+ *
+ *  Each stage of the FFT can double the values, so to stay inside 16 bits
+ *  a stage halves its outputs whenever its inputs are big enough to
+ *  overflow. Small signals keep all their bits that way. fftQ15() returns
+ *  the number of stages that halved, which fftMagnitudes() needs to put the
+ *  scale back.
+ *
+ *  The twiddle factors come from a table of a quarter of a sine wave in
+ *  PROGMEM, so it's in flash on the ATmega and costs no RAM. The table is
+ *  for FFT_MAX_SIZE points and any smaller power of two just steps through
+ *  it faster.
+ *
+ *  The magnitudes are the amplitude of the sine wave at each bin frequency
+ *  in Q15, so a sine that swings over the whole ADC range is 32768. Bin k
+ *  is at k x sample rate / N Hz.
+ *
+ *  Rather than send all the bins you can boil them down with fftBands(),
+ *  which gives one level for each group of bins, or fftPeaks(), which finds
+ *  the biggest peaks.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _FFT_Q15_H_
+#define _FFT_Q15_H_
+
+#include "Arduino.h"
+
+// The largest FFT the twiddle table can do is 2 ^ FFT_MAX_LOG2 points
+#define FFT_MAX_LOG2 9
+#define FFT_MAX_SIZE (1 << FFT_MAX_LOG2)
+
+/// \brief sin(2 pi k / FFT_MAX_SIZE) in Q15.
+int16_t fftSin(uint16_t k);
+
+/// \brief cos(2 pi k / FFT_MAX_SIZE) in Q15.
+inline int16_t fftCos(uint16_t k)
+{
+  return fftSin(k + FFT_MAX_SIZE / 4);
+}
+
+/// \brief The integer square root of a 32-bit number.
+uint16_t fftSqrt32(uint32_t x);
+
+/// \brief Take the average off a block of samples.
+/// Do this before the window or the DC leaks into the first few bins.
+/// \param x The 2 ^ log2n samples.
+void fftRemoveMean(int16_t* x, uint8_t log2n);
+
+/// \brief Apply a Hann window to a block of samples.
+/// Without a window a tone that isn't exactly on a bin frequency spreads
+/// out over the whole spectrum.
+/// \param x The 2 ^ log2n samples.
+void fftWindowHann(int16_t* x, uint8_t log2n);
+
+/// \brief Do an FFT in place.
+/// \param re The real parts. The outputs are in the normal order.
+/// \param im The imaginary parts. Set them to zero for real samples.
+/// \param log2n The FFT is 2 ^ log2n points, up to FFT_MAX_LOG2.
+/// \return The number of stages that halved their outputs.
+uint8_t fftQ15(int16_t* re, int16_t* im, uint8_t log2n);
+
+/// \brief Work out the amplitudes of the first half of the bins.
+/// This assumes the samples were real and had a Hann window.
+/// \param re The real parts from fftQ15().
+/// \param im The imaginary parts from fftQ15().
+/// \param log2n The size of the FFT.
+/// \param scale What fftQ15() returned.
+/// \param mag Where the 2 ^ (log2n - 1) amplitudes go. This can be \p re.
+void fftMagnitudes(const int16_t* re, const int16_t* im, uint8_t log2n, uint8_t scale, uint16_t* mag);
+
+/// \brief Add up runs of bins into bands.
+/// Each band is the RMS of its bins, so a tone that falls in a band gives
+/// its amplitude no matter how the window spreads it over the bins.
+/// \param mag The amplitudes from fftMagnitudes().
+/// \param num_bins The number of amplitudes.
+/// \param bands Where the band levels go.
+/// \param num_bands The number of bands. The bins are shared out evenly and
+/// any left over at the top are ignored.
+void fftBands(const uint16_t* mag, uint16_t num_bins, uint16_t* bands, uint8_t num_bands);
+
+/// \brief A peak in the spectrum.
+struct FftPeak
+{
+  uint16_t bin;
+  uint16_t mag;
+} __attribute__((packed));
+
+/// \brief Find the biggest peaks in the spectrum.
+/// A peak is a bin that's bigger than the bins on each side of it. Bin 0
+/// is left out as it's the DC.
+/// \param mag The amplitudes from fftMagnitudes().
+/// \param num_bins The number of amplitudes.
+/// \param peaks Where the peaks go, biggest first.
+/// \param max_peaks The most peaks to find.
+/// \return The number of peaks found.
+uint8_t fftPeaks(const uint16_t* mag, uint16_t num_bins, FftPeak* peaks, uint8_t max_peaks);
+
+#endif // _FFT_Q15_H_
@@ -0,0 +1,230 @@
+/** \file fft_q15.cpp
+ *  \brief A fixed-point FFT and spectrum summaries for blocks of samples.
+ *
+ * MIT License:
+ *
+ * Copyright 2022 Nigel Thompson
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "fft_q15.h"
+
+// sin(2 pi k / 512) in Q15 for k = 0..128, a quarter of a sine wave.
+// The rest of the wave is the same numbers backwards and upside down.
+// Made with:
+//   [min(32767, round(32768 * sin(2 * pi * k / 512))) for k in range(129)]
+static const int16_t fft_quarter_sine[FFT_MAX_SIZE / 4 + 1] PROGMEM = {
+  0, 402, 804, 1206, 1608, 2009, 2411, 2811, 3212, 3612, 4011, 4410,
+  4808, 5205, 5602, 5998, 6393, 6787, 7180, 7571, 7962, 8351, 8740, 9127,
+  9512, 9896, 10279, 10660, 11039, 11417, 11793, 12167, 12540, 12910, 13279, 13646,
+  14010, 14373, 14733, 15091, 15447, 15800, 16151, 16500, 16846, 17190, 17531, 17869,
+  18205, 18538, 18868, 19195, 19520, 19841, 20160, 20475, 20788, 21097, 21403, 21706,
+  22006, 22302, 22595, 22884, 23170, 23453, 23732, 24008, 24279, 24548, 24812, 25073,
+  25330, 25583, 25833, 26078, 26320, 26557, 26791, 27020, 27246, 27467, 27684, 27897,
+  28106, 28311, 28511, 28707, 28899, 29086, 29269, 29448, 29622, 29792, 29957, 30118,
+  30274, 30425, 30572, 30715, 30853, 30986, 31114, 31238, 31357, 31471, 31581, 31686,
+  31786, 31881, 31972, 32058, 32138, 32214, 32286, 32352, 32413, 32470, 32522, 32568,
+  32610, 32647, 32679, 32706, 32729, 32746, 32758, 32766, 32767
+};
+
+// If the |re| + |im| of every input to a stage is under this, none of its
+// outputs can overflow so the stage doesn't need to halve them. It leaves a
+// little room for the rounding.
+#define FFT_SAFE_LIMIT 16000
+
+int16_t fftSin(uint16_t k)
+{
+  const uint16_t quarter = FFT_MAX_SIZE / 4;
+  k &= FFT_MAX_SIZE - 1;
+  if (k <= quarter) {
+    return (int16_t)pgm_read_word(&fft_quarter_sine[k]);
+  } else if (k <= 2 * quarter) {
+    return (int16_t)pgm_read_word(&fft_quarter_sine[2 * quarter - k]);
+  } else if (k <= 3 * quarter) {
+    return -(int16_t)pgm_read_word(&fft_quarter_sine[k - 2 * quarter]);
+  }
+  return -(int16_t)pgm_read_word(&fft_quarter_sine[4 * quarter - k]);
+}
+
+uint16_t fftSqrt32(uint32_t x)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > x) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint16_t)root;
+}
+
+void fftRemoveMean(int16_t* x, uint8_t log2n)
+{
+  uint16_t n = 1 << log2n;
+  int32_t sum = 0;
+  for (uint16_t i = 0; i < n; i++) {
+    sum += x[i];
+  }
+  int16_t mean = (int16_t)(sum >> log2n);
+  for (uint16_t i = 0; i < n; i++) {
+    // can only overflow if the samples went from one end of the range to
+    // the other, so just clip
+    int32_t v = (int32_t)x[i] - mean;
+    x[i] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : (int16_t)v);
+  }
+}
+
+void fftWindowHann(int16_t* x, uint8_t log2n)
+{
+  // w[i] = (1 - cos(2 pi i / n)) / 2
+  uint16_t n = 1 << log2n;
+  uint8_t step = FFT_MAX_LOG2 - log2n;
+  for (uint16_t i = 0; i < n; i++) {
+    int32_t w = (32767L - fftCos(i << step)) >> 1;
+    x[i] = (int16_t)(((int32_t)x[i] * w) >> 15);
+  }
+}
+
+uint8_t fftQ15(int16_t* re, int16_t* im, uint8_t log2n)
+{
+  uint16_t n = 1 << log2n;
+
+  // Put the inputs in bit reversed order so the outputs come out in order
+  for (uint16_t i = 1, j = 0; i < n; i++) {
+    uint16_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j |= bit;
+    if (i < j) {
+      int16_t t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+
+  uint8_t scale = 0;
+  for (uint8_t stage = 1; stage <= log2n; stage++) {
+    // see if this stage needs to halve its outputs
+    uint8_t shift = 0;
+    for (uint16_t i = 0; i < n; i++) {
+      int32_t r = re[i];
+      int32_t m = im[i];
+      if (((r < 0) ? -r : r) + ((m < 0) ? -m : m) >= FFT_SAFE_LIMIT) {
+        shift = 1;
+        scale++;
+        break;
+      }
+    }
+
+    uint16_t half = 1 << (stage - 1);
+    uint8_t step = FFT_MAX_LOG2 - stage; // twiddle table step is FFT_MAX_SIZE / (2 * half)
+    for (uint16_t j = 0; j < half; j++) {
+      // the twiddle is e^(-2 pi i j / (2 * half))
+      int16_t wr = fftCos(j << step);
+      int16_t wi = -fftSin(j << step);
+      for (uint16_t a = j; a < n; a += 2 * half) {
+        uint16_t b = a + half;
+        int32_t tr = ((int32_t)wr * re[b] - (int32_t)wi * im[b]) >> 15;
+        int32_t ti = ((int32_t)wr * im[b] + (int32_t)wi * re[b]) >> 15;
+        int32_t ar = re[a];
+        int32_t ai = im[a];
+        re[a] = (int16_t)((ar + tr) >> shift);
+        im[a] = (int16_t)((ai + ti) >> shift);
+        re[b] = (int16_t)((ar - tr) >> shift);
+        im[b] = (int16_t)((ai - ti) >> shift);
+      }
+    }
+  }
+  return scale;
+}
+
+void fftMagnitudes(const int16_t* re, const int16_t* im, uint8_t log2n, uint8_t scale, uint16_t* mag)
+{
+  // The true FFT is the output times 2 ^ scale. Dividing by n / 2 gives the
+  // amplitude of a sine, and the Hann window halves that again, so the
+  // amplitude is |out| x 2 ^ (scale + 2 - log2n).
+  uint16_t num_bins = 1 << (log2n - 1);
+  int8_t shift = (int8_t)scale + 2 - (int8_t)log2n;
+  for (uint16_t k = 0; k < num_bins; k++) {
+    int32_t r = re[k];
+    int32_t i = im[k];
+    uint32_t m = fftSqrt32((uint32_t)(r * r) + (uint32_t)(i * i));
+    if (shift >= 0) {
+      m <<= shift;
+    } else {
+      m >>= -shift;
+    }
+    mag[k] = (m > 0xFFFF) ? 0xFFFF : (uint16_t)m;
+  }
+}
+
+void fftBands(const uint16_t* mag, uint16_t num_bins, uint16_t* bands, uint8_t num_bands)
+{
+  uint16_t per_band = num_bins / num_bands;
+  for (uint8_t b = 0; b < num_bands; b++) {
+    // The window spreads a tone over the bins so their squares add up to 1.5
+    // times the square of its amplitude. Take that out to get the amplitude back.
+    uint64_t sum = 0;
+    for (uint16_t k = 0; k < per_band; k++) {
+      uint32_t m = *mag++;
+      sum += m * m;
+    }
+    uint64_t ms = sum * 2 / 3;
+    bands[b] = (ms > 0xFFFFFFFFUL) ? 0xFFFF : fftSqrt32((uint32_t)ms);
+  }
+}
+
+uint8_t fftPeaks(const uint16_t* mag, uint16_t num_bins, FftPeak* peaks, uint8_t max_peaks)
+{
+  uint8_t count = 0;
+  for (uint16_t k = 1; k < num_bins; k++) {
+    uint16_t m = mag[k];
+    if ((m == 0) || (m <= mag[k - 1]) || ((k + 1 < num_bins) && (m < mag[k + 1]))) {
+      continue;
+    }
+    // keep the list sorted, biggest first, and drop the smallest when it's full
+    uint8_t pos = count;
+    while ((pos > 0) && (peaks[pos - 1].mag < m)) {
+      if (pos < max_peaks) {
+        peaks[pos] = peaks[pos - 1];
+      }
+      pos--;
+    }
+    if (pos < max_peaks) {
+      peaks[pos].bin = k;
+      peaks[pos].mag = m;
+      if (count < max_peaks) {
+        count++;
+      }
+    }
+  }
+  return count;
+}